@@ -101,7 +101,7 @@ int main(int argc, char** argv)
 		return 0;
 	}
 
-	J = js_newstate(NULL, NULL, JS_STRICT);
+	J = js_newstate(NULL, NULL, JS_STRICT, NULL);
 
 	js_newcfunction(J, jsB_gc, "gc", 0);
 	js_setglobal(J, "gc");
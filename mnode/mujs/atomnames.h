@@ -0,0 +1,24 @@
+"length",
+"prototype",
+"constructor",
+"toString",
+"valueOf",
+"callee",
+"arguments",
+"name",
+"message",
+"stackTrace",
+"source",
+"global",
+"ignoreCase",
+"multiline",
+"lastIndex",
+"index",
+"input",
+"toJSON",
+"value",
+"writable",
+"enumerable",
+"configurable",
+"get",
+"set",
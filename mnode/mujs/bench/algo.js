@@ -0,0 +1,44 @@
+// Recursion, a sieve, quicksort and a matrix product.
+// Run with the mujs shell: build/mujs bench/algo.js
+
+var T0 = Date.now();
+function fib(n) { return n < 2 ? n : fib(n - 1) + fib(n - 2); }
+fib(20);
+function sieve(n) {
+	var a = [], primes = 0;
+	for (var i = 0; i <= n; i++) a[i] = true;
+	for (var i = 2; i <= n; i++) {
+		if (a[i]) { primes++; for (var j = i * i; j <= n; j += i) a[j] = false; }
+	}
+	return primes;
+}
+sieve(20000);
+function qsort(arr, lo, hi) {
+	if (lo >= hi) return;
+	var p = arr[(lo + hi) >> 1], i = lo, j = hi;
+	while (i <= j) {
+		while (arr[i] < p) i++;
+		while (arr[j] > p) j--;
+		if (i <= j) { var t = arr[i]; arr[i] = arr[j]; arr[j] = t; i++; j--; }
+	}
+	qsort(arr, lo, j); qsort(arr, i, hi);
+}
+var data = [];
+for (var i = 0; i < 5000; i++) data.push((i * 7919) % 10007);
+qsort(data, 0, data.length - 1);
+function matmul(a, b, n) {
+	var c = [];
+	for (var i = 0; i < n; i++) {
+		c[i] = [];
+		for (var j = 0; j < n; j++) {
+			var s = 0;
+			for (var k = 0; k < n; k++) s += a[i][k] * b[k][j];
+			c[i][j] = s;
+		}
+	}
+	return c;
+}
+var m = [];
+for (var i = 0; i < 24; i++) { m[i] = []; for (var j = 0; j < 24; j++) m[i][j] = i + j; }
+matmul(m, m, 24);
+print("algo", Date.now() - T0, "ms");
@@ -0,0 +1,29 @@
+// Interpreter dispatch on calls.
+// Run with the mujs shell: build/mujs bench/call.js
+
+function bench(name, f) {
+	var t0 = Date.now();
+	var r = f();
+	print(name, Date.now() - t0, "ms", r);
+}
+
+function fib(n) { return n < 2 ? n : fib(n - 1) + fib(n - 2); }
+bench("fib(25)", function () { return fib(25); });
+
+function counter() { var c = 0; return function (x) { c += x; return c; }; }
+bench("closure call", function () {
+	var f = counter(), r;
+	for (var i = 0; i < 300000; i++) r = f(i);
+	return r;
+});
+
+function sum() {
+	var s = 0;
+	for (var i = 0; i < arguments.length; i++) s += arguments[i];
+	return s;
+}
+bench("arguments", function () {
+	var s = 0;
+	for (var i = 0; i < 100000; i++) s += sum(1, 2, 3);
+	return s;
+});
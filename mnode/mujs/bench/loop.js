@@ -0,0 +1,38 @@
+// Interpreter dispatch on tight loops.
+// Run with the mujs shell: build/mujs bench/loop.js
+
+function bench(name, f) {
+	var t0 = Date.now();
+	var r = f();
+	print(name, Date.now() - t0, "ms", r);
+}
+
+var gs, gi;
+bench("global loop", function () {
+	gs = 0;
+	for (gi = 0; gi < 3000000; gi++) gs = gs + gi;
+	return gs;
+});
+
+bench("local loop", function () {
+	var s = 0;
+	for (var i = 0; i < 3000000; i++) s = (s + i * 3) & 0xffff;
+	return s;
+});
+
+bench("arith mix", function () {
+	var a = 0, b = 1;
+	for (var i = 0; i < 2000000; i++) {
+		var c = a - b;
+		a = b;
+		b = c * 2 % 1000;
+		if (a < b) a++;
+	}
+	return a + b;
+});
+
+bench("float loop", function () {
+	var x = 0.5;
+	for (var i = 0; i < 2000000; i++) x = x * 1.0000001 + 0.1;
+	return x.toFixed(3);
+});
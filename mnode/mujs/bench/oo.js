@@ -0,0 +1,50 @@
+// Prototype methods and constructors: an n-body step and a BFS.
+// Run with the mujs shell: build/mujs bench/oo.js
+
+var T0 = Date.now();
+function Vec(x, y, z) { this.x = x; this.y = y; this.z = z; }
+Vec.prototype.add = function (o) { return new Vec(this.x + o.x, this.y + o.y, this.z + o.z); };
+Vec.prototype.scale = function (k) { return new Vec(this.x * k, this.y * k, this.z * k); };
+Vec.prototype.dot = function (o) { return this.x * o.x + this.y * o.y + this.z * o.z; };
+function Body(p, v, m) { this.p = p; this.v = v; this.m = m; }
+Body.prototype.step = function (dt) { this.p = this.p.add(this.v.scale(dt)); };
+var bodies = [];
+for (var i = 0; i < 50; i++)
+	bodies.push(new Body(new Vec(i, i * 2, i * 3), new Vec(1, 0.5, 0.25), i + 1));
+function energy(list) {
+	var e = 0;
+	for (var i = 0; i < list.length; i++) {
+		var b = list[i];
+		e += 0.5 * b.m * b.v.dot(b.v);
+		for (var j = i + 1; j < list.length; j++) {
+			var dx = list[i].p.x - list[j].p.x;
+			var dy = list[i].p.y - list[j].p.y;
+			e -= b.m * list[j].m / Math.sqrt(dx * dx + dy * dy + 1);
+		}
+	}
+	return e;
+}
+for (var n = 0; n < 60; n++) {
+	for (var k = 0; k < bodies.length; k++)
+		bodies[k].step(0.01);
+	energy(bodies);
+}
+function Queue() { this.items = []; this.head = 0; }
+Queue.prototype.push = function (x) { this.items.push(x); };
+Queue.prototype.shift = function () { return this.items[this.head++]; };
+Queue.prototype.isEmpty = function () { return this.head >= this.items.length; };
+var graph = {};
+for (var i = 0; i < 300; i++) graph[i] = [(i * 7) % 300, (i * 13 + 1) % 300, (i + 1) % 300];
+function bfs(start) {
+	var seen = {}, q = new Queue(), count = 0;
+	q.push(start); seen[start] = true;
+	while (!q.isEmpty()) {
+		var n = q.shift(); count++;
+		var edges = graph[n];
+		for (var i = 0; i < edges.length; i++)
+			if (!seen[edges[i]]) { seen[edges[i]] = true; q.push(edges[i]); }
+	}
+	return count;
+}
+for (var r = 0; r < 40; r++) bfs(r);
+print("oo", Date.now() - T0, "ms");
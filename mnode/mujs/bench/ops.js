@@ -0,0 +1,39 @@
+// Cost of single arithmetic operators on int32 and double operands.
+// Run with the mujs shell: build/mujs bench/ops.js
+// Each loop is timed against an empty loop over the same locals, and
+// the difference is printed in nanoseconds per operation.
+
+var N = 1000000;
+
+function base() { var a = 7, b = 3, r; for (var i = 0; i < N; i++) { r = a; } return r; }
+
+var ops = {
+	"int +": function () { var a = 7, b = 3, r; for (var i = 0; i < N; i++) { r = a + b; } return r; },
+	"int -": function () { var a = 7, b = 3, r; for (var i = 0; i < N; i++) { r = a - b; } return r; },
+	"int *": function () { var a = 7, b = 3, r; for (var i = 0; i < N; i++) { r = a * b; } return r; },
+	"int /": function () { var a = 7, b = 3, r; for (var i = 0; i < N; i++) { r = a / b; } return r; },
+	"int %": function () { var a = 7, b = 3, r; for (var i = 0; i < N; i++) { r = a % b; } return r; },
+	"int &": function () { var a = 7, b = 3, r; for (var i = 0; i < N; i++) { r = a & b; } return r; },
+	"int <<": function () { var a = 7, b = 3, r; for (var i = 0; i < N; i++) { r = a << b; } return r; },
+	"int <": function () { var a = 7, b = 3, r; for (var i = 0; i < N; i++) { r = a < b; } return r; },
+	"int ===": function () { var a = 7, b = 3, r; for (var i = 0; i < N; i++) { r = a === b; } return r; },
+	"int neg": function () { var a = 7, r; for (var i = 0; i < N; i++) { r = -a; } return r; },
+	"double +": function () { var a = 7.5, b = 3.25, r; for (var i = 0; i < N; i++) { r = a + b; } return r; },
+	"double -": function () { var a = 7.5, b = 3.25, r; for (var i = 0; i < N; i++) { r = a - b; } return r; },
+	"double *": function () { var a = 7.5, b = 3.25, r; for (var i = 0; i < N; i++) { r = a * b; } return r; },
+	"double /": function () { var a = 7.5, b = 3.25, r; for (var i = 0; i < N; i++) { r = a / b; } return r; },
+	"double <": function () { var a = 7.5, b = 3.25, r; for (var i = 0; i < N; i++) { r = a < b; } return r; },
+	"double &": function () { var a = 7.5, b = 3.25, r; for (var i = 0; i < N; i++) { r = a & b; } return r; },
+	"double neg": function () { var a = 7.5, r; for (var i = 0; i < N; i++) { r = -a; } return r; },
+	"double ++": function () { var a = 7.5; for (var i = 0; i < N; i++) { a++; } return a; }
+};
+
+var t0 = Date.now();
+base();
+var tbase = Date.now() - t0;
+
+for (var name in ops) {
+	t0 = Date.now();
+	ops[name]();
+	print(name, ((Date.now() - t0 - tbase) * 1e6 / N).toFixed(1), "ns/op");
+}
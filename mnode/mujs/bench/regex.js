@@ -0,0 +1,78 @@
+// Regular expressions over 2000 synthetic log lines: test, exec, match,
+// replace and split, plus an alternation loop over one long line.
+// Run with the mujs shell: build/mujs bench/regex.js
+
+function bench(name, f) {
+	var t = Date.now();
+	var r = f();
+	print(name, Date.now() - t, "ms", "result=" + r);
+}
+
+var lines = [], levels = ["INFO", "WARN", "ERROR", "DEBUG"];
+for (var i = 0; i < 2000; i++)
+	lines.push("2024-03-" + (10 + i % 20) + "T12:" + (10 + i % 50) + ":07.123Z host" + (i % 7) +
+		" app[" + (1000 + i) + "]: " + levels[i % 4] + " request id=" + (i * 7919 % 100000) +
+		" path=/api/v1/items/" + i + " took " + (i % 500) + "ms status=" + (i % 13 == 0 ? 500 : 200));
+var longline = Array(400).join("ab") + "X";
+
+function count(re, times) {
+	var n = 0;
+	for (var k = 0; k < times; k++)
+		for (var i = 0; i < lines.length; i++)
+			if (re.test(lines[i]))
+				n++;
+	return n;
+}
+
+bench("test /ERROR/", function () { return count(/ERROR/, 10); });
+bench("test /status=5\\d\\d$/", function () { return count(/status=5\d\d$/, 10); });
+bench("test /took \\d{3,}ms/", function () { return count(/took \d{3,}ms/, 10); });
+bench("test /error.*status=500/i", function () { return count(/error.*status=500/i, 10); });
+
+bench("exec timestamp and level", function () {
+	var n = 0, re = /^(\d{4})-(\d\d)-(\d\d)T(\d\d):(\d\d):(\d\d)\.\d+Z (\w+) (\w+)\[(\d+)\]: (\w+)/;
+	for (var k = 0; k < 3; k++)
+		for (var i = 0; i < lines.length; i++) {
+			var m = re.exec(lines[i]);
+			if (m) n += m[10].length;
+		}
+	return n;
+});
+
+bench("match id=(\\d+)", function () {
+	var n = 0;
+	for (var k = 0; k < 3; k++)
+		for (var i = 0; i < lines.length; i++) {
+			var m = lines[i].match(/id=(\d+)/);
+			if (m) n += +m[1];
+		}
+	return n;
+});
+
+bench("replace /\\d+/g", function () {
+	var n = 0;
+	for (var i = 0; i < lines.length; i++)
+		n += lines[i].replace(/\d+/g, "N").length;
+	return n;
+});
+
+bench("split /\\s+/", function () {
+	var n = 0;
+	for (var i = 0; i < lines.length; i++)
+		n += lines[i].split(/\s+/).length;
+	return n;
+});
+
+bench("(a|b)*c long line x20", function () {
+	var n = 0, re = /(a|b)*c/;
+	for (var k = 0; k < 20; k++)
+		if (re.test(longline)) n++;
+	return n;
+});
+
+bench("(a|b)*X long line x20", function () {
+	var n = 0, re = /(a|b)*X/;
+	for (var k = 0; k < 20; k++)
+		if (re.test(longline)) n++;
+	return n;
+});
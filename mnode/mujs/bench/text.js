@@ -0,0 +1,36 @@
+// A word-frequency count: tokenizing, object keys, sort, JSON and regexps.
+// Run with the mujs shell: build/mujs bench/text.js
+
+var T0 = Date.now();
+var words = "the quick brown fox jumps over the lazy dog and keeps running far away".split(" ");
+var text = [];
+for (var i = 0; i < 3000; i++) text.push(words[(i * 7) % words.length]);
+var s = text.join(" ");
+function tokenize(str) {
+	var out = [], cur = "";
+	for (var i = 0; i < str.length; i++) {
+		var c = str.charAt(i);
+		if (c === " ") { if (cur.length > 0) out.push(cur); cur = ""; }
+		else cur += c;
+	}
+	if (cur.length > 0) out.push(cur);
+	return out;
+}
+function count(tokens) {
+	var freq = {};
+	for (var i = 0; i < tokens.length; i++) {
+		var t = tokens[i];
+		if (freq[t] === undefined) freq[t] = 0;
+		freq[t] = freq[t] + 1;
+	}
+	return freq;
+}
+for (var r = 0; r < 3; r++) {
+	var f = count(tokenize(s));
+	var keys = Object.keys(f);
+	keys.sort(function (a, b) { return f[b] - f[a]; });
+	JSON.stringify(f);
+	JSON.parse(JSON.stringify({ keys: keys, n: keys.length }));
+	s.replace(/o/g, "0").toUpperCase().indexOf("LAZY");
+}
+print("text", Date.now() - T0, "ms");
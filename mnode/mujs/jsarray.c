@@ -1,11 +1,15 @@
 #include "jsi.h"
+#include "jscompile.h"
 #include "jsvalue.h"
 #include "jsbuiltin.h"
 
 unsigned int js_getlength(js_State *J, int idx)
 {
+	js_Value *v = js_tovalue(J, idx);
 	unsigned int len;
-	js_getproperty(J, idx, "length");
+	if (v->type == JS_TOBJECT && v->u.object->type == JS_CARRAY)
+		return v->u.object->u.a.length;
+	js_getpropertyatom(J, idx, JS_ATOM(J, length));
 	len = js_touint32(J, -1);
 	js_pop(J, 1);
 	return len;
@@ -14,24 +18,50 @@ unsigned int js_getlength(js_State *J, int idx)
 void js_setlength(js_State *J, int idx, unsigned int len)
 {
 	js_pushnumber(J, len);
-	js_setproperty(J, idx < 0 ? idx - 1: idx, "length");
+	js_setpropertyatom(J, idx < 0 ? idx - 1: idx, JS_ATOM(J, length));
+}
+
+/* the dense array at idx, if it has an element i */
+static js_Object *denseindex(js_State *J, int idx, unsigned int i)
+{
+	js_Value *v = js_tovalue(J, idx);
+	if (v->type == JS_TOBJECT && JSV_ISDENSE(v->u.object) && i < v->u.object->u.a.filled)
+		return v->u.object;
+	return NULL;
 }
 
 int js_hasindex(js_State *J, int idx, unsigned int i)
 {
 	char buf[32];
+	js_Object *obj = denseindex(J, idx, i);
+	if (obj) {
+		js_pushvalue(J, obj->u.a.array[i]);
+		return 1;
+	}
 	return js_hasproperty(J, idx, js_itoa(buf, i));
 }
 
 void js_getindex(js_State *J, int idx, unsigned int i)
 {
 	char buf[32];
+	js_Object *obj = denseindex(J, idx, i);
+	if (obj) {
+		js_pushvalue(J, obj->u.a.array[i]);
+		return;
+	}
 	js_getproperty(J, idx, js_itoa(buf, i));
 }
 
 void js_setindex(js_State *J, int idx, unsigned int i)
 {
 	char buf[32];
+	js_Value *v = js_tovalue(J, idx);
+	if (v->type == JS_TOBJECT && JSV_ISDENSE(v->u.object)) {
+		if (jsV_setdenseindex(J, v->u.object, i, js_tovalue(J, -1))) {
+			js_pop(J, 1);
+			return;
+		}
+	}
 	js_setproperty(J, idx, js_itoa(buf, i));
 }
 
@@ -50,7 +80,7 @@ static void jsB_new_Array(js_State *J)
 	if (top == 2) {
 		if (js_isnumber(J, 1)) {
 			js_copy(J, 1);
-			js_setproperty(J, -2, "length");
+			js_setpropertyatom(J, -2, JS_ATOM(J, length));
 		} else {
 			js_copy(J, 1);
 			js_setindex(J, -2, 0);
@@ -85,13 +115,36 @@ static void Ap_concat(js_State *J)
 	}
 }
 
+/* the length of the separators and the string elements of a dense array */
+static unsigned int joinsize(js_State *J, unsigned int len, unsigned int seplen)
+{
+	js_Value *v = js_tovalue(J, 0);
+	js_Object *obj;
+	double size = (double)(len - 1) * seplen;
+	unsigned int k;
+
+	if (v->type == JS_TOBJECT && JSV_ISDENSE(v->u.object)) {
+		obj = v->u.object;
+		for (k = 0; k < obj->u.a.filled; ++k) {
+			v = &obj->u.a.array[k];
+			if (v->type == JS_TMEMSTR)
+				size += v->u.memstr->length;
+			else if (v->type == JS_TLITSTR)
+				size += strlen(v->u.litstr);
+			else if (v->type == JS_TSHRSTR)
+				size += strlen(v->u.shrstr);
+		}
+	}
+
+	return size < UINT_MAX / 2 ? size : 0; /* too long: let the builder fail */
+}
+
 static void Ap_join(js_State *J)
 {
-	char * volatile out = NULL;
+	js_Builder sb;
 	const char *sep;
-	const char *r;
 	unsigned int seplen;
-	unsigned int k, n, len;
+	unsigned int k, len;
 
 	len = js_getlength(J, 0);
 
@@ -108,36 +161,18 @@ static void Ap_join(js_State *J)
 		return;
 	}
 
-	if (js_try(J)) {
-		js_free(J, out);
-		js_throw(J);
-	}
+	jsV_newbuilder(J, &sb, joinsize(J, len, seplen));
 
-	n = 1;
 	for (k = 0; k < len; ++k) {
+		if (k > 0)
+			jsV_putm(J, &sb, sep, sep + seplen);
 		js_getindex(J, 0, k);
-		if (js_isundefined(J, -1) || js_isnull(J, -1))
-			r = "";
-		else
-			r = js_tostring(J, -1);
-		n += strlen(r);
-
-		if (k == 0) {
-			out = js_malloc(J, n);
-			strcpy(out, r);
-		} else {
-			n += seplen;
-			out = realloc(out, n);
-			strcat(out, sep);
-			strcat(out, r);
-		}
-
+		if (!js_isundefined(J, -1) && !js_isnull(J, -1))
+			jsV_puts(J, &sb, js_tostring(J, -1));
 		js_pop(J, 1);
 	}
 
-	js_pushstring(J, out);
-	js_endtry(J);
-	js_free(J, out);
+	jsV_endbuilder(J, &sb);
 }
 
 static void Ap_pop(js_State *J)
@@ -148,7 +183,9 @@ static void Ap_pop(js_State *J)
 
 	if (n > 0) {
 		js_getindex(J, 0, n - 1);
-		js_delindex(J, 0, n - 1);
+		/* shrinking an array deletes its elements */
+		if (!js_isarray(J, 0))
+			js_delindex(J, 0, n - 1);
 		js_setlength(J, 0, n - 1);
 	} else {
 		js_setlength(J, 0, 0);
@@ -203,6 +240,7 @@ static void Ap_reverse(js_State *J)
 
 static void Ap_shift(js_State *J)
 {
+	js_Object *self;
 	unsigned int k, len;
 
 	len = js_getlength(J, 0);
@@ -215,6 +253,18 @@ static void Ap_shift(js_State *J)
 
 	js_getindex(J, 0, 0);
 
+	if (js_isarray(J, 0)) {
+		self = js_toobject(J, 0);
+		if (self->u.a.simple) {
+			if (self->u.a.filled > 0) {
+				memmove(self->u.a.array, self->u.a.array + 1, (self->u.a.filled - 1) * sizeof *self->u.a.array);
+				--self->u.a.filled;
+			}
+			self->u.a.length = len - 1;
+			return;
+		}
+	}
+
 	for (k = 1; k < len; ++k) {
 		if (js_hasindex(J, 0, k))
 			js_setindex(J, 0, k - 1);
@@ -222,7 +272,8 @@ static void Ap_shift(js_State *J)
 			js_delindex(J, 0, k - 1);
 	}
 
-	js_delindex(J, 0, len - 1);
+	if (!js_isarray(J, 0))
+		js_delindex(J, 0, len - 1);
 	js_setlength(J, 0, len - 1);
 }
 
@@ -248,67 +299,182 @@ static void Ap_slice(js_State *J)
 			js_setindex(J, -2, n);
 }
 
-static int compare(js_State *J, unsigned int x, unsigned int y, int *hasx, int *hasy, int hasfn)
-{
-	const char *sx, *sy;
-	int c;
+/*
+ * Array.prototype.sort copies the elements other than undefined into a
+ * private array, sorts a vector of indices into it with a stable merge
+ * sort, and writes the result back in one pass followed by the undefined
+ * values and then the holes. The default order compares the string form of
+ * each element, computed once up front. A comparator of the form
+ * function (a, b) { return a - b } (or b - a) over numbers is done inline.
+ */
 
-	*hasx = js_hasindex(J, 0, x);
-	*hasy = js_hasindex(J, 0, y);
+struct sortctx
+{
+	js_State *J;
+	js_Value *values;
+	const char **keys; /* string forms, for the default order */
+	int numeric; /* 1 for a - b, -1 for b - a, 0 to call the comparator */
+};
+
+/* x sorts after y */
+static int sortafter(struct sortctx *ctx, unsigned int x, unsigned int y)
+{
+	js_State *J = ctx->J;
+	double c;
+
+	if (ctx->keys)
+		return strcmp(ctx->keys[x], ctx->keys[y]) > 0;
+	if (ctx->numeric) {
+		double a = jsV_tonumber(J, &ctx->values[x]);
+		double b = jsV_tonumber(J, &ctx->values[y]);
+		return ctx->numeric > 0 ? a > b : b > a;
+	}
 
-	if (*hasx && *hasy) {
-		int unx = js_isundefined(J, -2);
-		int uny = js_isundefined(J, -1);
-		if (unx && uny) return 0;
-		if (unx) return 1;
-		if (uny) return -1;
+	js_copy(J, 1); /* copy function */
+	js_pushundefinedthis(J); /* set this object */
+	js_pushvalue(J, ctx->values[x]);
+	js_pushvalue(J, ctx->values[y]);
+	js_call(J, 2);
+	c = js_tonumber(J, -1);
+	js_pop(J, 1);
+	return c > 0;
+}
 
-		if (hasfn) {
-			js_copy(J, 1); /* copy function */
-			js_pushundefinedthis(J); /* set this object */
-			js_copy(J, -4); /* copy x */
-			js_copy(J, -4); /* copy y */
-			js_call(J, 2);
-			c = js_tonumber(J, -1);
-			js_pop(J, 1);
-			return c;
+static void mergesort(struct sortctx *ctx, unsigned int *a, unsigned int *tmp, unsigned int n)
+{
+	unsigned int i, j, k, m, x;
+
+	if (n <= 8) {
+		for (i = 1; i < n; ++i) {
+			x = a[i];
+			for (k = i; k > 0 && sortafter(ctx, a[k-1], x); --k)
+				a[k] = a[k-1];
+			a[k] = x;
 		}
-
-		sx = js_tostring(J, -2);
-		sy = js_tostring(J, -1);
-		return strcmp(sx, sy);
+		return;
 	}
 
-	if (*hasx) return -1;
-	if (*hasy) return 1;
+	m = n / 2;
+	mergesort(ctx, a, tmp, m);
+	mergesort(ctx, a + m, tmp, n - m);
+	if (!sortafter(ctx, a[m-1], a[m]))
+		return; /* already in order */
+
+	memcpy(tmp, a, m * sizeof *a);
+	i = 0, j = m, k = 0;
+	while (i < m && j < n)
+		a[k++] = sortafter(ctx, tmp[i], a[j]) ? a[j++] : tmp[i++];
+	while (i < m)
+		a[k++] = tmp[i++];
+}
+
+/* the comparator subtracts its arguments: 1 for a - b, -1 for b - a */
+static int issubtraction(js_State *J, int idx)
+{
+	js_Value *v = js_tovalue(J, idx);
+	js_Function *F;
+	js_Instruction *p;
+
+	if (v->type != JS_TOBJECT || v->u.object->type != JS_CFUNCTION)
+		return 0;
+	F = v->u.object->u.f.function;
+	p = F->code;
+	if (F->numparams != 2 || !F->lightweight || F->codelen < 7)
+		return 0;
+	if (p[0] != OP_LINE || p[2] != OP_GETLOCAL2 || p[5] != OP_SUB || p[6] != OP_RETURN)
+		return 0;
+	if (p[3] == 1 && p[4] == 2) return 1;
+	if (p[3] == 2 && p[4] == 1) return -1;
 	return 0;
 }
 
+/* append the value on top of the stack to a private array */
+static void sortpush(js_State *J, js_Object *obj)
+{
+	if (!jsV_setdenseindex(J, obj, obj->u.a.filled, js_tovalue(J, -1)))
+		js_rangeerror(J, "array too large to sort");
+	js_pop(J, 1);
+}
+
 static void Ap_sort(js_State *J)
 {
-	unsigned int len, i, k;
-	int hasx, hasy, hasfn;
+	struct sortctx ctx;
+	js_Object *values, *keys = NULL;
+	unsigned int len, i, n, undefs;
+	unsigned int *order;
+	int hasfn;
 
 	len = js_getlength(J, 0);
-
 	hasfn = js_iscallable(J, 1);
 
-	for (i = 1; i < len; ++i) {
-		k = i;
-		while (k > 0 && compare(J, k - 1, k, &hasx, &hasy, hasfn) > 0) {
-			if (hasx && hasy) {
-				js_setindex(J, 0, k - 1);
-				js_setindex(J, 0, k);
-			} else if (hasx) {
-				js_delindex(J, 0, k - 1);
-				js_setindex(J, 0, k);
-			} else if (hasy) {
-				js_setindex(J, 0, k - 1);
-				js_delindex(J, 0, k);
+	values = jsV_newobject(J, JS_CARRAY, NULL);
+	js_pushobject(J, values);
+	undefs = 0;
+	for (i = 0; i < len; ++i) {
+		if (js_hasindex(J, 0, i)) {
+			if (js_isundefined(J, -1)) {
+				js_pop(J, 1);
+				++undefs;
+			} else {
+				sortpush(J, values);
 			}
-			--k;
 		}
 	}
+	n = values->u.a.filled;
+
+	ctx.J = J;
+	ctx.values = values->u.a.array;
+	ctx.keys = NULL;
+	ctx.numeric = 0;
+
+	if (!hasfn) {
+		/* the string forms stay alive in a second private array */
+		keys = jsV_newobject(J, JS_CARRAY, NULL);
+		js_pushobject(J, keys);
+		for (i = 0; i < n; ++i) {
+			js_pushvalue(J, ctx.values[i]);
+			sortpush(J, keys);
+		}
+		for (i = 0; i < n; ++i)
+			jsV_tostring(J, &keys->u.a.array[i]);
+	} else {
+		ctx.numeric = issubtraction(J, 1);
+		for (i = 0; i < n && ctx.numeric; ++i)
+			if (!JSV_ISNUMBER(&ctx.values[i]))
+				ctx.numeric = 0;
+	}
+
+	if (n > UINT_MAX / (2 * sizeof *order + sizeof *ctx.keys))
+		js_rangeerror(J, "array too large to sort");
+	order = js_malloc(J, n * (2 * sizeof *order + sizeof *ctx.keys) + 1); /* never zero bytes */
+	if (keys) {
+		ctx.keys = (const char **)(order + 2 * n);
+		for (i = 0; i < n; ++i)
+			ctx.keys[i] = jsV_tostring(J, &keys->u.a.array[i]);
+	}
+
+	if (js_try(J)) {
+		js_free(J, order);
+		js_throw(J);
+	}
+
+	for (i = 0; i < n; ++i)
+		order[i] = i;
+	mergesort(&ctx, order, order + n, n);
+
+	for (i = 0; i < n; ++i) {
+		js_pushvalue(J, values->u.a.array[order[i]]);
+		js_setindex(J, 0, i);
+	}
+	for (; i < n + undefs; ++i) {
+		js_pushundefined(J);
+		js_setindex(J, 0, i);
+	}
+	for (; i < len; ++i)
+		js_delindex(J, 0, i);
+
+	js_endtry(J);
+	js_free(J, order);
 
 	js_copy(J, 0);
 }
@@ -345,8 +511,9 @@ static void Ap_splice(js_State *J)
 			else
 				js_delindex(J, 0, k + add);
 		}
-		for (k = len; k > len - del + add; --k)
-			js_delindex(J, 0, k - 1);
+		if (!js_isarray(J, 0))
+			for (k = len; k > len - del + add; --k)
+				js_delindex(J, 0, k - 1);
 	} else if (add > del) {
 		for (k = len - del; k > start; --k) {
 			if (js_hasindex(J, 0, k + del - 1))
@@ -31,7 +31,7 @@ void jsC_error(js_State *J, js_Ast *node, const char *fmt, ...)
 	js_throw(J);
 }
 
-static js_Function *newfun(js_State *J, js_Ast *name, js_Ast *params, js_Ast *body, int script)
+static js_Function *newfun(js_State *J, js_Function *outer, js_Ast *name, js_Ast *params, js_Ast *body, int script)
 {
 	js_Function *F = js_malloc(J, sizeof *F);
 	memset(F, 0, sizeof *F);
@@ -43,10 +43,16 @@ static js_Function *newfun(js_State *J, js_Ast *name, js_Ast *params, js_Ast *bo
 	F->filename = js_intern(J, J->filename);
 	F->line = name ? name->line : params ? params->line : body ? body->line : 1;
 	F->script = script;
-	F->name = name ? name->string : "";
+	F->name = name ? name->string : js_intern(J, "");
+	F->outer = outer;
 
 	cfunbody(J, F, name, params, body);
 
+	if (F->cachelen) {
+		F->cachetab = js_malloc(J, F->cachelen * sizeof *F->cachetab);
+		memset(F->cachetab, 0, F->cachelen * sizeof *F->cachetab);
+	}
+
 	return F;
 }
 
@@ -63,8 +69,82 @@ static void emitraw(JF, int value)
 	F->code[F->codelen++] = value;
 }
 
+/*
+ * Fuse an opcode with the previous instruction into a superinstruction.
+ * The operands of the new opcode are emitted by the caller as usual, so
+ * fusions only rewrite the previous opcode in place. Never fuse across
+ * a jump target.
+ */
+static int fuse(JF, int opcode)
+{
+	js_Instruction *last = F->code + F->lastop;
+	int k;
+
+	if (F->codelen == 0)
+		return 0;
+
+	/*
+	 * A call right before a return is a tail call. The return is kept for
+	 * the other paths that jump to it and for calls that cannot reuse the
+	 * frame, so this is safe at a jump target too.
+	 */
+	if (opcode == OP_RETURN && *last == OP_CALL) {
+		*last = OP_TAILCALL;
+		return 0;
+	}
+
+	if (F->codelen == F->jumptarget)
+		return 0;
+
+	switch (opcode) {
+	case OP_POP:
+		if (*last == OP_SETLOCAL) {
+			*last = OP_INITLOCAL;
+			return 1;
+		}
+		if (*last == OP_SETENV) {
+			*last = OP_INITENV;
+			return 1;
+		}
+		break;
+	case OP_GETLOCAL:
+		if (*last == OP_GETLOCAL) {
+			*last = OP_GETLOCAL2;
+			return 1;
+		}
+		break;
+	case OP_GETPROP_S:
+		if (*last == OP_GETLOCAL) {
+			*last = OP_GETLOCALPROP_S;
+			return 1;
+		}
+		if (*last == OP_GETLOCAL2) {
+			/* split into GETLOCAL and GETLOCALPROP_S */
+			k = last[2];
+			last[0] = OP_GETLOCAL;
+			last[2] = OP_GETLOCALPROP_S;
+			F->lastop += 2;
+			emitraw(J, F, k);
+			return 1;
+		}
+		break;
+	case OP_JFALSE:
+		switch (*last) {
+		case OP_LT: *last = OP_JNLT; return 1;
+		case OP_GT: *last = OP_JNGT; return 1;
+		case OP_LE: *last = OP_JNLE; return 1;
+		case OP_GE: *last = OP_JNGE; return 1;
+		}
+		break;
+	}
+	return 0;
+}
+
 static void emit(JF, int value)
 {
+	if (fuse(J, F, value))
+		return;
+	F->lastop = F->codelen;
 	emitraw(J, F, value);
 }
 
@@ -104,8 +184,9 @@ static int addnumber(JF, double value)
 static int addstring(JF, const char *value)
 {
 	unsigned int i;
+	value = js_intern(J, value);
 	for (i = 0; i < F->strlen; ++i)
-		if (!strcmp(F->strtab[i], value))
+		if (F->strtab[i] == value)
 			return i;
 	if (F->strlen >= F->strcap) {
 		F->strcap = F->strcap ? F->strcap * 2 : 16;
@@ -115,6 +196,15 @@ static int addstring(JF, const char *value)
 	return F->strlen++;
 }
 
+static void addvar(JF, const char *name)
+{
+	if (F->varlen >= F->varcap) {
+		F->varcap = F->varcap ? F->varcap * 2 : 16;
+		F->vartab = js_realloc(J, F->vartab, F->varcap * sizeof *F->vartab);
+	}
+	F->vartab[F->varlen++] = name;
+}
+
 static void addlocal(JF, js_Ast *ident, int reuse)
 {
 	const char *name = ident->string;
@@ -127,7 +217,7 @@ static void addlocal(JF, js_Ast *ident, int reuse)
 	if (reuse || J->strict) {
 		unsigned int i;
 		for (i = 0; i < F->varlen; ++i) {
-			if (!strcmp(F->vartab[i], name)) {
+			if (F->vartab[i] == name) {
 				if (reuse)
 					return;
 				if (J->strict)
@@ -135,22 +225,38 @@ static void addlocal(JF, js_Ast *ident, int reuse)
 			}
 		}
 	}
-	if (F->varlen >= F->varcap) {
-		F->varcap = F->varcap ? F->varcap * 2 : 16;
-		F->vartab = js_realloc(J, F->vartab, F->varcap * sizeof *F->vartab);
-	}
-	F->vartab[F->varlen++] = name;
+	addvar(J, F, name);
 }
 
 static int findlocal(JF, const char *name)
 {
 	unsigned int i;
-	for (i = F->varlen; i > 0; --i)
-		if (!strcmp(F->vartab[i-1], name))
+	for (i = F->varlen - F->catchlen; i > 0; --i)
+		if (F->vartab[i-1] == name)
 			return i;
 	return -1;
 }
 
+static int findenv(JF, const char *name)
+{
+	unsigned int i;
+	for (i = 0; i < F->envlen; ++i)
+		if (F->envtab[i] == name)
+			return i;
+	return -1;
+}
+
+static void addenv(JF, const char *name)
+{
+	if (findenv(J, F, name) >= 0)
+		return;
+	if (F->envlen >= F->envcap) {
+		F->envcap = F->envcap ? F->envcap * 2 : 8;
+		F->envtab = js_realloc(J, F->envtab, F->envcap * sizeof *F->envtab);
+	}
+	F->envtab[F->envlen++] = name;
+}
+
 static void emitfunction(JF, js_Function *fun)
 {
 	emit(J, F, OP_CLOSURE);
@@ -171,6 +277,10 @@ static void emitnumber(JF, double num)
 	} else if (num < 0 && -num == (js_Instruction)(-num)) {
 		emit(J, F, OP_NUMBER_NEG);
 		emitraw(J, F, (js_Instruction)(-num));
+	} else if (num >= INT_MIN && num <= INT_MAX && num == (int)num) {
+		emit(J, F, OP_INTEGER);
+		emitraw(J, F, (unsigned int)(int)num & 0xFFFF);
+		emitraw(J, F, (unsigned int)(int)num >> 16);
 	} else {
 		emit(J, F, OP_NUMBER);
 		emitraw(J, F, addnumber(J, F, num));
@@ -183,9 +293,73 @@ static void emitstring(JF, int opcode, const char *str)
 	emitraw(J, F, addstring(J, F, str));
 }
 
+/* named property access with an inline cache slot */
+static void emitprop(JF, int opcode, const char *str)
+{
+	emitstring(J, F, opcode, str);
+	emitraw(J, F, F->cachelen++);
+}
+
+static int isfun(enum js_AstType T)
+{
+	return T == AST_FUNDEC || T == EXP_FUN || T == EXP_PROP_GET || T == EXP_PROP_SET;
+}
+
+static int isarguments(js_State *J, js_Ast *node)
+{
+	return node->type == EXP_IDENTIFIER && node->string == JS_ATOM(J, arguments);
+}
+
+/*
+ * Resolve a name in a lightweight function to a stack slot (with depth -1)
+ * or to a slot in the environment record of this or an enclosing lightweight
+ * function (with depth counting the records to skip). Names bound by a catch
+ * clause live in a stack slot when the clause has one (see catchslots), and
+ * are otherwise looked up by name, as are names declared outside the
+ * lightweight functions.
+ */
+static int resolvelocal(JF, js_Ast *ident, int *depth)
+{
+	const char *name = ident->string;
+	js_Ast *node = ident, *prev;
+	js_Function *fun;
+	int i, catches = 0;
+
+	for (fun = F; fun && fun->lightweight; fun = fun->outer)
+		catches += fun->catchdepth;
+
+	*depth = 0;
+	for (fun = F; fun && fun->lightweight; fun = fun->outer) {
+		if (catches) {
+			do {
+				prev = node, node = node->parent;
+				if (node->type == STM_TRY && prev == node->c && node->b->string == name) {
+					if (fun != F || !node->catchslot)
+						return -1;
+					*depth = -1;
+					return node->catchslot;
+				}
+			} while (!isfun(node->type));
+		}
+		i = findenv(J, fun, name);
+		if (i >= 0)
+			return i;
+		if (fun == F) {
+			i = findlocal(J, F, name);
+			if (i >= 0) {
+				*depth = -1;
+				return i;
+			}
+		}
+		if (fun->envlen)
+			++*depth;
+	}
+	return -1;
+}
+
 static void emitlocal(JF, int oploc, int opvar, js_Ast *ident)
 {
-	int i;
+	int i, depth;
 	if (J->strict && oploc == OP_SETLOCAL) {
 		if (!strcmp(ident->string, "arguments"))
 			jsC_error(J, ident, "'arguments' is read-only in strict mode");
@@ -193,25 +367,57 @@ static void emitlocal(JF, int oploc, int opvar, js_Ast *ident)
 			jsC_error(J, ident, "'eval' is read-only in strict mode");
 	}
 	if (F->lightweight) {
-		i = findlocal(J, F, ident->string);
-		if (i >= 0) {
+		i = resolvelocal(J, F, ident, &depth);
+		if (i >= 0 && depth < 0) {
 			emit(J, F, oploc);
 			emitraw(J, F, i);
 			return;
 		}
+		if (i >= 0) {
+			if (oploc == OP_DELLOCAL) {
+				emit(J, F, OP_DELLOCAL);
+				emitraw(J, F, 0);
+				return;
+			}
+			emit(J, F, oploc == OP_GETLOCAL ? OP_GETENV : OP_SETENV);
+			emitraw(J, F, depth);
+			emitraw(J, F, i);
+			return;
+		}
 	}
 	emitstring(J, F, opvar, ident->string);
 }
 
+/* Initialize a variable declared in this function */
+static void emitdecl(JF, const char *name)
+{
+	int i;
+	if (F->lightweight) {
+		i = findenv(J, F, name);
+		if (i >= 0) {
+			emit(J, F, OP_INITENV);
+			emitraw(J, F, 0);
+			emitraw(J, F, i);
+		} else {
+			emit(J, F, OP_INITLOCAL);
+			emitraw(J, F, findlocal(J, F, name));
+		}
+	} else {
+		emitstring(J, F, OP_INITVAR, name);
+	}
+}
+
 static int here(JF)
 {
+	F->jumptarget = F->codelen;
 	return F->codelen;
 }
 
 static int emitjump(JF, int opcode)
 {
-	int inst = F->codelen + 1;
+	int inst;
 	emit(J, F, opcode);
+	inst = F->codelen;
 	emitraw(J, F, 0);
 	return inst;
 }
@@ -233,7 +439,7 @@ static void labelto(JF, int inst, int addr)
 
 static void label(JF, int inst)
 {
-	labelto(J, F, inst, F->codelen);
+	labelto(J, F, inst, here(J, F));
 }
 
 /* Expressions */
@@ -323,11 +529,11 @@ static void cobject(JF, js_Ast *list)
 			emit(J, F, OP_INITPROP);
 			break;
 		case EXP_PROP_GET:
-			emitfunction(J, F, newfun(J, NULL, kv->b, kv->c, 0));
+			emitfunction(J, F, newfun(J, F, NULL, kv->b, kv->c, 0));
 			emit(J, F, OP_INITGETTER);
 			break;
 		case EXP_PROP_SET:
-			emitfunction(J, F, newfun(J, NULL, kv->b, kv->c, 0));
+			emitfunction(J, F, newfun(J, F, NULL, kv->b, kv->c, 0));
 			emit(J, F, OP_INITSETTER);
 			break;
 		}
@@ -365,7 +571,7 @@ static void cassign(JF, js_Ast *exp)
 	case EXP_MEMBER:
 		cexp(J, F, lhs->a);
 		cexp(J, F, rhs);
-		emitstring(J, F, OP_SETPROP_S, lhs->b->string);
+		emitprop(J, F, OP_SETPROP_S, lhs->b->string);
 		break;
 	default:
 		jsC_error(J, lhs, "invalid l-value in assignment");
@@ -399,7 +605,7 @@ static void cassignforin(JF, js_Ast *stm)
 	case EXP_MEMBER:
 		cexp(J, F, lhs->a);
 		emit(J, F, OP_ROT2);
-		emitstring(J, F, OP_SETPROP_S, lhs->b->string);
+		emitprop(J, F, OP_SETPROP_S, lhs->b->string);
 		emit(J, F, OP_POP);
 		break;
 	default:
@@ -422,7 +628,7 @@ static void cassignop1(JF, js_Ast *lhs)
 	case EXP_MEMBER:
 		cexp(J, F, lhs->a);
 		emit(J, F, OP_DUP);
-		emitstring(J, F, OP_GETPROP_S, lhs->b->string);
+		emitprop(J, F, OP_GETPROP_S, lhs->b->string);
 		break;
 	default:
 		jsC_error(J, lhs, "invalid l-value in assignment");
@@ -442,7 +648,7 @@ static void cassignop2(JF, js_Ast *lhs, int postfix)
 		break;
 	case EXP_MEMBER:
 		if (postfix) emit(J, F, OP_ROT3);
-		emitstring(J, F, OP_SETPROP_S, lhs->b->string);
+		emitprop(J, F, OP_SETPROP_S, lhs->b->string);
 		break;
 	default:
 		jsC_error(J, lhs, "invalid l-value in assignment");
@@ -504,9 +710,7 @@ static void ccall(JF, js_Ast *fun, js_Ast *args)
 		break;
 	case EXP_MEMBER:
 		cexp(J, F, fun->a);
-		emit(J, F, OP_DUP);
-		emitstring(J, F, OP_GETPROP_S, fun->b->string);
-		emit(J, F, OP_ROT2);
+		emitprop(J, F, OP_GETMETHOD_S, fun->b->string);
 		break;
 	case EXP_IDENTIFIER:
 		if (!strcmp(fun->string, "eval")) {
@@ -524,6 +728,27 @@ static void ccall(JF, js_Ast *fun, js_Ast *args)
 	emitraw(J, F, n);
 }
 
+static void cdiscard(JF, js_Ast *exp)
+{
+	/* evaluate an expression for its side effects only */
+	switch (exp->type) {
+	case EXP_POSTINC:
+		cassignop1(J, F, exp->a);
+		emit(J, F, OP_INC);
+		cassignop2(J, F, exp->a, 0);
+		break;
+	case EXP_POSTDEC:
+		cassignop1(J, F, exp->a);
+		emit(J, F, OP_DEC);
+		cassignop2(J, F, exp->a, 0);
+		break;
+	default:
+		cexp(J, F, exp);
+		break;
+	}
+	emit(J, F, OP_POP);
+}
+
 static void cexp(JF, js_Ast *exp)
 {
 	int then, end;
@@ -555,7 +780,7 @@ static void cexp(JF, js_Ast *exp)
 		break;
 
 	case EXP_FUN:
-		emitfunction(J, F, newfun(J, exp->a, exp->b, exp->c, 0));
+		emitfunction(J, F, newfun(J, F, exp->a, exp->b, exp->c, 0));
 		break;
 
 	case EXP_IDENTIFIER:
@@ -563,14 +788,23 @@ static void cexp(JF, js_Ast *exp)
 		break;
 
 	case EXP_INDEX:
+		if (F->arguments == JS_ARGUMENTS_INPLACE && isarguments(J, exp->a)) {
+			cexp(J, F, exp->b);
+			emit(J, F, OP_GETARG);
+			break;
+		}
 		cexp(J, F, exp->a);
 		cexp(J, F, exp->b);
 		emit(J, F, OP_GETPROP);
 		break;
 
 	case EXP_MEMBER:
+		if (F->arguments == JS_ARGUMENTS_INPLACE && isarguments(J, exp->a)) {
+			emit(J, F, OP_ARGLENGTH);
+			break;
+		}
 		cexp(J, F, exp->a);
-		emitstring(J, F, OP_GETPROP_S, exp->b->string);
+		emitprop(J, F, OP_GETPROP_S, exp->b->string);
 		break;
 
 	case EXP_CALL:
@@ -662,8 +896,7 @@ static void cexp(JF, js_Ast *exp)
 	case EXP_ASS_BITOR: cassignop(J, F, exp, OP_BITOR); break;
 
 	case EXP_COMMA:
-		cexp(J, F, exp->a);
-		emit(J, F, OP_POP);
+		cdiscard(J, F, exp->a);
 		cexp(J, F, exp->b);
 		break;
 
@@ -729,11 +962,6 @@ static int isloop(enum js_AstType T)
 		T == STM_FOR_IN || T == STM_FOR_IN_VAR;
 }
 
-static int isfun(enum js_AstType T)
-{
-	return T == AST_FUNDEC || T == EXP_FUN || T == EXP_PROP_GET || T == EXP_PROP_SET;
-}
-
 static int matchlabel(js_Ast *node, const char *label)
 {
 	while (node && node->type == STM_LABEL) {
@@ -787,8 +1015,24 @@ static js_Ast *returntarget(JF, js_Ast *node)
 	return NULL;
 }
 
-/* Emit code to rebalance stack and scopes during an abrupt exit */
+/* Bind the exception to the catch variable: a stack slot, or a new scope */
+static void emitcatch(JF, js_Ast *stm)
+{
+	if (stm->catchslot) {
+		emit(J, F, OP_INITLOCAL);
+		emitraw(J, F, stm->catchslot);
+	} else {
+		emitstring(J, F, OP_CATCH, stm->b->string);
+	}
+}
 
+static void emitendcatch(JF, js_Ast *stm)
+{
+	if (!stm->catchslot)
+		emit(J, F, OP_ENDCATCH);
+}
+
+/* Emit code to rebalance stack and scopes during an abrupt exit */
 static void cexit(JF, enum js_AstType T, js_Ast *node, js_Ast *target)
 {
 	js_Ast *prev;
@@ -829,11 +1073,11 @@ static void cexit(JF, enum js_AstType T, js_Ast *node, js_Ast *target)
 			if (prev == node->c) {
 				/* ... with finally */
 				if (node->d) {
-					emit(J, F, OP_ENDCATCH);
+					emitendcatch(J, F, node);
 					emit(J, F, OP_ENDTRY);
 					cstm(J, F, node->d); /* finally */
 				} else {
-					emit(J, F, OP_ENDCATCH);
+					emitendcatch(J, F, node);
 				}
 			}
 			break;
@@ -858,7 +1102,7 @@ static void ctryfinally(JF, js_Ast *trystm, js_Ast *finallystm)
 	cstm(J, F, finallystm);
 }
 
-static void ctrycatch(JF, js_Ast *trystm, js_Ast *catchvar, js_Ast *catchstm)
+static void ctrycatch(JF, js_Ast *stm, js_Ast *trystm, js_Ast *catchvar, js_Ast *catchstm)
 {
 	int L1, L2;
 	L1 = emitjump(J, F, OP_TRY);
@@ -870,9 +1114,11 @@ static void ctrycatch(JF, js_Ast *trystm, js_Ast *catchvar, js_Ast *catchstm)
 			if (!strcmp(catchvar->string, "eval"))
 				jsC_error(J, catchvar, "redefining 'eval' is not allowed in strict mode");
 		}
-		emitstring(J, F, OP_CATCH, catchvar->string);
+		emitcatch(J, F, stm);
+		++F->catchdepth;
 		cstm(J, F, catchstm);
-		emit(J, F, OP_ENDCATCH);
+		--F->catchdepth;
+		emitendcatch(J, F, stm);
 		L2 = emitjump(J, F, OP_JUMP); /* skip past the try block */
 	}
 	label(J, F, L1);
@@ -881,7 +1127,7 @@ static void ctrycatch(JF, js_Ast *trystm, js_Ast *catchvar, js_Ast *catchstm)
 	label(J, F, L2);
 }
 
-static void ctrycatchfinally(JF, js_Ast *trystm, js_Ast *catchvar, js_Ast *catchstm, js_Ast *finallystm)
+static void ctrycatchfinally(JF, js_Ast *stm, js_Ast *trystm, js_Ast *catchvar, js_Ast *catchstm, js_Ast *finallystm)
 {
 	int L1, L2, L3;
 	L1 = emitjump(J, F, OP_TRY);
@@ -900,9 +1146,11 @@ static void ctrycatchfinally(JF, js_Ast *trystm, js_Ast *catchvar, js_Ast *catch
 			if (!strcmp(catchvar->string, "eval"))
 				jsC_error(J, catchvar, "redefining 'eval' is not allowed in strict mode");
 		}
-		emitstring(J, F, OP_CATCH, catchvar->string);
+		emitcatch(J, F, stm);
+		++F->catchdepth;
 		cstm(J, F, catchstm);
-		emit(J, F, OP_ENDCATCH);
+		--F->catchdepth;
+		emitendcatch(J, F, stm);
 		L3 = emitjump(J, F, OP_JUMP); /* skip past the try block to the finally block */
 	}
 	label(J, F, L1);
@@ -970,6 +1218,47 @@ static void cvarinit(JF, js_Ast *list)
 	}
 }
 
+/* whether cexit emits nothing on the way from node out to target */
+static int plainexit(js_Ast *node, js_Ast *target)
+{
+	js_Ast *prev;
+	do {
+		prev = node, node = node->parent;
+		switch (node->type) {
+		case STM_WITH:
+		case STM_FOR_IN:
+		case STM_FOR_IN_VAR:
+			return 0;
+		case STM_TRY:
+			if (prev == node->a || prev == node->c)
+				return 0;
+			break;
+		}
+	} while (node != target);
+	return 1;
+}
+
+/* Give each arm of a conditional its own return, so that calls in either arm are tail calls.
+ * Only worth it when nothing runs between the call and the return. */
+static void creturn(JF, js_Ast *stm, js_Ast *exp, js_Ast *target)
+{
+	int then;
+	if (exp && exp->type == EXP_COND && plainexit(stm, target)) {
+		cexp(J, F, exp->a);
+		then = emitjump(J, F, OP_JTRUE);
+		creturn(J, F, stm, exp->c, target);
+		label(J, F, then);
+		creturn(J, F, stm, exp->b, target);
+		return;
+	}
+	if (exp)
+		cexp(J, F, exp);
+	else
+		emit(J, F, OP_UNDEF);
+	cexit(J, F, STM_RETURN, stm, target);
+	emit(J, F, OP_RETURN);
+}
+
 static void cstm(JF, js_Ast *stm)
 {
 	js_Ast *target;
@@ -1037,10 +1326,8 @@ static void cstm(JF, js_Ast *stm)
 		if (stm->type == STM_FOR_VAR) {
 			cvarinit(J, F, stm->a);
 		} else {
-			if (stm->a) {
-				cexp(J, F, stm->a);
-				emit(J, F, OP_POP);
-			}
+			if (stm->a)
+				cdiscard(J, F, stm->a);
 		}
 		loop = here(J, F);
 		if (stm->b) {
@@ -1051,10 +1338,8 @@ static void cstm(JF, js_Ast *stm)
 		}
 		cstm(J, F, stm->d);
 		cont = here(J, F);
-		if (stm->c) {
-			cexp(J, F, stm->c);
-			emit(J, F, OP_POP);
-		}
+		if (stm->c)
+			cdiscard(J, F, stm->c);
 		emitjumpto(J, F, OP_JUMP, loop);
 		if (end)
 			label(J, F, end);
@@ -1127,15 +1412,10 @@ static void cstm(JF, js_Ast *stm)
 		break;
 
 	case STM_RETURN:
-		if (stm->a)
-			cexp(J, F, stm->a);
-		else
-			emit(J, F, OP_UNDEF);
 		target = returntarget(J, F, stm);
 		if (!target)
 			jsC_error(J, stm, "return not in function");
-		cexit(J, F, STM_RETURN, stm, target);
-		emit(J, F, OP_RETURN);
+		creturn(J, F, stm, stm->a, target);
 		break;
 
 	case STM_THROW:
@@ -1153,9 +1433,9 @@ static void cstm(JF, js_Ast *stm)
 	case STM_TRY:
 		if (stm->b && stm->c) {
 			if (stm->d)
-				ctrycatchfinally(J, F, stm->a, stm->b, stm->c, stm->d);
+				ctrycatchfinally(J, F, stm, stm->a, stm->b, stm->c, stm->d);
 			else
-				ctrycatch(J, F, stm->a, stm->b, stm->c);
+				ctrycatch(J, F, stm, stm->a, stm->b, stm->c);
 		} else {
 			ctryfinally(J, F, stm->a, stm->d);
 		}
@@ -1170,8 +1450,7 @@ static void cstm(JF, js_Ast *stm)
 			emit(J, F, OP_POP);
 			cexp(J, F, stm);
 		} else {
-			cexp(J, F, stm);
-			emit(J, F, OP_POP);
+			cdiscard(J, F, stm);
 		}
 		break;
 	}
@@ -1187,25 +1466,54 @@ static void cstmlist(JF, js_Ast *list)
 
 /* Analyze */
 
+/* Is this use of arguments a plain read of arguments.length or arguments[i]? */
+static int readinplace(js_State *J, js_Ast *node)
+{
+	js_Ast *exp = node->parent, *parent;
+	if (!exp || exp->a != node)
+		return 0;
+	if (exp->type == EXP_MEMBER) {
+		if (exp->b->string != JS_ATOM(J, length))
+			return 0;
+	} else if (exp->type != EXP_INDEX) {
+		return 0;
+	}
+	parent = exp->parent;
+	if (parent && parent->a == exp) {
+		if (parent->type >= EXP_ASS && parent->type <= EXP_ASS_BITOR)
+			return 0;
+		switch (parent->type) {
+		case EXP_CALL: /* binds this to the arguments object */
+		case EXP_DELETE:
+		case EXP_PREINC:
+		case EXP_PREDEC:
+		case EXP_POSTINC:
+		case EXP_POSTDEC:
+		case STM_FOR_IN:
+			return 0;
+		}
+	}
+	return 1;
+}
+
 static void analyze(JF, js_Ast *node)
 {
-	if (isfun(node->type)) {
-		F->lightweight = 0;
+	if (isfun(node->type))
 		return; /* don't scan inner functions */
-	}
 
 	if (node->type == STM_WITH) {
 		F->lightweight = 0;
 	}
 
-	if (node->type == STM_TRY && node->c) {
-		F->lightweight = 0;
-	}
+	/* a local or catch variable named arguments hides the arguments object */
+	if (node->type == EXP_VAR && node->a->string == JS_ATOM(J, arguments))
+		F->arguments |= JS_ARGUMENTS_OBJECT;
+	if (node->type == STM_TRY && node->b && node->b->string == JS_ATOM(J, arguments))
+		F->arguments |= JS_ARGUMENTS_OBJECT;
 
 	if (node->type == EXP_IDENTIFIER) {
-		if (!strcmp(node->string, "arguments")) {
-			F->lightweight = 0;
-			F->arguments = 1;
+		if (node->string == JS_ATOM(J, arguments)) {
+			F->arguments |= readinplace(J, node) ? JS_ARGUMENTS_INPLACE : JS_ARGUMENTS_OBJECT;
 		} else if (!strcmp(node->string, "eval")) {
 			/* eval may only be used as a direct function call */
 			if (!node->parent || node->parent->type != EXP_CALL || node->parent->a != node)
@@ -1220,6 +1528,57 @@ static void analyze(JF, js_Ast *node)
 	if (node->d) analyze(J, F, node->d);
 }
 
+/* Find the locals named in inner functions; eval in an inner function may name any of them */
+static void capture(JF, js_Ast *node, int inner)
+{
+	unsigned int i;
+
+	if (isfun(node->type))
+		inner = 1;
+
+	if (inner && node->type == EXP_IDENTIFIER && node->string != JS_ATOM(J, arguments)) {
+		if (!strcmp(node->string, "eval")) {
+			for (i = 0; i < F->varlen; ++i)
+				if (F->vartab[i] != JS_ATOM(J, arguments))
+					addenv(J, F, F->vartab[i]);
+		} else if (findlocal(J, F, node->string) >= 0) {
+			addenv(J, F, node->string);
+		}
+	}
+
+	if (node->a) capture(J, F, node->a, inner);
+	if (node->b) capture(J, F, node->b, inner);
+	if (node->c) capture(J, F, node->c, inner);
+	if (node->d) capture(J, F, node->d, inner);
+}
+
+static int hasfun(js_Ast *node)
+{
+	if (isfun(node->type))
+		return 1;
+	return (node->a && hasfun(node->a)) || (node->b && hasfun(node->b)) ||
+		(node->c && hasfun(node->c)) || (node->d && hasfun(node->d));
+}
+
+/* Give each catch variable that no inner function can see a stack slot of its own */
+static void catchslots(JF, js_Ast *node)
+{
+	if (isfun(node->type))
+		return;
+
+	if (node->type == STM_TRY && node->b && node->c && !hasfun(node->c) &&
+			node->b->string != JS_ATOM(J, arguments) && strcmp(node->b->string, "eval")) {
+		addvar(J, F, node->b->string);
+		++F->catchlen;
+		node->catchslot = F->varlen;
+	}
+
+	if (node->a) catchslots(J, F, node->a);
+	if (node->b) catchslots(J, F, node->b);
+	if (node->c) catchslots(J, F, node->c);
+	if (node->d) catchslots(J, F, node->d);
+}
+
 /* Declarations and programs */
 
 static int listlength(js_Ast *list)
@@ -1261,13 +1620,69 @@ static void cfundecs(JF, js_Ast *list)
 	while (list) {
 		js_Ast *stm = list->a;
 		if (stm->type == AST_FUNDEC) {
-			emitfunction(J, F, newfun(J, stm->a, stm->b, stm->c, 0));
-			emitstring(J, F, OP_INITVAR, stm->a->string);
+			emitfunction(J, F, newfun(J, F, stm->a, stm->b, stm->c, 0));
+			emitdecl(J, F, stm->a->string);
 		}
 		list = list->b;
 	}
 }
 
+/*
+ * Lay out the locals of a lightweight function: parameters first, then the
+ * arguments object, then the other variables that stay on the stack. Locals
+ * used by inner functions move to the environment record instead, and the
+ * captured parameters are copied there on entry.
+ */
+static void clocals(JF, js_Ast *name, js_Ast *body)
+{
+	js_Ast *list;
+	unsigned int i, k;
+
+	if (F->arguments) {
+		if (findlocal(J, F, JS_ATOM(J, arguments)) < 0)
+			addvar(J, F, JS_ATOM(J, arguments));
+		else
+			F->arguments = 0; /* shadowed by a parameter */
+	}
+
+	if (name) {
+		if (name->string == JS_ATOM(J, arguments) && F->arguments)
+			F->arguments = JS_ARGUMENTS_OBJECT;
+		addlocal(J, F, name, 0);
+	}
+
+	if (body) {
+		cvardecs(J, F, body);
+		for (list = body; list; list = list->b) {
+			if (list->a->type == AST_FUNDEC) {
+				if (list->a->a->string == JS_ATOM(J, arguments) && F->arguments)
+					F->arguments = JS_ARGUMENTS_OBJECT;
+				addlocal(J, F, list->a->a, 1);
+			}
+		}
+		capture(J, F, body, 0);
+	}
+
+	for (i = k = F->numparams; i < F->varlen; ++i)
+		if (findenv(J, F, F->vartab[i]) < 0)
+			F->vartab[k++] = F->vartab[i];
+	F->varlen = k;
+
+	if (body)
+		catchslots(J, F, body);
+
+	for (i = 0; i < F->envlen; ++i) {
+		int slot = findlocal(J, F, F->envtab[i]);
+		if (slot >= 0) {
+			emit(J, F, OP_GETLOCAL);
+			emitraw(J, F, slot);
+			emit(J, F, OP_INITENV);
+			emitraw(J, F, 0);
+			emitraw(J, F, i);
+		}
+	}
+}
+
 static void cfunbody(JF, js_Ast *name, js_Ast *params, js_Ast *body)
 {
 	F->lightweight = 1;
@@ -1279,21 +1694,22 @@ static void cfunbody(JF, js_Ast *name, js_Ast *params, js_Ast *body)
 	if (body)
 		analyze(J, F, body);
 
+	if (F->arguments & JS_ARGUMENTS_OBJECT || (F->arguments && !F->lightweight))
+		F->arguments = JS_ARGUMENTS_OBJECT;
+
 	cparams(J, F, params);
 
+	if (F->lightweight)
+		clocals(J, F, name, body);
+
 	if (name) {
 		emit(J, F, OP_CURRENT);
-		if (F->lightweight) {
-			addlocal(J, F, name, 0);
-			emit(J, F, OP_INITLOCAL);
-			emitraw(J, F, findlocal(J, F, name->string));
-		} else {
-			emitstring(J, F, OP_INITVAR, name->string);
-		}
+		emitdecl(J, F, name->string);
 	}
 
 	if (body) {
-		cvardecs(J, F, body);
+		if (!F->lightweight)
+			cvardecs(J, F, body);
 		cfundecs(J, F, body);
 	}
 
@@ -1310,10 +1726,10 @@ static void cfunbody(JF, js_Ast *name, js_Ast *params, js_Ast *body)
 
 js_Function *jsC_compilefunction(js_State *J, js_Ast *prog)
 {
-	return newfun(J, prog->a, prog->b, prog->c, 0);
+	return newfun(J, NULL, prog->a, prog->b, prog->c, 0);
 }
 
 js_Function *jsC_compile(js_State *J, js_Ast *prog)
 {
-	return newfun(J, NULL, NULL, prog, 1);
+	return newfun(J, NULL, NULL, NULL, prog, 1);
 }
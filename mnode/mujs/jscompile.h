@@ -15,6 +15,7 @@ enum js_OpCode
 	OP_NUMBER_POS,	/* -K- K */
 	OP_NUMBER_NEG,	/* -K- -K */
 
+	OP_INTEGER,	/* -K K- <integer> */
 	OP_NUMBER,	/* -N- <number> */
 	OP_STRING,	/* -S- <string> */
 	OP_CLOSURE,	/* -F- <closure> */
@@ -37,6 +38,13 @@ enum js_OpCode
 	OP_SETLOCAL,	/* <value> -K- <value> */
 	OP_DELLOCAL,	/* -K- false */
 
+	OP_INITENV,	/* <value> -D K- */
+	OP_GETENV,	/* -D K- <value> */
+	OP_SETENV,	/* <value> -D K- <value> */
+
+	OP_ARGLENGTH,	/* -- <arguments.length> */
+	OP_GETARG,	/* <index> -- <arguments[index]> */
+
 	OP_INITVAR,	/* <value> -S- */
 	OP_DEFVAR,	/* -S- */
 	OP_HASVAR,	/* -S- ( <value> | undefined ) */
@@ -51,9 +59,9 @@ enum js_OpCode
 	OP_INITSETTER,	/* <obj> <key> <closure> -- <obj> */
 
 	OP_GETPROP,	/* <obj> <name> -- <value> */
-	OP_GETPROP_S,	/* <obj> -S- <value> */
+	OP_GETPROP_S,	/* <obj> -S C- <value> */
 	OP_SETPROP,	/* <obj> <name> <value> -- <value> */
-	OP_SETPROP_S,	/* <obj> <value> -S- <value> */
+	OP_SETPROP_S,	/* <obj> <value> -S C- <value> */
 	OP_DELPROP,	/* <obj> <name> -- <success> */
 	OP_DELPROP_S,	/* <obj> -S- <success> */
 
@@ -62,6 +70,7 @@ enum js_OpCode
 
 	OP_EVAL,	/* <args...> -(numargs)- <returnvalue> */
 	OP_CALL,	/* <closure> <this> <args...> -(numargs)- <returnvalue> */
+	OP_TAILCALL,	/* like OP_CALL, replacing the current call when it can */
 	OP_NEW,		/* <closure> <args...> -(numargs)- <returnvalue> */
 
 	OP_TYPEOF,
@@ -115,6 +124,41 @@ enum js_OpCode
 	OP_RETURN,
 
 	OP_LINE,	/* -K- */
+
+	/* Superinstructions fused by the compiler from common sequences */
+	OP_GETLOCAL2,	/* -K K- <value> <value> */
+	OP_GETLOCALPROP_S,	/* -K S C- <value> */
+	OP_GETMETHOD_S,	/* <obj> -S C- <value> <obj> */
+	OP_JNLT,	/* <x> <y> -ADDR- */
+	OP_JNGT,	/* <x> <y> -ADDR- */
+	OP_JNLE,	/* <x> <y> -ADDR- */
+	OP_JNGE,	/* <x> <y> -ADDR- */
+};
+
+/*
+ * Inline cache for a named property access, selected by the C operand.
+ * A hit needs the receiver to have the recorded shape; properties found
+ * on the prototype also need the same prototype with the same shape.
+ */
+struct js_PropCache
+{
+	js_Shape *shape; /* receiver shape, NULL when empty */
+	js_Shape *next; /* set: shape after adding the property, NULL for an own property */
+	js_Object *holder; /* get: prototype holding the property, NULL for an own property */
+	js_Shape *holdershape;
+	unsigned int slot;
+};
+
+/*
+ * A lightweight function that only reads arguments.length and arguments[i]
+ * keeps a copy of the arguments above its locals and reads them in place;
+ * the arguments local holds their count. Otherwise the arguments object is
+ * created on every call.
+ */
+enum
+{
+	JS_ARGUMENTS_OBJECT = 1,
+	JS_ARGUMENTS_INPLACE = 2,
 };
 
 struct js_Function
@@ -122,7 +166,7 @@ struct js_Function
 	const char *name;
 	int script;
 	int lightweight;
-	unsigned int arguments;
+	unsigned int arguments; /* JS_ARGUMENTS_OBJECT or JS_ARGUMENTS_INPLACE */
 	unsigned int numparams;
 
 	js_Instruction *code;
@@ -137,11 +181,23 @@ struct js_Function
 	const char **strtab;
 	unsigned int strcap, strlen;
 
+	js_Regexp *regtab; /* compiled regular expression literals, by strtab index */
+
 	const char **vartab;
 	unsigned int varcap, varlen;
 
+	const char **envtab; /* captured variables, kept in an environment record */
+	unsigned int envcap, envlen;
+
+	js_PropCache *cachetab;
+	unsigned int cachelen;
+
 	const char *filename;
 	int line, lastline;
+	unsigned int lastop, jumptarget; /* for fusing superinstructions */
+	js_Function *outer; /* enclosing function, while compiling */
+	int catchdepth; /* nesting of catch clauses, while compiling */
+	unsigned int catchlen; /* catch variables kept in stack slots, at the end of vartab */
 
 	js_Function *gcnext;
 	int gcmark;
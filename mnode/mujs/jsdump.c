@@ -717,12 +717,15 @@ void jsC_dumpfunction(js_State *J, js_Function *F)
 
 	printf("%s(%d)\n", F->name, F->numparams);
 	if (F->lightweight) printf("\tlightweight\n");
-	if (F->arguments) printf("\targuments\n");
+	if (F->arguments == JS_ARGUMENTS_OBJECT) printf("\targuments\n");
+	if (F->arguments == JS_ARGUMENTS_INPLACE) printf("\targuments in place\n");
 	printf("\tsource %s:%d\n", F->filename, F->line);
 	for (i = 0; i < F->funlen; ++i)
 		printf("\tfunction %d %s\n", i, F->funtab[i]->name);
 	for (i = 0; i < F->varlen; ++i)
 		printf("\tlocal %d %s\n", i + 1, F->vartab[i]);
+	for (i = 0; i < F->envlen; ++i)
+		printf("\tenv %d %s\n", i, F->envtab[i]);
 
 	printf("{\n");
 	while (p < end) {
@@ -735,6 +738,10 @@ void jsC_dumpfunction(js_State *J, js_Function *F)
 		case OP_NUMBER:
 			printf(" %.9g", F->numtab[*p++]);
 			break;
+		case OP_INTEGER:
+			printf(" %d", (int)(p[0] | (unsigned int)p[1] << 16));
+			p += 2;
+			break;
 		case OP_STRING:
 			pc(' ');
 			pstr(F->strtab[*p++]);
@@ -744,14 +751,31 @@ void jsC_dumpfunction(js_State *J, js_Function *F)
 			pregexp(F->strtab[p[0]], p[1]);
 			p += 2;
 			break;
+		case OP_GETLOCAL2:
+		case OP_INITENV:
+		case OP_GETENV:
+		case OP_SETENV:
+			printf(" %d %d", p[0], p[1]);
+			p += 2;
+			break;
+		case OP_GETLOCALPROP_S:
+			printf(" %d ", *p++);
+			ps(F->strtab[*p++]);
+			printf(" %d", *p++);
+			break;
+		case OP_GETPROP_S:
+		case OP_GETMETHOD_S:
+		case OP_SETPROP_S:
+			pc(' ');
+			ps(F->strtab[*p++]);
+			printf(" %d", *p++);
+			break;
 
 		case OP_INITVAR:
 		case OP_DEFVAR:
 		case OP_GETVAR:
 		case OP_SETVAR:
 		case OP_DELVAR:
-		case OP_GETPROP_S:
-		case OP_SETPROP_S:
 		case OP_DELPROP_S:
 		case OP_CATCH:
 			pc(' ');
@@ -767,10 +791,15 @@ void jsC_dumpfunction(js_State *J, js_Function *F)
 		case OP_NUMBER_POS:
 		case OP_NUMBER_NEG:
 		case OP_CALL:
+		case OP_TAILCALL:
 		case OP_NEW:
 		case OP_JUMP:
 		case OP_JTRUE:
 		case OP_JFALSE:
+		case OP_JNLT:
+		case OP_JNGT:
+		case OP_JNLE:
+		case OP_JNGE:
 		case OP_JCASE:
 		case OP_TRY:
 			printf(" %d", *p++);
@@ -798,9 +827,10 @@ void js_dumpvalue(js_State *J, js_Value v)
 	case JS_TNULL: printf("null"); break;
 	case JS_TBOOLEAN: printf(v.u.boolean ? "true" : "false"); break;
 	case JS_TNUMBER: printf("%.9g", v.u.number); break;
+	case JS_TINT32: printf("%d", v.u.integer); break;
 	case JS_TSHRSTR: printf("'%s'", v.u.shrstr); break;
 	case JS_TLITSTR: printf("'%s'", v.u.litstr); break;
-	case JS_TMEMSTR: printf("'%s'", v.u.memstr->p); break;
+	case JS_TMEMSTR: printf("'%s'", JSV_MEMSTR(J, v.u.memstr)); break;
 	case JS_TOBJECT:
 		if (v.u.object == J->G) {
 			printf("[Global]");
@@ -845,8 +875,23 @@ static void js_dumpproperty(js_State *J, js_Property *node)
 
 void js_dumpobject(js_State *J, js_Object *obj)
 {
+	js_Property *ref;
+	unsigned int k;
 	printf("{\n");
-	if (obj->properties->level)
+	if (JSV_ISDENSE(obj)) {
+		for (k = 0; k < obj->u.a.filled; ++k) {
+			printf("\t%u: ", k);
+			js_dumpvalue(J, obj->u.a.array[k]);
+			printf(",\n");
+		}
+	}
+	if (obj->shape) {
+		for (ref = jsV_firstproperty(J, obj); ref; ref = jsV_nextproperty(J, obj, ref)) {
+			printf("\t%s: ", ref->name);
+			js_dumpvalue(J, *jsV_propvalue(J, obj, ref));
+			printf(",\n");
+		}
+	} else if (obj->properties->level)
 		js_dumpproperty(J, obj->properties);
 	printf("}\n");
 }
@@ -9,16 +9,16 @@ static void jsB_stacktrace(js_State *J, int skip)
 {
 	int n;
 	char buf[256];
-	for (n = J->tracetop - skip; n >= 0; --n) {
-		const char *name = J->trace[n].name;
-		const char *file = J->trace[n].file;
-		int line = J->trace[n].line;
+	for (n = J->frametop - skip; n >= 0; --n) {
+		const char *name = J->frames[n].name;
+		const char *file = J->frames[n].file;
+		int line = J->frames[n].line;
 		if (line > 0)
 			snprintf(buf, sizeof buf, "\n\t%s:%d: in function '%s'", file, line, name);
 		else
 			snprintf(buf, sizeof buf, "\n\t%s: in function '%s'", file, name);
 		js_pushstring(J, buf);
-		if (n < J->tracetop - skip)
+		if (n < J->frametop - skip)
 			js_concat(J);
 	}
 }
@@ -32,15 +32,15 @@ static void Ep_toString(js_State *J)
 	if (!js_isobject(J, -1))
 		js_typeerror(J, "not an object");
 
-	if (js_hasproperty(J, 0, "name"))
+	if (js_haspropertyatom(J, 0, JS_ATOM(J, name)))
 		name = js_tostring(J, -1);
-	if (js_hasproperty(J, 0, "message"))
+	if (js_haspropertyatom(J, 0, JS_ATOM(J, message)))
 		message = js_tostring(J, -1);
 
 	snprintf(buf, sizeof buf, "%s: %s", name, message);
 	js_pushstring(J, buf);
 
-	if (js_hasproperty(J, 0, "stackTrace"))
+	if (js_haspropertyatom(J, 0, JS_ATOM(J, stackTrace)))
 		js_concat(J);
 }
 
@@ -50,10 +50,10 @@ static int jsB_ErrorX(js_State *J, js_Object *prototype)
 	js_pushobject(J, jsV_newobject(J, JS_CERROR, prototype));
 	if (top > 1) {
 		js_pushstring(J, js_tostring(J, 1));
-		js_setproperty(J, -2, "message");
+		js_setpropertyatom(J, -2, JS_ATOM(J, message));
 	}
 	jsB_stacktrace(J, 1);
-	js_setproperty(J, -2, "stackTrace");
+	js_setpropertyatom(J, -2, JS_ATOM(J, stackTrace));
 	return 1;
 }
 
@@ -61,9 +61,9 @@ static void js_newerrorx(js_State *J, const char *message, js_Object *prototype)
 {
 	js_pushobject(J, jsV_newobject(J, JS_CERROR, prototype));
 	js_pushstring(J, message);
-	js_setproperty(J, -2, "message");
+	js_setpropertyatom(J, -2, JS_ATOM(J, message));
 	jsB_stacktrace(J, 0);
-	js_setproperty(J, -2, "stackTrace");
+	js_setpropertyatom(J, -2, JS_ATOM(J, stackTrace));
 }
 
 #define DERROR(name, Name) \
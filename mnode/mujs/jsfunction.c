@@ -174,8 +174,8 @@ static void Fp_bind(js_State *J)
 	js_newcconstructor(J, callbound, constructbound, "[bind]", n);
 
 	/* Reuse target function's prototype for HasInstance check. */
-	js_getproperty(J, 0, "prototype");
-	js_defproperty(J, -2, "prototype", JS_READONLY | JS_DONTENUM | JS_DONTCONF);
+	js_getpropertyatom(J, 0, JS_ATOM(J, prototype));
+	js_defpropertyatom(J, -2, JS_ATOM(J, prototype), JS_READONLY | JS_DONTENUM | JS_DONTCONF);
 
 	/* target function */
 	js_copy(J, 0);
@@ -6,6 +6,14 @@
 #include "regex.h"
 
 static void jsG_markobject(js_State *J, int mark, js_Object *obj);
+static void jsG_markslots(js_State *J, int mark, js_Value *v, unsigned int n);
+
+static void jsG_freestring(js_State *J, js_String *str)
+{
+	if (str->p && str->p != str->u.text)
+		js_free(J, str->p);
+	js_free(J, str);
+}
 
 static void jsG_freeenvironment(js_State *J, js_Environment *env)
 {
@@ -14,11 +22,20 @@ static void jsG_freeenvironment(js_State *J, js_Environment *env)
 
 static void jsG_freefunction(js_State *J, js_Function *fun)
 {
+	unsigned int i;
 	js_free(J, fun->funtab);
 	js_free(J, fun->numtab);
 	js_free(J, fun->strtab);
+	if (fun->regtab) {
+		for (i = 0; i < fun->strlen; ++i)
+			if (fun->regtab[i].prog)
+				js_regfree(fun->regtab[i].prog);
+		js_free(J, fun->regtab);
+	}
 	js_free(J, fun->vartab);
+	js_free(J, fun->envtab);
 	js_free(J, fun->code);
+	js_free(J, fun->cachetab);
 	js_free(J, fun);
 }
 
@@ -44,7 +61,10 @@ static void jsG_freeobject(js_State *J, js_Object *obj)
 {
 	if (obj->head)
 		jsG_freeproperty(J, obj->head);
-	if (obj->type == JS_CREGEXP)
+	js_free(J, obj->slots);
+	if (obj->type == JS_CARRAY)
+		js_free(J, obj->u.a.array);
+	if (obj->type == JS_CREGEXP && !obj->u.r.owner)
 		js_regfree(obj->u.r.prog);
 	if (obj->type == JS_CITERATOR)
 		jsG_freeiterator(J, obj->u.iter.head);
@@ -57,6 +77,14 @@ static void jsG_markfunction(js_State *J, int mark, js_Function *fun)
 {
 	unsigned int i;
 	fun->gcmark = mark;
+	jsS_markstring(J, mark, fun->name);
+	jsS_markstring(J, mark, fun->filename);
+	for (i = 0; i < fun->strlen; ++i)
+		jsS_markstring(J, mark, fun->strtab[i]);
+	for (i = 0; i < fun->varlen; ++i)
+		jsS_markstring(J, mark, fun->vartab[i]);
+	for (i = 0; i < fun->envlen; ++i)
+		jsS_markstring(J, mark, fun->envtab[i]);
 	for (i = 0; i < fun->funlen; ++i)
 		if (fun->funtab[i]->gcmark != mark)
 			jsG_markfunction(J, mark, fun->funtab[i]);
@@ -66,17 +94,44 @@ static void jsG_markenvironment(js_State *J, int mark, js_Environment *env)
 {
 	do {
 		env->gcmark = mark;
-		if (env->variables->gcmark != mark)
-			jsG_markobject(J, mark, env->variables);
+		if (env->variables) {
+			if (env->variables->gcmark != mark)
+				jsG_markobject(J, mark, env->variables);
+		} else {
+			if (env->function->gcmark != mark)
+				jsG_markfunction(J, mark, env->function);
+			jsG_markslots(J, mark, env->slots, env->function->envlen);
+		}
 		env = env->outer;
 	} while (env && env->gcmark != mark);
 }
 
+/* Mark a string and the pieces of a rope. Recurse into the shorter half, which
+ * is at most half as long, so the C stack stays logarithmic in the length. */
+static void jsG_markmemstring(js_State *J, int mark, js_String *str)
+{
+	while (str->gcmark != mark) {
+		str->gcmark = mark;
+		if (str->p)
+			return;
+		if (str->u.rope.left->length < str->u.rope.right->length) {
+			jsG_markmemstring(J, mark, str->u.rope.left);
+			str = str->u.rope.right;
+		} else {
+			jsG_markmemstring(J, mark, str->u.rope.right);
+			str = str->u.rope.left;
+		}
+	}
+}
+
 static void jsG_markproperty(js_State *J, int mark, js_Property *node)
 {
 	while (node) {
+		jsS_markstring(J, mark, node->name);
+		if (node->value.type == JS_TLITSTR)
+			jsS_markliteral(J, mark, node->value.u.litstr);
 		if (node->value.type == JS_TMEMSTR && node->value.u.memstr->gcmark != mark)
-			node->value.u.memstr->gcmark = mark;
+			jsG_markmemstring(J, mark, node->value.u.memstr);
 		if (node->value.type == JS_TOBJECT && node->value.u.object->gcmark != mark)
 			jsG_markobject(J, mark, node->value.u.object);
 		if (node->getter && node->getter->gcmark != mark)
@@ -87,15 +142,54 @@ static void jsG_markproperty(js_State *J, int mark, js_Property *node)
 	}
 }
 
+static void jsG_markshape(js_State *J, int mark, js_Shape *shape)
+{
+	while (shape && shape->gcmark != mark) {
+		shape->gcmark = mark;
+		if (shape->parent)
+			jsS_markstring(J, mark, shape->prop.name);
+		shape = shape->parent;
+	}
+}
+
+static void jsG_markslots(js_State *J, int mark, js_Value *v, unsigned int n)
+{
+	while (n--) {
+		if (v->type == JS_TLITSTR)
+			jsS_markliteral(J, mark, v->u.litstr);
+		if (v->type == JS_TMEMSTR && v->u.memstr->gcmark != mark)
+			jsG_markmemstring(J, mark, v->u.memstr);
+		if (v->type == JS_TOBJECT && v->u.object->gcmark != mark)
+			jsG_markobject(J, mark, v->u.object);
+		++v;
+	}
+}
+
 static void jsG_markobject(js_State *J, int mark, js_Object *obj)
 {
 	obj->gcmark = mark;
+	if (obj->shape) {
+		jsG_markshape(J, mark, obj->shape);
+		jsG_markslots(J, mark, obj->slots, obj->shape->count);
+	}
 	if (obj->head)
 		jsG_markproperty(J, mark, obj->head);
+	if (JSV_ISDENSE(obj))
+		jsG_markslots(J, mark, obj->u.a.array, obj->u.a.filled);
 	if (obj->prototype && obj->prototype->gcmark != mark)
 		jsG_markobject(J, mark, obj->prototype);
+	if (obj->type == JS_CSTRING)
+		jsS_markstring(J, mark, obj->u.s.string);
+	if (obj->type == JS_CREGEXP) {
+		jsS_markstring(J, mark, obj->u.r.source);
+		if (obj->u.r.owner && obj->u.r.owner->gcmark != mark)
+			jsG_markfunction(J, mark, obj->u.r.owner);
+	}
 	if (obj->type == JS_CITERATOR) {
+		js_Iterator *it;
 		jsG_markobject(J, mark, obj->u.iter.target);
+		for (it = obj->u.iter.head; it; it = it->next)
+			jsS_markstring(J, mark, it->name);
 	}
 	if (obj->type == JS_CFUNCTION || obj->type == JS_CSCRIPT) {
 		if (obj->u.f.scope && obj->u.f.scope->gcmark != mark)
@@ -110,8 +204,10 @@ static void jsG_markstack(js_State *J, int mark)
 	js_Value *v = J->stack;
 	int n = J->top;
 	while (n--) {
+		if (v->type == JS_TLITSTR)
+			jsS_markliteral(J, mark, v->u.litstr);
 		if (v->type == JS_TMEMSTR && v->u.memstr->gcmark != mark)
-			v->u.memstr->gcmark = mark;
+			jsG_markmemstring(J, mark, v->u.memstr);
 		if (v->type == JS_TOBJECT && v->u.object->gcmark != mark)
 			jsG_markobject(J, mark, v->u.object);
 		++v;
@@ -124,12 +220,17 @@ void js_gc(js_State *J, int report)
 	js_Object *obj, *nextobj, **prevnextobj;
 	js_String *str, *nextstr, **prevnextstr;
 	js_Environment *env, *nextenv, **prevnextenv;
-	int nenv = 0, nfun = 0, nobj = 0, nstr = 0;
-	int genv = 0, gfun = 0, gobj = 0, gstr = 0;
+	js_Shape *shape, *nextshape, **prevnextshape, **kidp;
+	int nenv = 0, nfun = 0, nobj = 0, nstr = 0, nshape = 0;
+	int genv = 0, gfun = 0, gobj = 0, gstr = 0, gshape = 0;
+	int natom = 0, gatom = 0;
+	unsigned int atombytes;
 	int mark;
 	int i;
 
 	mark = J->gcmark = J->gcmark == 1 ? 2 : 1;
+	J->strkey = NULL; /* the measured literal string may be swept */
+	memset(J->cursors, 0, sizeof J->cursors); /* and so may the strings looked up */
 
 	jsG_markobject(J, mark, J->Object_prototype);
 	jsG_markobject(J, mark, J->Array_prototype);
@@ -151,12 +252,15 @@ void js_gc(js_State *J, int report)
 	jsG_markobject(J, mark, J->R);
 	jsG_markobject(J, mark, J->G);
 
+	jsG_markshape(J, mark, J->emptyshape);
+
 	jsG_markstack(J, mark);
 
 	jsG_markenvironment(J, mark, J->E);
 	jsG_markenvironment(J, mark, J->GE);
-	for (i = 0; i < J->envtop; ++i)
-		jsG_markenvironment(J, mark, J->envstack[i]);
+	for (i = 0; i <= J->frametop; ++i)
+		if (J->frames[i].E)
+			jsG_markenvironment(J, mark, J->frames[i].E);
 
 	prevnextenv = &J->gcenv;
 	for (env = J->gcenv; env; env = nextenv) {
@@ -202,7 +306,7 @@ void js_gc(js_State *J, int report)
 		nextstr = str->gcnext;
 		if (str->gcmark != mark) {
 			*prevnextstr = nextstr;
-			js_free(J, str);
+			jsG_freestring(J, str);
 			++gstr;
 		} else {
 			prevnextstr = &str->gcnext;
@@ -210,9 +314,43 @@ void js_gc(js_State *J, int report)
 		++nstr;
 	}
 
-	if (report)
-		printf("garbage collected: %d/%d envs, %d/%d funs, %d/%d objs, %d/%d strs\n",
-			genv, nenv, gfun, nfun, gobj, nobj, gstr, nstr);
+	/* unlink dead shapes from live parents; the kids of a dead shape are all dead */
+	for (shape = J->gcshape; shape; shape = shape->gcnext) {
+		if (shape->gcmark != mark && shape->parent && shape->parent->gcmark == mark) {
+			kidp = &shape->parent->kids;
+			while (*kidp != shape)
+				kidp = &(*kidp)->sibling;
+			*kidp = shape->sibling;
+		}
+	}
+
+	prevnextshape = &J->gcshape;
+	for (shape = J->gcshape; shape; shape = nextshape) {
+		nextshape = shape->gcnext;
+		if (shape->gcmark != mark) {
+			*prevnextshape = nextshape;
+			js_free(J, shape);
+			++gshape;
+		} else {
+			prevnextshape = &shape->gcnext;
+		}
+		++nshape;
+	}
+
+	atombytes = jsS_sweepstrings(J, mark, &natom, &gatom);
+
+	/* inline caches may point to freed shapes and objects */
+	if (gobj || gshape)
+		for (fun = J->gcfun; fun; fun = fun->gcnext)
+			if (fun->cachetab)
+				memset(fun->cachetab, 0, fun->cachelen * sizeof *fun->cachetab);
+
+	if (report) {
+		printf("garbage collected: %d/%d envs, %d/%d funs, %d/%d objs, %d/%d strs, %d/%d shapes\n",
+			genv, nenv, gfun, nfun, gobj, nobj, gstr, nstr, gshape, nshape);
+		printf("interned strings: %d/%d, %u bytes reclaimed\n", gatom, natom, atombytes);
+		printf("inline caches: %u hits, %u misses\n", J->ichits, J->icmisses);
+	}
 }
 
 void js_freestate(js_State *J)
@@ -221,6 +359,12 @@ void js_freestate(js_State *J)
 	js_Object *obj, *nextobj;
 	js_Environment *env, *nextenv;
 	js_String *str, *nextstr;
+	js_Shape *shape, *nextshape;
+	int i;
+
+#ifdef JS_OPSTATS
+	jsR_dumpopstats();
+#endif
 
 	for (env = J->gcenv; env; env = nextenv)
 		nextenv = env->gcnext, jsG_freeenvironment(J, env);
@@ -229,11 +373,20 @@ void js_freestate(js_State *J)
 	for (obj = J->gcobj; obj; obj = nextobj)
 		nextobj = obj->gcnext, jsG_freeobject(J, obj);
 	for (str = J->gcstr; str; str = nextstr)
-		nextstr = str->gcnext, js_free(J, str);
+		nextstr = str->gcnext, jsG_freestring(J, str);
+	for (shape = J->gcshape; shape; shape = nextshape)
+		nextshape = shape->gcnext, js_free(J, shape);
 
 	jsS_freestrings(J);
 
 	js_free(J, J->lexbuf.text);
+	jsR_freeoldstacks(J);
+	js_free(J, J->oldstacks);
+	for (i = 0; i < J->trycap; ++i)
+		js_free(J, J->trybuf[i]);
+	js_free(J, J->trybuf);
+	js_free(J, J->strcache);
+	J->alloc(J->actx, J->frames, 0);
 	J->alloc(J->actx, J->stack, 0);
 	J->alloc(J->actx, J, 0);
 }
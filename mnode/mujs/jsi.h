@@ -6,8 +6,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdarg.h>
 #include <string.h>
+#include <limits.h>
 #include <setjmp.h>
 #include <math.h>
 #include <float.h>
@@ -40,20 +42,28 @@ void js_free(js_State *J, void *ptr);
 typedef struct js_Regexp js_Regexp;
 typedef struct js_Value js_Value;
 typedef struct js_Object js_Object;
+typedef struct js_Shape js_Shape;
 typedef struct js_String js_String;
 typedef struct js_Ast js_Ast;
 typedef struct js_Function js_Function;
+typedef struct js_PropCache js_PropCache;
 typedef struct js_Environment js_Environment;
 typedef struct js_StringNode js_StringNode;
 typedef struct js_Jumpbuf js_Jumpbuf;
-typedef struct js_StackTrace js_StackTrace;
+typedef struct js_Frame js_Frame;
+typedef struct js_Cursor js_Cursor;
 
 /* Limits */
 
-#define JS_STACKSIZE 256	/* value stack size */
-#define JS_ENVLIMIT 64		/* environment stack size */
-#define JS_TRYLIMIT 64		/* exception stack size */
+/* defaults for the per-state limits in js_Options */
+#define JS_STACKSIZE 64		/* initial value stack size */
+#define JS_STACKLIMIT 16384	/* max value stack size */
+#define JS_FRAMES 16		/* initial call stack size */
+#define JS_FRAMELIMIT 4096	/* max call stack size */
+#define JS_TRYLIMIT 64		/* max exception stack size */
 #define JS_GCLIMIT 10000	/* run gc cycle every N allocations */
+#define JS_SHAPELIMIT 16	/* max properties of an object in shape mode */
+#define JS_CURSORS 8		/* strings remembered for character lookups */
 
 /* instruction size -- change to unsigned int if you get integer overflow syntax errors */
 typedef unsigned short js_Instruction;
@@ -61,9 +71,47 @@ typedef unsigned short js_Instruction;
 /* String interning */
 
 const char *js_intern(js_State *J, const char *s);
+void jsS_markstring(js_State *J, int mark, const char *s);
+void jsS_markliteral(js_State *J, int mark, const char *s);
+unsigned int jsS_sweepstrings(js_State *J, int mark, int *nstr, int *gstr);
 void jsS_dumpstrings(js_State *J);
 void jsS_freestrings(js_State *J);
 
+/* Atoms are names interned when the state is created and never collected */
+
+enum
+{
+	JS_ATOM_length,
+	JS_ATOM_prototype,
+	JS_ATOM_constructor,
+	JS_ATOM_toString,
+	JS_ATOM_valueOf,
+	JS_ATOM_callee,
+	JS_ATOM_arguments,
+	JS_ATOM_name,
+	JS_ATOM_message,
+	JS_ATOM_stackTrace,
+	JS_ATOM_source,
+	JS_ATOM_global,
+	JS_ATOM_ignoreCase,
+	JS_ATOM_multiline,
+	JS_ATOM_lastIndex,
+	JS_ATOM_index,
+	JS_ATOM_input,
+	JS_ATOM_toJSON,
+	JS_ATOM_value,
+	JS_ATOM_writable,
+	JS_ATOM_enumerable,
+	JS_ATOM_configurable,
+	JS_ATOM_get,
+	JS_ATOM_set,
+	JS_NATOMS
+};
+
+#define JS_ATOM(J, x) ((J)->atoms[JS_ATOM_##x])
+
+void jsS_initatoms(js_State *J);
+
 /* Portable strtod and printf float formatting */
 
 void js_fmtexp(char *p, int e);
@@ -95,24 +143,64 @@ void js_dup1rot4(js_State *J);
 void js_pushundefinedthis(js_State *J); /* push 'global' if non-strict, undefined if strict */
 
 void js_RegExp_prototype_exec(js_State *J, js_Regexp *re, const char *text);
+void js_newregexpliteral(js_State *J, js_Function *F, int idx, int flags);
 
 void js_trap(js_State *J, int pc); /* dump stack and environment to stdout */
 
-struct js_StackTrace
+/*
+ * A call frame. Calls from C recurse into the interpreter, calls from
+ * one script function to another are run in the same interpreter loop
+ * and keep the caller to resume in the frame.
+ */
+struct js_Frame
 {
 	const char *name;
 	const char *file;
 	int line;
+	js_Environment *E; /* scope of the caller, restored on return */
+	js_Function *F; /* caller of an inline call, NULL otherwise */
+	js_Instruction *pc;
+	int bot;
+	int construct; /* an inline call by 'new' returns 'this' unless it returns an object */
+};
+
+/*
+ * The last character looked up in a non-ASCII string and its byte offset,
+ * so that walking a string by index costs O(1) per step. The state keeps
+ * the most recently used few, most recent first.
+ */
+struct js_Cursor
+{
+	js_String *str;
+	unsigned int index, offset;
 };
 
 /* Exception handling */
 
+/*
+ * GCC's builtin setjmp saves only the frame and stack pointers and the
+ * resume address, and leaves the compiler to spill the live registers,
+ * which is much cheaper than the library call on every try. The longjmp
+ * must not be in the function that called setjmp, hence the noinline
+ * js_throw.
+ */
+#if defined(__GNUC__) && !defined(__clang__)
+typedef void *js_JumpState[5];
+#define js_setjmp(buf) __builtin_setjmp(buf)
+#define js_longjmp(buf) __builtin_longjmp(buf, 1)
+#define JS_NOINLINE __attribute__((noinline))
+#else
+typedef jmp_buf js_JumpState;
+#define js_setjmp(buf) setjmp(buf)
+#define js_longjmp(buf) longjmp(buf, 1)
+#define JS_NOINLINE
+#endif
+
 struct js_Jumpbuf
 {
-	jmp_buf buf;
+	js_JumpState buf;
 	js_Environment *E;
-	int envtop;
-	int tracetop;
+	int frametop;
 	int top, bot;
 	js_Instruction *pc;
 };
@@ -120,10 +208,10 @@ struct js_Jumpbuf
 void js_savetry(js_State *J, js_Instruction *pc);
 
 #define js_trypc(J, PC) \
-	(js_savetry(J, PC), setjmp(J->trybuf[J->trytop++].buf))
+	(js_savetry(J, PC), js_setjmp(J->trybuf[J->trytop++]->buf))
 
 #define js_try(J) \
-	(js_savetry(J, NULL), setjmp(J->trybuf[J->trytop++].buf))
+	(js_savetry(J, NULL), js_setjmp(J->trybuf[J->trytop++]->buf))
 
 #define js_endtry(J) \
 	(--J->trytop)
@@ -137,7 +225,9 @@ struct js_State
 	js_Alloc alloc;
 	js_Panic panic;
 
-	js_StringNode *strings;
+	js_StringNode **strings; /* intern table */
+	unsigned int strlen, strcap;
+	const char *atoms[JS_NATOMS];
 
 	int strict;
 
@@ -183,10 +273,18 @@ struct js_State
 	js_Object *G; /* the global object */
 	js_Environment *E; /* current environment scope */
 	js_Environment *GE; /* global environment scope (at the root) */
+	js_Shape *emptyshape; /* root of the shape transition tree */
+	unsigned int ichits, icmisses; /* property inline cache statistics */
+	const char *strkey; /* literal string last measured into strcache */
+	js_String *strcache;
+	js_Cursor cursors[JS_CURSORS];
 
-	/* execution stack */
+	/* execution stack, grown on demand up to stacklimit */
 	int top, bot;
+	int stacksize, stacklimit;
 	js_Value *stack;
+	int oldstacklen;
+	js_Value **oldstacks; /* outgrown stacks; js_tostring results may point into them */
 
 	/* garbage collector list */
 	int gcmark;
@@ -194,20 +292,17 @@ struct js_State
 	js_Environment *gcenv;
 	js_Function *gcfun;
 	js_Object *gcobj;
+	js_Shape *gcshape;
 	js_String *gcstr;
 
 
-	/* environments on the call stack but currently not in scope */
-	int envtop;
-	js_Environment *envstack[JS_ENVLIMIT];
-
-	/* debug info stack trace */
-	int tracetop;
-	js_StackTrace trace[JS_ENVLIMIT];
+	/* call stack, grown on demand up to framelimit */
+	int frametop, framecap, framelimit;
+	js_Frame *frames;
 
-	/* exception stack */
-	int trytop;
-	js_Jumpbuf trybuf[JS_TRYLIMIT];
+	/* exception stack; the jump buffers are allocated one by one so they never move */
+	int trytop, trycap, trylimit;
+	js_Jumpbuf **trybuf;
 };
 
 #endif
@@ -1,106 +1,162 @@
 #include "jsi.h"
 
-/* Use an AA-tree to quickly look up interned strings. */
+/*
+ * Interned strings live in a chained hash table. Interned strings are
+ * garbage collected: js_gc marks the ones still referenced by a property,
+ * shape, iterator, string or regexp object, function constant table or
+ * literal string value, and jsS_sweepstrings frees the rest. Atoms are
+ * pinned and stay until the state is freed.
+ */
+
+#define JS_STRINGBUCKETS 256 /* initial size of the intern table */
 
 struct js_StringNode
 {
-	js_StringNode *left, *right;
-	int level;
+	js_StringNode *next;
+	unsigned int hash;
+	unsigned short gcmark;
+	unsigned short pinned;
 	char string[1];
 };
 
-static js_StringNode jsS_sentinel = { &jsS_sentinel, &jsS_sentinel, 0, ""};
+#define NODESIZE(n) (offsetof(js_StringNode, string) + (n) + 1)
+#define STRINGNODE(s) ((js_StringNode*)((s) - offsetof(js_StringNode, string)))
 
-static js_StringNode *jsS_newstringnode(js_State *J, const char *string, const char **result)
+static unsigned int jsS_hash(const char *s, unsigned int *np)
 {
-	int n = strlen(string);
-	js_StringNode *node = js_malloc(J, offsetof(js_StringNode, string) + n + 1);
-	node->left = node->right = &jsS_sentinel;
-	node->level = 1;
-	memcpy(node->string, string, n + 1);
-	return *result = node->string, node;
+	const char *p = s;
+	unsigned int h = 2166136261u;
+	while (*p)
+		h = (h ^ (unsigned char)*p++) * 16777619u;
+	*np = p - s;
+	return h;
 }
 
-static js_StringNode *jsS_skew(js_StringNode *node)
+static void jsS_resize(js_State *J, unsigned int cap)
 {
-	if (node->left->level == node->level) {
-		js_StringNode *temp = node;
-		node = node->left;
-		temp->left = node->right;
-		node->right = temp;
+	js_StringNode **table = js_malloc(J, cap * sizeof *table);
+	js_StringNode *node, *next;
+	unsigned int i;
+	memset(table, 0, cap * sizeof *table);
+	for (i = 0; i < J->strcap; ++i) {
+		for (node = J->strings[i]; node; node = next) {
+			next = node->next;
+			node->next = table[node->hash & (cap - 1)];
+			table[node->hash & (cap - 1)] = node;
+		}
 	}
-	return node;
+	js_free(J, J->strings);
+	J->strings = table;
+	J->strcap = cap;
 }
 
-static js_StringNode *jsS_split(js_StringNode *node)
+const char *js_intern(js_State *J, const char *s)
 {
-	if (node->right->right->level == node->level) {
-		js_StringNode *temp = node;
-		node = node->right;
-		temp->right = node->left;
-		node->left = temp;
-		++node->level;
+	js_StringNode *node;
+	unsigned int n, h = jsS_hash(s, &n);
+
+	if (J->strings) {
+		for (node = J->strings[h & (J->strcap - 1)]; node; node = node->next)
+			if (node->hash == h && !strcmp(node->string, s))
+				return node->string;
 	}
-	return node;
+
+	if (J->strlen >= J->strcap)
+		jsS_resize(J, J->strcap ? J->strcap * 2 : JS_STRINGBUCKETS);
+
+	node = js_malloc(J, NODESIZE(n));
+	node->hash = h;
+	node->gcmark = 0;
+	node->pinned = 0;
+	memcpy(node->string, s, n + 1);
+	node->next = J->strings[h & (J->strcap - 1)];
+	J->strings[h & (J->strcap - 1)] = node;
+	++J->strlen;
+	++J->gccounter;
+	return node->string;
 }
 
-static js_StringNode *jsS_insert(js_State *J, js_StringNode *node, const char *string, const char **result)
+/* Intern a string and keep it alive for the lifetime of the state */
+const char *js_atom(js_State *J, const char *s)
 {
-	if (node != &jsS_sentinel) {
-		int c = strcmp(string, node->string);
-		if (c < 0)
-			node->left = jsS_insert(J, node->left, string, result);
-		else if (c > 0)
-			node->right = jsS_insert(J, node->right, string, result);
-		else
-			return *result = node->string, node;
-		node = jsS_skew(node);
-		node = jsS_split(node);
-		return node;
-	}
-	return jsS_newstringnode(J, string, result);
+	s = js_intern(J, s);
+	STRINGNODE(s)->pinned = 1;
+	return s;
 }
 
-static void dumpstringnode(js_StringNode *node, int level)
+static const char *atomnames[] = {
+#include "atomnames.h"
+};
+
+void jsS_initatoms(js_State *J)
 {
 	int i;
-	if (node->left != &jsS_sentinel)
-		dumpstringnode(node->left, level + 1);
-	printf("%d: ", node->level);
-	for (i = 0; i < level; ++i)
-		putchar('\t');
-	printf("'%s'\n", node->string);
-	if (node->right != &jsS_sentinel)
-		dumpstringnode(node->right, level + 1);
+	for (i = 0; i < JS_NATOMS; ++i)
+		J->atoms[i] = js_atom(J, atomnames[i]);
 }
 
-void jsS_dumpstrings(js_State *J)
+/* Mark a string known to come from js_intern. */
+void jsS_markstring(js_State *J, int mark, const char *s)
 {
-	js_StringNode *root = J->strings;
-	printf("interned strings {\n");
-	if (root && root != &jsS_sentinel)
-		dumpstringnode(root, 1);
-	printf("}\n");
+	STRINGNODE(s)->gcmark = mark;
+}
+
+/* Mark a string that may or may not be interned, such as a literal string value. */
+void jsS_markliteral(js_State *J, int mark, const char *s)
+{
+	js_StringNode *node;
+	unsigned int n, h;
+	if (!J->strings)
+		return;
+	h = jsS_hash(s, &n);
+	for (node = J->strings[h & (J->strcap - 1)]; node; node = node->next) {
+		if (node->string == s) {
+			node->gcmark = mark;
+			return;
+		}
+	}
 }
 
-static void jsS_freestringnode(js_State *J, js_StringNode *node)
+/* Free unmarked strings; return the number of bytes reclaimed. */
+unsigned int jsS_sweepstrings(js_State *J, int mark, int *nstr, int *gstr)
 {
-	if (node->left != &jsS_sentinel) jsS_freestringnode(J, node->left);
-	if (node->right != &jsS_sentinel) jsS_freestringnode(J, node->right);
-	js_free(J, node);
+	js_StringNode *node, **prevnext;
+	unsigned int i, bytes = 0;
+	for (i = 0; i < J->strcap; ++i) {
+		prevnext = &J->strings[i];
+		while ((node = *prevnext)) {
+			++*nstr;
+			if (node->gcmark != mark && !node->pinned) {
+				*prevnext = node->next;
+				bytes += NODESIZE(strlen(node->string));
+				js_free(J, node);
+				--J->strlen;
+				++*gstr;
+			} else {
+				prevnext = &node->next;
+			}
+		}
+	}
+	return bytes;
 }
 
-void jsS_freestrings(js_State *J)
+void jsS_dumpstrings(js_State *J)
 {
-	if (J->strings && J->strings != &jsS_sentinel)
-		jsS_freestringnode(J, J->strings);
+	js_StringNode *node;
+	unsigned int i;
+	printf("interned strings {\n");
+	for (i = 0; i < J->strcap; ++i)
+		for (node = J->strings[i]; node; node = node->next)
+			printf("\t%u: '%s'\n", i, node->string);
+	printf("}\n");
 }
 
-const char *js_intern(js_State *J, const char *s)
+void jsS_freestrings(js_State *J)
 {
-	const char *result;
-	if (!J->strings)
-		J->strings = &jsS_sentinel;
-	J->strings = jsS_insert(J, J->strings, s, &result);
-	return result;
+	js_StringNode *node, *next;
+	unsigned int i;
+	for (i = 0; i < J->strcap; ++i)
+		for (node = J->strings[i]; node; node = next)
+			next = node->next, js_free(J, node);
+	js_free(J, J->strings);
 }
@@ -54,9 +54,9 @@ static void Op_valueOf(js_State *J)
 static void Op_hasOwnProperty(js_State *J)
 {
 	js_Object *self = js_toobject(J, 0);
-	const char *name = js_tostring(J, 1);
+	const char *name = js_intern(J, js_tostring(J, 1));
 	js_Property *ref = jsV_getownproperty(J, self, name);
-	js_pushboolean(J, ref != NULL);
+	js_pushboolean(J, ref != NULL || jsV_getdenseindex(J, self, name));
 }
 
 static void Op_isPrototypeOf(js_State *J)
@@ -78,9 +78,9 @@ static void Op_isPrototypeOf(js_State *J)
 static void Op_propertyIsEnumerable(js_State *J)
 {
 	js_Object *self = js_toobject(J, 0);
-	const char *name = js_tostring(J, 1);
+	const char *name = js_intern(J, js_tostring(J, 1));
 	js_Property *ref = jsV_getownproperty(J, self, name);
-	js_pushboolean(J, ref && !(ref->atts & JS_DONTENUM));
+	js_pushboolean(J, (ref && !(ref->atts & JS_DONTENUM)) || jsV_getdenseindex(J, self, name));
 }
 
 static void O_getPrototypeOf(js_State *J)
@@ -97,37 +97,53 @@ static void O_getPrototypeOf(js_State *J)
 
 static void O_getOwnPropertyDescriptor(js_State *J)
 {
-	js_Object *obj;
+	js_Object *obj, *holder;
 	js_Property *ref;
+	const char *name;
+	js_Value *v;
 	if (!js_isobject(J, 1))
 		js_typeerror(J, "not an object");
 	obj = js_toobject(J, 1);
-	ref = jsV_getproperty(J, obj, js_tostring(J, 2));
+	name = js_intern(J, js_tostring(J, 2));
+	v = jsV_getdenseindex(J, obj, name);
+	if (v) {
+		js_newobject(J);
+		js_pushvalue(J, *v);
+		js_setpropertyatom(J, -2, JS_ATOM(J, value));
+		js_pushboolean(J, 1);
+		js_setpropertyatom(J, -2, JS_ATOM(J, writable));
+		js_pushboolean(J, 1);
+		js_setpropertyatom(J, -2, JS_ATOM(J, enumerable));
+		js_pushboolean(J, 1);
+		js_setpropertyatom(J, -2, JS_ATOM(J, configurable));
+		return;
+	}
+	ref = jsV_getpropertyx(J, obj, name, &holder);
 	if (!ref)
 		js_pushundefined(J);
 	else {
 		js_newobject(J);
 		if (!ref->getter && !ref->setter) {
-			js_pushvalue(J, ref->value);
-			js_setproperty(J, -2, "value");
+			js_pushvalue(J, *jsV_propvalue(J, holder, ref));
+			js_setpropertyatom(J, -2, JS_ATOM(J, value));
 			js_pushboolean(J, !(ref->atts & JS_READONLY));
-			js_setproperty(J, -2, "writable");
+			js_setpropertyatom(J, -2, JS_ATOM(J, writable));
 		} else {
 			if (ref->getter)
 				js_pushobject(J, ref->getter);
 			else
 				js_pushundefined(J);
-			js_setproperty(J, -2, "get");
+			js_setpropertyatom(J, -2, JS_ATOM(J, get));
 			if (ref->setter)
 				js_pushobject(J, ref->setter);
 			else
 				js_pushundefined(J);
-			js_setproperty(J, -2, "set");
+			js_setpropertyatom(J, -2, JS_ATOM(J, set));
 		}
 		js_pushboolean(J, !(ref->atts & JS_DONTENUM));
-		js_setproperty(J, -2, "enumerable");
+		js_setpropertyatom(J, -2, JS_ATOM(J, enumerable));
 		js_pushboolean(J, !(ref->atts & JS_DONTCONF));
-		js_setproperty(J, -2, "configurable");
+		js_setpropertyatom(J, -2, JS_ATOM(J, configurable));
 	}
 }
 
@@ -135,6 +151,7 @@ static void O_getOwnPropertyNames(js_State *J)
 {
 	js_Object *obj;
 	js_Property *ref;
+	char buf[32];
 	unsigned int k;
 	int i;
 
@@ -145,7 +162,13 @@ static void O_getOwnPropertyNames(js_State *J)
 	js_newarray(J);
 
 	i = 0;
-	for (ref = obj->head; ref; ref = ref->next) {
+	if (JSV_ISDENSE(obj)) {
+		for (k = 0; k < obj->u.a.filled; ++k) {
+			js_pushstring(J, js_itoa(buf, k));
+			js_setindex(J, -2, i++);
+		}
+	}
+	for (ref = jsV_firstproperty(J, obj); ref; ref = jsV_nextproperty(J, obj, ref)) {
 		js_pushliteral(J, ref->name);
 		js_setindex(J, -2, i++);
 	}
@@ -190,20 +213,20 @@ static void ToPropertyDescriptor(js_State *J, js_Object *obj, const char *name,
 	js_pushobject(J, obj);
 	js_pushobject(J, desc);
 
-	if (js_hasproperty(J, -1, "writable")) {
+	if (js_haspropertyatom(J, -1, JS_ATOM(J, writable))) {
 		haswritable = 1;
 		writable = js_toboolean(J, -1);
 		js_pop(J, 1);
 	}
-	if (js_hasproperty(J, -1, "enumerable")) {
+	if (js_haspropertyatom(J, -1, JS_ATOM(J, enumerable))) {
 		enumerable = js_toboolean(J, -1);
 		js_pop(J, 1);
 	}
-	if (js_hasproperty(J, -1, "configurable")) {
+	if (js_haspropertyatom(J, -1, JS_ATOM(J, configurable))) {
 		configurable = js_toboolean(J, -1);
 		js_pop(J, 1);
 	}
-	if (js_hasproperty(J, -1, "value")) {
+	if (js_haspropertyatom(J, -1, JS_ATOM(J, value))) {
 		hasvalue = 1;
 		js_setproperty(J, -3, name);
 	}
@@ -212,14 +235,14 @@ static void ToPropertyDescriptor(js_State *J, js_Object *obj, const char *name,
 	if (!enumerable) atts |= JS_DONTENUM;
 	if (!configurable) atts |= JS_DONTCONF;
 
-	if (js_hasproperty(J, -1, "get")) {
+	if (js_haspropertyatom(J, -1, JS_ATOM(J, get))) {
 		if (haswritable || hasvalue)
 			js_typeerror(J, "value/writable and get/set attributes are exclusive");
 	} else {
 		js_pushundefined(J);
 	}
 
-	if (js_hasproperty(J, -2, "set")) {
+	if (js_haspropertyatom(J, -2, JS_ATOM(J, set))) {
 		if (haswritable || hasvalue)
 			js_typeerror(J, "value/writable and get/set attributes are exclusive");
 	} else {
@@ -239,22 +262,35 @@ static void O_defineProperty(js_State *J)
 	js_copy(J, 1);
 }
 
+/* The value of an own property, taken by name since a descriptor getter may reshape obj */
+static js_Value *ownvalue(js_State *J, js_Object *obj, const char *name)
+{
+	js_Property *ref = jsV_getownproperty(J, obj, name);
+	if (ref)
+		return jsV_propvalue(J, obj, ref);
+	return jsV_getdenseindex(J, obj, name);
+}
+
 static void O_defineProperties(js_State *J)
 {
 	js_Object *props;
-	js_Property *ref;
+	js_Value *v;
+	const char *name;
 
 	if (!js_isobject(J, 1)) js_typeerror(J, "not an object");
 	if (!js_isobject(J, 2)) js_typeerror(J, "not an object");
 
 	props = js_toobject(J, 2);
-	for (ref = props->head; ref; ref = ref->next) {
-		if (!(ref->atts & JS_DONTENUM)) {
-			js_pushvalue(J, ref->value);
-			ToPropertyDescriptor(J, js_toobject(J, 1), ref->name, js_toobject(J, -1));
+	js_pushiterator(J, 2, 1);
+	while ((name = js_nextiterator(J, -1))) {
+		v = ownvalue(J, props, name);
+		if (v) {
+			js_pushvalue(J, *v);
+			ToPropertyDescriptor(J, js_toobject(J, 1), name, js_toobject(J, -1));
 			js_pop(J, 1);
 		}
 	}
+	js_pop(J, 1);
 
 	js_copy(J, 1);
 }
@@ -264,7 +300,8 @@ static void O_create(js_State *J)
 	js_Object *obj;
 	js_Object *proto;
 	js_Object *props;
-	js_Property *ref;
+	js_Value *v;
+	const char *name;
 
 	if (js_isobject(J, 1))
 		proto = js_toobject(J, 1);
@@ -279,12 +316,15 @@ static void O_create(js_State *J)
 	if (js_isdefined(J, 2)) {
 		if (!js_isobject(J, 2)) js_typeerror(J, "not an object");
 		props = js_toobject(J, 2);
-		for (ref = props->head; ref; ref = ref->next) {
-			if (!(ref->atts & JS_DONTENUM)) {
-				if (ref->value.type != JS_TOBJECT) js_typeerror(J, "not an object");
-				ToPropertyDescriptor(J, obj, ref->name, ref->value.u.object);
+		js_pushiterator(J, 2, 1);
+		while ((name = js_nextiterator(J, -1))) {
+			v = ownvalue(J, props, name);
+			if (v) {
+				if (v->type != JS_TOBJECT) js_typeerror(J, "not an object");
+				ToPropertyDescriptor(J, obj, name, v->u.object);
 			}
 		}
+		js_pop(J, 1);
 	}
 }
 
@@ -292,6 +332,7 @@ static void O_keys(js_State *J)
 {
 	js_Object *obj;
 	js_Property *ref;
+	char buf[32];
 	unsigned int k;
 	int i;
 
@@ -302,7 +343,13 @@ static void O_keys(js_State *J)
 	js_newarray(J);
 
 	i = 0;
-	for (ref = obj->head; ref; ref = ref->next) {
+	if (JSV_ISDENSE(obj)) {
+		for (k = 0; k < obj->u.a.filled; ++k) {
+			js_pushstring(J, js_itoa(buf, k));
+			js_setindex(J, -2, i++);
+		}
+	}
+	for (ref = jsV_firstproperty(J, obj); ref; ref = jsV_nextproperty(J, obj, ref)) {
 		if (!(ref->atts & JS_DONTENUM)) {
 			js_pushliteral(J, ref->name);
 			js_setindex(J, -2, i++);
@@ -319,9 +366,18 @@ static void O_keys(js_State *J)
 
 static void O_preventExtensions(js_State *J)
 {
+	js_Object *obj;
+
 	if (!js_isobject(J, 1))
 		js_typeerror(J, "not an object");
-	js_toobject(J, 1)->extensible = 0;
+
+	obj = js_toobject(J, 1);
+	obj->extensible = 0;
+
+	/* dense arrays can always grow */
+	if (JSV_ISDENSE(obj))
+		jsV_todictionary(J, obj);
+
 	js_copy(J, 1);
 }
 
@@ -343,6 +399,7 @@ static void O_seal(js_State *J)
 	obj = js_toobject(J, 1);
 	obj->extensible = 0;
 
+	jsV_todictionary(J, obj);
 	for (ref = obj->head; ref; ref = ref->next)
 		ref->atts |= JS_DONTCONF;
 
@@ -363,7 +420,7 @@ static void O_isSealed(js_State *J)
 		return;
 	}
 
-	for (ref = obj->head; ref; ref = ref->next) {
+	for (ref = jsV_firstproperty(J, obj); ref; ref = jsV_nextproperty(J, obj, ref)) {
 		if (!(ref->atts & JS_DONTCONF)) {
 			js_pushboolean(J, 0);
 			return;
@@ -384,6 +441,7 @@ static void O_freeze(js_State *J)
 	obj = js_toobject(J, 1);
 	obj->extensible = 0;
 
+	jsV_todictionary(J, obj);
 	for (ref = obj->head; ref; ref = ref->next)
 		ref->atts |= JS_READONLY | JS_DONTCONF;
 
@@ -404,7 +462,7 @@ static void O_isFrozen(js_State *J)
 		return;
 	}
 
-	for (ref = obj->head; ref; ref = ref->next) {
+	for (ref = jsV_firstproperty(J, obj); ref; ref = jsV_nextproperty(J, obj, ref)) {
 		if (!(ref->atts & (JS_READONLY | JS_DONTCONF))) {
 			js_pushboolean(J, 0);
 			return;
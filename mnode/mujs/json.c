@@ -155,27 +155,32 @@ static int fmtvalue(js_State *J, js_Buffer **sb, const char *key, const char *ga
 static void fmtobject(js_State *J, js_Buffer **sb, js_Object *obj, const char *gap, int level)
 {
 	js_Property *ref;
+	const char *name;
 	int save;
 	int n = 0;
 
 	js_putc(J, sb, '{');
-	for (ref = obj->head; ref; ref = ref->next) {
-		if (ref->atts & JS_DONTENUM)
+	/* toJSON may reshape obj, so take the names up front */
+	js_pushiterator(J, -1, 1);
+	while ((name = js_nextiterator(J, -1))) {
+		ref = jsV_getownproperty(J, obj, name);
+		if (!ref)
 			continue;
 		save = (*sb)->n;
 		if (n) js_putc(J, sb, ',');
 		if (gap) fmtindent(J, sb, gap, level + 1);
-		fmtstr(J, sb, ref->name);
+		fmtstr(J, sb, name);
 		js_putc(J, sb, ':');
 		if (gap)
 			js_putc(J, sb, ' ');
-		js_pushvalue(J, ref->value);
-		if (!fmtvalue(J, sb, ref->name, gap, level + 1))
+		js_pushvalue(J, *jsV_propvalue(J, obj, ref));
+		if (!fmtvalue(J, sb, name, gap, level + 1))
 			(*sb)->n = save;
 		else
 			++n;
 		js_pop(J, 1);
 	}
+	js_pop(J, 1);
 	if (gap && n) fmtindent(J, sb, gap, level);
 	js_putc(J, sb, '}');
 }
@@ -208,7 +213,7 @@ static int fmtvalue(js_State *J, js_Buffer **sb, const char *key, const char *ga
 		js_throw(J);
 	}
 	if (js_isobject(J, -1)) {
-		if (js_hasproperty(J, -1, "toJSON")) {
+		if (js_haspropertyatom(J, -1, JS_ATOM(J, toJSON))) {
 			if (js_iscallable(J, -1)) {
 				js_copy(J, -2);
 				js_pushliteral(J, key);
@@ -132,6 +132,7 @@ struct js_Ast
 	const char *string;
 	js_JumpList *jumps; /* list of break/continue jumps to patch */
 	int casejump; /* for switch case clauses */
+	int catchslot; /* local slot of a try statement's catch variable, or 0 for a scope */
 	js_Ast *gcnext; /* next in alloc list */
 };
 
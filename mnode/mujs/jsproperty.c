@@ -16,8 +16,33 @@
 
 	skew() fixes left horizontal links.
 	split() fixes consecutive right horizontal links.
+
+	Objects start out without a tree of their own. Objects that got
+	their properties added in the same order with the same attributes
+	share a shape, which is a node in a tree of transitions from the
+	empty shape. Each shape adds one property, and its descriptor holds
+	the name and attributes; the values are kept in a slot array in the
+	object itself, in insertion order.
+
+	Deleting a property, changing its attributes, defining a getter or
+	setter, or growing past JS_SHAPELIMIT properties turns the object
+	into a dictionary: its properties are moved into an AA-tree of its
+	own and it stops using shapes for good. Arrays, strings and regular
+	expressions, whose special properties bypass the tree, are always
+	dictionaries; the inline caches in jsrun.c rely on this.
+
+	Arrays start out dense, with their elements in a vector outside of
+	the tree. Making a hole, deleting an element, giving one attributes
+	or accessors, or making the array non-extensible moves the elements
+	into the tree as ordinary properties, and it stays sparse for good.
+
+	Property names are interned, and so are the names passed to the
+	lookup functions below, so names are compared by pointer. The tree
+	is ordered by the address of the name.
 */
 
+#define NAMECMP(a, b) ((uintptr_t)(a) < (uintptr_t)(b) ? -1 : (a) != (b))
+
 static js_Property sentinel = {
 	"",
 	&sentinel, &sentinel,
@@ -30,7 +55,7 @@ static js_Property sentinel = {
 static js_Property *newproperty(js_State *J, js_Object *obj, const char *name)
 {
 	js_Property *node = js_malloc(J, sizeof *node);
-	node->name = js_intern(J, name);
+	node->name = name;
 	node->left = node->right = &sentinel;
 	node->prevp = NULL;
 	node->next = NULL;
@@ -44,20 +69,85 @@ static js_Property *newproperty(js_State *J, js_Object *obj, const char *name)
 	return node;
 }
 
-static js_Property *lookup(js_Property *node, const char *name)
+static inline js_Property *lookup(js_Property *node, const char *name)
 {
 	while (node != &sentinel) {
-		int c = strcmp(name, node->name);
-		if (c == 0)
+		if (name == node->name)
 			return node;
-		else if (c < 0)
-			node = node->left;
-		else
-			node = node->right;
+		node = NAMECMP(name, node->name) < 0 ? node->left : node->right;
+	}
+	return NULL;
+}
+
+/* Shapes */
+
+js_Shape *jsV_newshape(js_State *J, js_Shape *parent, const char *name, int atts)
+{
+	js_Shape *shape = js_malloc(J, sizeof *shape);
+	memset(shape, 0, sizeof *shape);
+	shape->gcmark = 0;
+	shape->gcnext = J->gcshape;
+	J->gcshape = shape;
+	++J->gccounter;
+
+	shape->prop.name = name;
+	shape->prop.atts = atts;
+	shape->prop.value.type = JS_TUNDEFINED;
+	shape->parent = parent;
+	if (parent) {
+		shape->count = parent->count + 1;
+		shape->sibling = parent->kids;
+		parent->kids = shape;
+	}
+	return shape;
+}
+
+static inline js_Shape *lookupshape(js_Shape *shape, const char *name)
+{
+	while (shape->parent) {
+		if (shape->prop.name == name)
+			return shape;
+		shape = shape->parent;
 	}
 	return NULL;
 }
 
+/* the shape that added the property in slot i */
+static js_Shape *shapeat(js_Shape *shape, unsigned int i)
+{
+	while (shape->count > i + 1)
+		shape = shape->parent;
+	return shape;
+}
+
+static js_Shape *transition(js_State *J, js_Shape *shape, const char *name, int atts)
+{
+	js_Shape *kid;
+	for (kid = shape->kids; kid; kid = kid->sibling)
+		if (kid->prop.name == name && kid->prop.atts == atts)
+			return kid;
+	return jsV_newshape(J, shape, name, atts);
+}
+
+/* move obj to a child of its current shape */
+void jsV_extendshape(js_State *J, js_Object *obj, js_Shape *shape)
+{
+	unsigned int n = obj->shape->count;
+	if (n == 0 || (n >= 4 && (n & (n - 1)) == 0))
+		obj->slots = js_realloc(J, obj->slots, (n ? n * 2 : 4) * sizeof *obj->slots);
+	obj->shape = shape;
+	obj->slots[n].type = JS_TUNDEFINED;
+	++obj->count;
+}
+
+static js_Property *addslot(js_State *J, js_Object *obj, const char *name, int atts)
+{
+	jsV_extendshape(J, obj, transition(J, obj->shape, name, atts));
+	return &obj->shape->prop;
+}
+
+/* AA-tree */
+
 static js_Property *skew(js_Property *node)
 {
 	if (node->left->level == node->level) {
@@ -84,7 +174,7 @@ static js_Property *split(js_Property *node)
 static js_Property *insert(js_State *J, js_Object *obj, js_Property *node, const char *name, js_Property **result)
 {
 	if (node != &sentinel) {
-		int c = strcmp(name, node->name);
+		int c = NAMECMP(name, node->name);
 		if (c < 0)
 			node->left = insert(J, obj, node->left, name, result);
 		else if (c > 0)
@@ -114,7 +204,7 @@ static js_Property *delete(js_State *J, js_Object *obj, js_Property *node, const
 	js_Property *temp, *succ;
 
 	if (node != &sentinel) {
-		int c = strcmp(name, node->name);
+		int c = NAMECMP(name, node->name);
 		if (c < 0) {
 			node->left = delete(J, obj, node->left, name);
 		} else if (c > 0) {
@@ -168,25 +258,109 @@ js_Object *jsV_newobject(js_State *J, enum js_Class type, js_Object *prototype)
 	obj->properties = &sentinel;
 	obj->head = NULL;
 	obj->tailp = &obj->head;
+	/* classes with special property names are kept out of shape mode */
+	if (type == JS_CARRAY || type == JS_CSTRING || type == JS_CREGEXP)
+		obj->shape = NULL;
+	else
+		obj->shape = J->emptyshape;
+	obj->slots = NULL;
+	if (type == JS_CARRAY)
+		obj->u.a.simple = 1;
 	obj->prototype = prototype;
 	obj->extensible = 1;
 	return obj;
 }
 
-js_Property *jsV_getownproperty(js_State *J, js_Object *obj, const char *name)
+static inline js_Property *lookupown(js_Object *obj, const char *name)
 {
+	if (obj->shape) {
+		js_Shape *shape = lookupshape(obj->shape, name);
+		return shape ? &shape->prop : NULL;
+	}
 	return lookup(obj->properties, name);
 }
 
-js_Property *jsV_getpropertyx(js_State *J, js_Object *obj, const char *name, int *own)
+static js_Property *insertnode(js_State *J, js_Object *obj, const char *name, int atts)
+{
+	js_Property *result;
+	obj->properties = insert(J, obj, obj->properties, name, &result);
+	if (!result->prevp) {
+		result->atts = atts;
+		result->prevp = obj->tailp;
+		*obj->tailp = result;
+		obj->tailp = &result->next;
+	}
+	return result;
+}
+
+static void tosparse(js_State *J, js_Object *obj)
+{
+	js_Property *ref;
+	char buf[32];
+	unsigned int k;
+
+	for (k = 0; k < obj->u.a.filled; ++k) {
+		ref = insertnode(J, obj, js_intern(J, js_itoa(buf, k)), 0);
+		ref->value = obj->u.a.array[k];
+	}
+	obj->u.a.simple = 0;
+	js_free(J, obj->u.a.array);
+	obj->u.a.array = NULL;
+	obj->u.a.filled = 0;
+	obj->u.a.capacity = 0;
+}
+
+void jsV_todictionary(js_State *J, js_Object *obj)
+{
+	js_Shape *shape = obj->shape;
+	js_Property *ref;
+	unsigned int i;
+
+	if (JSV_ISDENSE(obj))
+		tosparse(J, obj);
+	if (!shape)
+		return;
+	obj->shape = NULL;
+	obj->count = 0;
+	for (i = 0; i < shape->count; ++i) {
+		js_Property *prop = &shapeat(shape, i)->prop;
+		ref = insertnode(J, obj, prop->name, prop->atts);
+		ref->value = obj->slots[i];
+	}
+	js_free(J, obj->slots);
+	obj->slots = NULL;
+}
+
+js_Property *jsV_firstproperty(js_State *J, js_Object *obj)
+{
+	if (obj->shape)
+		return obj->shape->count ? &shapeat(obj->shape, 0)->prop : NULL;
+	return obj->head;
+}
+
+js_Property *jsV_nextproperty(js_State *J, js_Object *obj, js_Property *ref)
+{
+	if (obj->shape) {
+		unsigned int i = ((js_Shape*)ref)->count;
+		return i < obj->shape->count ? &shapeat(obj->shape, i)->prop : NULL;
+	}
+	return ref->next;
+}
+
+js_Property *jsV_getownproperty(js_State *J, js_Object *obj, const char *name)
+{
+	return lookupown(obj, name);
+}
+
+js_Property *jsV_getpropertyx(js_State *J, js_Object *obj, const char *name, js_Object **holder)
 {
-	*own = 1;
 	do {
-		js_Property *ref = lookup(obj->properties, name);
-		if (ref)
+		js_Property *ref = lookupown(obj, name);
+		if (ref) {
+			*holder = obj;
 			return ref;
+		}
 		obj = obj->prototype;
-		*own = 0;
 	} while (obj);
 	return NULL;
 }
@@ -194,7 +368,7 @@ js_Property *jsV_getpropertyx(js_State *J, js_Object *obj, const char *name, int
 js_Property *jsV_getproperty(js_State *J, js_Object *obj, const char *name)
 {
 	do {
-		js_Property *ref = lookup(obj->properties, name);
+		js_Property *ref = lookupown(obj, name);
 		if (ref)
 			return ref;
 		obj = obj->prototype;
@@ -202,10 +376,22 @@ js_Property *jsV_getproperty(js_State *J, js_Object *obj, const char *name)
 	return NULL;
 }
 
-js_Property *jsV_setproperty(js_State *J, js_Object *obj, const char *name)
+/* Find or create an own property; atts only apply to a new property */
+js_Property *jsV_setproperty(js_State *J, js_Object *obj, const char *name, int atts)
 {
 	js_Property *result;
 
+	if (obj->shape) {
+		js_Shape *shape = lookupshape(obj->shape, name);
+		if (shape)
+			return &shape->prop;
+		if (obj->extensible) {
+			if (obj->shape->count < JS_SHAPELIMIT)
+				return addslot(J, obj, name, atts);
+			jsV_todictionary(J, obj);
+		}
+	}
+
 	if (!obj->extensible) {
 		result = lookup(obj->properties, name);
 		if (J->strict && !result)
@@ -213,17 +399,16 @@ js_Property *jsV_setproperty(js_State *J, js_Object *obj, const char *name)
 		return result;
 	}
 
-	obj->properties = insert(J, obj, obj->properties, name, &result);
-	if (!result->prevp) {
-		result->prevp = obj->tailp;
-		*obj->tailp = result;
-		obj->tailp = &result->next;
-	}
-	return result;
+	return insertnode(J, obj, name, atts);
 }
 
 void jsV_delproperty(js_State *J, js_Object *obj, const char *name)
 {
+	if (obj->shape) {
+		if (!lookupshape(obj->shape, name))
+			return;
+		jsV_todictionary(J, obj);
+	}
 	obj->properties = delete(J, obj, obj->properties, name);
 }
 
@@ -233,12 +418,14 @@ static int itshadow(js_State *J, js_Object *top, js_Object *bot, const char *nam
 {
 	unsigned int k;
 	while (top != bot) {
-		js_Property *prop = lookup(top->properties, name);
+		js_Property *prop = lookupown(top, name);
 		if (prop && !(prop->atts & JS_DONTENUM))
 			return 1;
 		if (top->type == JS_CSTRING)
 			if (js_isarrayindex(J, name, &k) && k < top->u.s.length)
 				return 1;
+		if (jsV_getdenseindex(J, top, name))
+			return 1;
 		top = top->prototype;
 	}
 	return 0;
@@ -263,19 +450,29 @@ static void itwalk(js_State *J, js_Object *io, js_Object *top, int own)
 	}
 
 	while (obj) {
-		js_Property *prop = obj->head;
+		js_Property *prop = jsV_firstproperty(J, obj);
+
+		if (JSV_ISDENSE(obj)) {
+			for (k = 0; k < obj->u.a.filled; ++k) {
+				const char *name = js_intern(J, js_itoa(buf, k));
+				if (!itshadow(J, top, obj, name)) {
+					ITADD(name);
+				}
+			}
+		}
+
 		while (prop) {
 			if (!(prop->atts & JS_DONTENUM) && !itshadow(J, top, obj, prop->name)) {
 				ITADD(prop->name);
 			}
-			prop = prop->next;
+			prop = jsV_nextproperty(J, obj, prop);
 		}
 
 		if (obj->type == JS_CSTRING) {
 			for (k = 0; k < obj->u.s.length; ++k) {
-				js_itoa(buf, k);
-				if (!itshadow(J, top, obj, buf)) {
-					ITADD(js_intern(J, buf));
+				const char *name = js_intern(J, js_itoa(buf, k));
+				if (!itshadow(J, top, obj, name)) {
+					ITADD(name);
 				}
 			}
 		}
@@ -307,6 +504,8 @@ const char *jsV_nextiterator(js_State *J, js_Object *io)
 		io->u.iter.head = next;
 		if (jsV_getproperty(J, io->u.iter.target, name))
 			return name;
+		if (jsV_getdenseindex(J, io->u.iter.target, name))
+			return name;
 		if (io->u.iter.target->type == JS_CSTRING)
 			if (js_isarrayindex(J, name, &k) && k < io->u.iter.target->u.s.length)
 				return name;
@@ -314,6 +513,56 @@ const char *jsV_nextiterator(js_State *J, js_Object *io)
 	return NULL;
 }
 
+/* The element of a dense array with the given name, or NULL */
+
+js_Value *jsV_getdenseindex(js_State *J, js_Object *obj, const char *name)
+{
+	unsigned int k;
+	if (JSV_ISDENSE(obj) && js_isarrayindex(J, name, &k) && k < obj->u.a.filled)
+		return &obj->u.a.array[k];
+	return NULL;
+}
+
+/* Store an element of a dense array; fails if it would make a hole */
+
+static int hassetter(js_State *J, js_Object *obj, unsigned int k)
+{
+	js_Object *p;
+	js_Property *ref;
+	char buf[32];
+
+	/* accessors only live in dictionaries and sparse arrays */
+	for (p = obj; p; p = p->prototype)
+		if (!p->shape && !JSV_ISDENSE(p))
+			break;
+	if (!p)
+		return 0;
+	ref = jsV_getproperty(J, obj, js_intern(J, js_itoa(buf, k)));
+	return ref && ref->setter;
+}
+
+int jsV_setdenseindex(js_State *J, js_Object *obj, unsigned int k, const js_Value *value)
+{
+	unsigned int n = obj->u.a.filled;
+	if (k < n) {
+		obj->u.a.array[k] = *value;
+		return 1;
+	}
+	if (k > n || hassetter(J, obj->prototype, k))
+		return 0;
+	if (n == obj->u.a.capacity) {
+		if (n > UINT_MAX / 2 / sizeof *obj->u.a.array)
+			return 0;
+		obj->u.a.capacity = n ? n * 2 : 8;
+		obj->u.a.array = js_realloc(J, obj->u.a.array, obj->u.a.capacity * sizeof *obj->u.a.array);
+	}
+	obj->u.a.array[n] = *value;
+	obj->u.a.filled = n + 1;
+	if (obj->u.a.length < n + 1)
+		obj->u.a.length = n + 1;
+	return 1;
+}
+
 /* Walk all the properties and delete them one by one for arrays */
 
 void jsV_resizearray(js_State *J, js_Object *obj, unsigned int newlen)
@@ -321,6 +570,13 @@ void jsV_resizearray(js_State *J, js_Object *obj, unsigned int newlen)
 	char buf[32];
 	const char *s;
 	unsigned int k;
+	if (obj->u.a.simple) {
+		/* growing only adds trailing holes */
+		if (newlen < obj->u.a.filled)
+			obj->u.a.filled = newlen;
+		obj->u.a.length = newlen;
+		return;
+	}
 	if (newlen < obj->u.a.length) {
 		if (obj->u.a.length > obj->count * 2) {
 			js_Object *it = jsV_newiterator(J, obj, 1);
@@ -331,7 +587,7 @@ void jsV_resizearray(js_State *J, js_Object *obj, unsigned int newlen)
 			}
 		} else {
 			for (k = newlen; k < obj->u.a.length; ++k) {
-				jsV_delproperty(J, obj, js_itoa(buf, k));
+				jsV_delproperty(J, obj, js_intern(J, js_itoa(buf, k)));
 			}
 		}
 	}
@@ -1,17 +1,15 @@
 #include "jsi.h"
+#include "jscompile.h"
 #include "jsvalue.h"
 #include "jsbuiltin.h"
 #include "regex.h"
 
-void js_newregexp(js_State *J, const char *pattern, int flags)
+static Reprog *compile(js_State *J, const char *pattern, int flags)
 {
 	const char *error;
-	js_Object *obj;
 	Reprog *prog;
 	int opts;
 
-	obj = jsV_newobject(J, JS_CREGEXP, J->RegExp_prototype);
-
 	opts = 0;
 	if (flags & JS_REGEXP_I) opts |= REG_ICASE;
 	if (flags & JS_REGEXP_M) opts |= REG_NEWLINE;
@@ -19,9 +17,51 @@ void js_newregexp(js_State *J, const char *pattern, int flags)
 	prog = js_regcomp(pattern, opts, &error);
 	if (!prog)
 		js_syntaxerror(J, "regular expression: %s", error);
+	return prog;
+}
+
+void js_newregexp(js_State *J, const char *pattern, int flags)
+{
+	js_Object *obj;
+
+	obj = jsV_newobject(J, JS_CREGEXP, J->RegExp_prototype);
+	obj->u.r.prog = compile(J, pattern, flags);
+	obj->u.r.source = js_intern(J, pattern);
+	obj->u.r.owner = NULL;
+	obj->u.r.flags = flags;
+	obj->u.r.last = 0;
+	js_pushobject(J, obj);
+}
 
-	obj->u.r.prog = prog;
-	obj->u.r.source = pattern;
+/*
+ * A literal is compiled the first time it is evaluated and the program is
+ * kept in the function, so each evaluation only makes a new object sharing
+ * it. The program is freed with the function, which the objects keep alive.
+ */
+void js_newregexpliteral(js_State *J, js_Function *F, int idx, int flags)
+{
+	js_Object *obj;
+	js_Regexp *re;
+
+	if (!F->regtab) {
+		F->regtab = js_malloc(J, F->strlen * sizeof *F->regtab);
+		memset(F->regtab, 0, F->strlen * sizeof *F->regtab);
+	}
+
+	re = &F->regtab[idx];
+	if (!re->prog) {
+		re->prog = compile(J, F->strtab[idx], flags);
+		re->source = F->strtab[idx];
+		re->owner = F;
+		re->flags = flags;
+	} else if ((re->flags ^ flags) & (JS_REGEXP_I | JS_REGEXP_M)) {
+		/* the same source with other flags */
+		js_newregexp(J, F->strtab[idx], flags);
+		return;
+	}
+
+	obj = jsV_newobject(J, JS_CREGEXP, J->RegExp_prototype);
+	obj->u.r = *re;
 	obj->u.r.flags = flags;
 	obj->u.r.last = 0;
 	js_pushobject(J, obj);
@@ -49,9 +89,9 @@ void js_RegExp_prototype_exec(js_State *J, js_Regexp *re, const char *text)
 	if (!js_regexec(re->prog, text, &m, opts)) {
 		js_newarray(J);
 		js_pushstring(J, text);
-		js_setproperty(J, -2, "input");
+		js_setpropertyatom(J, -2, JS_ATOM(J, input));
 		js_pushnumber(J, js_utfptrtoidx(text, m.sub[0].sp));
-		js_setproperty(J, -2, "index");
+		js_setpropertyatom(J, -2, JS_ATOM(J, index));
 		for (i = 0; i < m.nsub; ++i) {
 			js_pushlstring(J, m.sub[i].sp, m.sub[i].ep - m.sub[i].sp);
 			js_setindex(J, -2, i);
@@ -90,7 +130,8 @@ static void Rp_test(js_State *J)
 		}
 	}
 
-	if (!js_regexec(re->prog, text, &m, opts)) {
+	/* without the global flag only the answer matters, which the DFA gives */
+	if (!js_regexec(re->prog, text, (re->flags & JS_REGEXP_G) ? &m : NULL, opts)) {
 		if (re->flags & JS_REGEXP_G)
 			re->last = re->last + (m.sub[0].ep - text);
 		js_pushboolean(J, 1);
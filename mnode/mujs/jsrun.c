@@ -21,6 +21,14 @@ static void js_stackoverflow(js_State *J)
 	js_throw(J);
 }
 
+static void js_tryoverflow(js_State *J)
+{
+	STACK[TOP].type = JS_TLITSTR;
+	STACK[TOP].u.litstr = "exception stack overflow";
+	++TOP;
+	js_throw(J);
+}
+
 static void js_outofmemory(js_State *J)
 {
 	STACK[TOP].type = JS_TLITSTR;
@@ -52,9 +60,96 @@ void js_free(js_State *J, void *ptr)
 
 js_String *jsV_newmemstring(js_State *J, const char *s, int n)
 {
-	js_String *v = js_malloc(J, offsetof(js_String, p) + n + 1);
-	memcpy(v->p, s, n);
+	js_String *v = js_malloc(J, offsetof(js_String, u.text) + n + 1);
+	memcpy(v->u.text, s, n);
+	v->u.text[n] = 0;
+	v->p = v->u.text;
+	v->length = n;
+	jsV_measurestring(v);
+	v->gcmark = 0;
+	v->gcnext = J->gcstr;
+	J->gcstr = v;
+	++J->gccounter;
+	return v;
+}
+
+/*
+ * Scratch text for builtins. The buffer hangs off a heap string on the
+ * collector's list, so if an error unwinds past the builtin the next
+ * collection frees it and no js_try is needed to clean up. The string is not
+ * a root until it is pushed: push it before running any script code.
+ */
+js_String *jsV_newscratch(js_State *J, unsigned int size)
+{
+	js_String *v = js_malloc(J, sizeof *v);
+	v->u.text[0] = 0;
+	v->p = v->u.text;
+	v->length = v->runes = 0;
+	v->ascii = 1;
+	v->gcmark = 0;
+	v->gcnext = J->gcstr;
+	J->gcstr = v;
+	++J->gccounter;
+	v->p = js_malloc(J, size + 1);
+	v->p[0] = 0;
+	return v;
+}
+
+void jsV_resizescratch(js_State *J, js_String *v, unsigned int size)
+{
+	v->p = js_realloc(J, v->p, size + 1);
+}
+
+/* Terminate the text after n bytes and measure it. */
+void jsV_endscratch(js_String *v, unsigned int n)
+{
 	v->p[n] = 0;
+	v->length = n;
+	jsV_measurestring(v);
+}
+
+/*
+ * A builder appends to a scratch string that is pushed on the stack at once,
+ * so script code may run while it is being filled. Size it from what is
+ * known up front; it doubles when that runs out. jsV_endbuilder turns the
+ * text into the string value in place, without copying it.
+ */
+void jsV_newbuilder(js_State *J, js_Builder *sb, unsigned int size)
+{
+	sb->str = jsV_newscratch(J, size);
+	sb->n = 0;
+	sb->cap = size;
+	js_pushmemstring(J, sb->str);
+}
+
+void jsV_growbuilder(js_State *J, js_Builder *sb, unsigned int more)
+{
+	unsigned int need = sb->n + more;
+	if (need < sb->n || need == UINT_MAX)
+		js_rangeerror(J, "invalid string length");
+	if (sb->cap < UINT_MAX / 2 - 32)
+		sb->cap = sb->cap * 2 + 64;
+	if (sb->cap < need)
+		sb->cap = need;
+	jsV_resizescratch(J, sb->str, sb->cap);
+}
+
+void jsV_endbuilder(js_State *J, js_Builder *sb)
+{
+	if (sb->cap - sb->n > 64 && sb->cap - sb->n > sb->n / 4)
+		jsV_resizescratch(J, sb->str, sb->n); /* give back what the estimate overshot */
+	jsV_endscratch(sb->str, sb->n);
+}
+
+js_String *jsV_newrope(js_State *J, js_String *left, js_String *right)
+{
+	js_String *v = js_malloc(J, sizeof *v);
+	v->u.rope.left = left;
+	v->u.rope.right = right;
+	v->p = NULL;
+	v->length = left->length + right->length;
+	v->runes = left->runes + right->runes;
+	v->ascii = left->ascii && right->ascii;
 	v->gcmark = 0;
 	v->gcnext = J->gcstr;
 	J->gcstr = v;
@@ -62,7 +157,39 @@ js_String *jsV_newmemstring(js_State *J, const char *s, int n)
 	return v;
 }
 
-#define CHECKSTACK(n) if (TOP + n >= JS_STACKSIZE) js_stackoverflow(J)
+/*
+ * Grow the stack to hold n more values. Values on the stack move, so code
+ * that writes through a js_Value pointer must not hold it across a push.
+ * Short strings live in their stack slot and callers of js_tostring keep
+ * reading them, so the old stacks are only freed by js_freestate. As each
+ * stack is at least twice the one it replaces, that keeps up to one current
+ * stack's worth of dead memory for the life of the state.
+ */
+static void jsR_growstack(js_State *J, int n)
+{
+	js_Value *stack;
+	int size = J->stacksize;
+	while (size <= TOP + n && size < J->stacklimit)
+		size *= 2;
+	if (size > J->stacklimit)
+		size = J->stacklimit;
+	if (size <= TOP + n)
+		js_stackoverflow(J);
+	J->oldstacks = js_realloc(J, J->oldstacks, (J->oldstacklen + 1) * sizeof *J->oldstacks);
+	stack = js_malloc(J, size * sizeof *STACK);
+	memcpy(stack, STACK, TOP * sizeof *STACK);
+	J->oldstacks[J->oldstacklen++] = STACK;
+	STACK = stack;
+	J->stacksize = size;
+}
+
+void jsR_freeoldstacks(js_State *J)
+{
+	while (J->oldstacklen > 0)
+		js_free(J, J->oldstacks[--J->oldstacklen]);
+}
+
+#define CHECKSTACK(n) if (TOP + (int)(n) >= J->stacksize) jsR_growstack(J, n)
 
 void js_pushvalue(js_State *J, js_Value v)
 {
@@ -96,8 +223,21 @@ void js_pushboolean(js_State *J, int v)
 void js_pushnumber(js_State *J, double v)
 {
 	CHECKSTACK(1);
-	STACK[TOP].type = JS_TNUMBER;
-	STACK[TOP].u.number = v;
+	if (v >= INT_MIN && v <= INT_MAX && v == (int)v && (v != 0 || !signbit(v))) {
+		STACK[TOP].type = JS_TINT32;
+		STACK[TOP].u.integer = v;
+	} else {
+		STACK[TOP].type = JS_TNUMBER;
+		STACK[TOP].u.number = v;
+	}
+	++TOP;
+}
+
+static void js_pushint32(js_State *J, int v)
+{
+	CHECKSTACK(1);
+	STACK[TOP].type = JS_TINT32;
+	STACK[TOP].u.integer = v;
 	++TOP;
 }
 
@@ -132,6 +272,14 @@ void js_pushlstring(js_State *J, const char *v, unsigned int n)
 	++TOP;
 }
 
+void js_pushmemstring(js_State *J, js_String *v)
+{
+	CHECKSTACK(1);
+	STACK[TOP].type = JS_TMEMSTR;
+	STACK[TOP].u.memstr = v;
+	++TOP;
+}
+
 void js_pushliteral(js_State *J, const char *v)
 {
 	CHECKSTACK(1);
@@ -188,7 +336,7 @@ int js_isdefined(js_State *J, int idx) { return stackidx(J, idx)->type != JS_TUN
 int js_isundefined(js_State *J, int idx) { return stackidx(J, idx)->type == JS_TUNDEFINED; }
 int js_isnull(js_State *J, int idx) { return stackidx(J, idx)->type == JS_TNULL; }
 int js_isboolean(js_State *J, int idx) { return stackidx(J, idx)->type == JS_TBOOLEAN; }
-int js_isnumber(js_State *J, int idx) { return stackidx(J, idx)->type == JS_TNUMBER; }
+int js_isnumber(js_State *J, int idx) { return JSV_ISNUMBER(stackidx(J, idx)); }
 int js_isstring(js_State *J, int idx) { enum js_Type t = stackidx(J, idx)->type; return t == JS_TSHRSTR || t == JS_TLITSTR || t == JS_TMEMSTR; }
 int js_isprimitive(js_State *J, int idx) { return stackidx(J, idx)->type != JS_TOBJECT; }
 int js_isobject(js_State *J, int idx) { return stackidx(J, idx)->type == JS_TOBJECT; }
@@ -233,6 +381,7 @@ static const char *js_typeof(js_State *J, int idx)
 	case JS_TNULL: return "object";
 	case JS_TBOOLEAN: return "boolean";
 	case JS_TNUMBER: return "number";
+	case JS_TINT32: return "number";
 	case JS_TLITSTR: return "string";
 	case JS_TMEMSTR: return "string";
 	case JS_TOBJECT:
@@ -259,12 +408,18 @@ double js_tointeger(js_State *J, int idx)
 
 int js_toint32(js_State *J, int idx)
 {
-	return jsV_numbertoint32(jsV_tonumber(J, stackidx(J, idx)));
+	js_Value *v = stackidx(J, idx);
+	if (v->type == JS_TINT32)
+		return v->u.integer;
+	return jsV_numbertoint32(jsV_tonumber(J, v));
 }
 
 unsigned int js_touint32(js_State *J, int idx)
 {
-	return jsV_numbertouint32(jsV_tonumber(J, stackidx(J, idx)));
+	js_Value *v = stackidx(J, idx);
+	if (v->type == JS_TINT32)
+		return v->u.integer;
+	return jsV_numbertouint32(jsV_tonumber(J, v));
 }
 
 short js_toint16(js_State *J, int idx)
@@ -346,6 +501,14 @@ void js_remove(js_State *J, int idx)
 	--TOP;
 }
 
+void js_replace(js_State *J, int idx)
+{
+	idx = idx < 0 ? TOP + idx : BOT + idx;
+	if (idx < BOT || idx >= TOP)
+		js_error(J, "stack error!");
+	STACK[idx] = STACK[--TOP];
+}
+
 void js_copy(js_State *J, int idx)
 {
 	CHECKSTACK(1);
@@ -420,12 +583,22 @@ void js_rot(js_State *J, int n)
 
 /* Property access that takes care of attributes and getters/setters */
 
+/* the canonical decimal form of an unsigned 32-bit integer */
 int js_isarrayindex(js_State *J, const char *str, unsigned int *idx)
 {
-	char buf[32];
-	*idx = jsV_numbertouint32(jsV_stringtonumber(J, str));
-	sprintf(buf, "%u", *idx);
-	return !strcmp(buf, str);
+	unsigned int n = 0;
+	int i;
+	if (str[0] == '0') {
+		*idx = 0;
+		return str[1] == 0;
+	}
+	for (i = 0; str[i] >= '0' && str[i] <= '9'; ++i) {
+		if (i == 9 && (n > UINT_MAX / 10 || n * 10 > UINT_MAX - (str[i] - '0')))
+			return 0;
+		n = n * 10 + (str[i] - '0');
+	}
+	*idx = n;
+	return i > 0 && i <= 10 && str[i] == 0;
 }
 
 static void js_pushrune(js_State *J, Rune rune)
@@ -439,62 +612,74 @@ static void js_pushrune(js_State *J, Rune rune)
 	}
 }
 
+static void jsR_pushproperty(js_State *J, js_Object *obj, js_Object *holder, js_Property *ref)
+{
+	if (ref->getter) {
+		js_pushobject(J, ref->getter);
+		js_pushobject(J, obj);
+		js_call(J, 0);
+	} else {
+		js_pushvalue(J, *jsV_propvalue(J, holder, ref));
+	}
+}
 
 static int jsR_hasproperty(js_State *J, js_Object *obj, const char *name)
 {
 	js_Property *ref;
+	js_Object *holder;
 	unsigned int k;
 
 	if (obj->type == JS_CARRAY) {
-		if (!strcmp(name, "length")) {
+		if (name == JS_ATOM(J, length)) {
 			js_pushnumber(J, obj->u.a.length);
 			return 1;
 		}
+		if (obj->u.a.simple) {
+			js_Value *v = jsV_getdenseindex(J, obj, name);
+			if (v) {
+				js_pushvalue(J, *v);
+				return 1;
+			}
+		}
 	}
 
 	if (obj->type == JS_CSTRING) {
-		if (!strcmp(name, "length")) {
+		if (name == JS_ATOM(J, length)) {
 			js_pushnumber(J, obj->u.s.length);
 			return 1;
 		}
 		if (js_isarrayindex(J, name, &k)) {
-			js_pushrune(J, js_runeat(J, obj->u.s.string, k));
+			js_pushrune(J, jsV_runeat(J, jsV_literalinfo(J, obj->u.s.string), k));
 			return 1;
 		}
 	}
 
 	if (obj->type == JS_CREGEXP) {
-		if (!strcmp(name, "source")) {
+		if (name == JS_ATOM(J, source)) {
 			js_pushliteral(J, obj->u.r.source);
 			return 1;
 		}
-		if (!strcmp(name, "global")) {
+		if (name == JS_ATOM(J, global)) {
 			js_pushboolean(J, obj->u.r.flags & JS_REGEXP_G);
 			return 1;
 		}
-		if (!strcmp(name, "ignoreCase")) {
+		if (name == JS_ATOM(J, ignoreCase)) {
 			js_pushboolean(J, obj->u.r.flags & JS_REGEXP_I);
 			return 1;
 		}
-		if (!strcmp(name, "multiline")) {
+		if (name == JS_ATOM(J, multiline)) {
 			js_pushboolean(J, obj->u.r.flags & JS_REGEXP_M);
 			return 1;
 		}
-		if (!strcmp(name, "lastIndex")) {
+		if (name == JS_ATOM(J, lastIndex)) {
 			js_pushnumber(J, obj->u.r.last);
 			return 1;
 		}
 	}
 
-	ref = jsV_getproperty(J, obj, name);
+	ref = jsV_getpropertyx(J, obj, name, &holder);
 	if (ref) {
-		if (ref->getter) {
-			js_pushobject(J, ref->getter);
-			js_pushobject(J, obj);
-			js_call(J, 0);
-		} else {
-			js_pushvalue(J, ref->value);
-		}
+		jsR_pushproperty(J, obj, holder, ref);
 		return 1;
 	}
 
@@ -510,11 +695,11 @@ static void jsR_getproperty(js_State *J, js_Object *obj, const char *name)
 static void jsR_setproperty(js_State *J, js_Object *obj, const char *name, js_Value *value)
 {
 	js_Property *ref;
+	js_Object *holder;
 	unsigned int k;
-	int own;
 
 	if (obj->type == JS_CARRAY) {
-		if (!strcmp(name, "length")) {
+		if (name == JS_ATOM(J, length)) {
 			double rawlen = jsV_tonumber(J, value);
 			unsigned int newlen = jsV_numbertouint32(rawlen);
 			if (newlen != rawlen)
@@ -522,48 +707,55 @@ static void jsR_setproperty(js_State *J, js_Object *obj, const char *name, js_Va
 			jsV_resizearray(J, obj, newlen);
 			return;
 		}
-		if (js_isarrayindex(J, name, &k))
+		if (js_isarrayindex(J, name, &k)) {
+			if (obj->u.a.simple) {
+				if (jsV_setdenseindex(J, obj, k, value))
+					return;
+				jsV_todictionary(J, obj);
+			}
 			if (k >= obj->u.a.length)
 				obj->u.a.length = k + 1;
+		}
 	}
 
 	if (obj->type == JS_CSTRING) {
-		if (!strcmp(name, "length"))
+		if (name == JS_ATOM(J, length))
 			goto readonly;
 		if (js_isarrayindex(J, name, &k))
-			if (js_runeat(J, obj->u.s.string, k))
+			if (k < obj->u.s.length)
 				goto readonly;
 	}
 
 	if (obj->type == JS_CREGEXP) {
-		if (!strcmp(name, "source")) goto readonly;
-		if (!strcmp(name, "global")) goto readonly;
-		if (!strcmp(name, "ignoreCase")) goto readonly;
-		if (!strcmp(name, "multiline")) goto readonly;
-		if (!strcmp(name, "lastIndex")) {
+		if (name == JS_ATOM(J, source)) goto readonly;
+		if (name == JS_ATOM(J, global)) goto readonly;
+		if (name == JS_ATOM(J, ignoreCase)) goto readonly;
+		if (name == JS_ATOM(J, multiline)) goto readonly;
+		if (name == JS_ATOM(J, lastIndex)) {
 			obj->u.r.last = jsV_tointeger(J, value);
 			return;
 		}
 	}
 
 	/* First try to find a setter in prototype chain */
-	ref = jsV_getpropertyx(J, obj, name, &own);
+	ref = jsV_getpropertyx(J, obj, name, &holder);
 	if (ref && ref->setter) {
+		js_Value v = *value; /* the pushes may move the stack */
 		js_pushobject(J, ref->setter);
 		js_pushobject(J, obj);
-		js_pushvalue(J, *value);
+		js_pushvalue(J, v);
 		js_call(J, 1);
 		js_pop(J, 1);
 		return;
 	}
 
 	/* Property not found on this object, so create one */
-	if (!ref || !own)
-		ref = jsV_setproperty(J, obj, name);
+	if (!ref || holder != obj)
+		ref = jsV_setproperty(J, obj, name, 0);
 
 	if (ref) {
 		if (!(ref->atts & JS_READONLY))
-			ref->value = *value;
+			*jsV_propvalue(J, obj, ref) = *value;
 		else
 			goto readonly;
 	}
@@ -575,54 +767,207 @@ readonly:
 		js_typeerror(J, "'%s' is read-only", name);
 }
 
+/*
+ * Inline caches for named property access. Only objects in shape mode
+ * are cached: they have no special-cased properties, and accessors only
+ * live in dictionaries. A prototype chain of shaped objects thus has no
+ * setters that could intercept adding a property.
+ */
+
+static int jsR_shapedchain(js_Object *obj)
+{
+	for (; obj; obj = obj->prototype)
+		if (!obj->shape)
+			return 0;
+	return 1;
+}
+
+static void jsR_getpropertycached(js_State *J, js_Object *obj, const char *name, js_PropCache *c)
+{
+	js_Property *ref;
+	js_Object *holder;
+
+	if (c->shape && obj->shape == c->shape) {
+		if (!c->holder) {
+			++J->ichits;
+			js_pushvalue(J, obj->slots[c->slot]);
+			return;
+		}
+		if (obj->prototype == c->holder && c->holder->shape == c->holdershape) {
+			++J->ichits;
+			js_pushvalue(J, c->holder->slots[c->slot]);
+			return;
+		}
+	}
+
+	++J->icmisses;
+	if (!obj->shape) {
+		jsR_getproperty(J, obj, name);
+		return;
+	}
+
+	ref = jsV_getpropertyx(J, obj, name, &holder);
+	if (!ref) {
+		js_pushundefined(J);
+		return;
+	}
+	if (holder == obj || (holder == obj->prototype && holder->shape)) {
+		c->shape = obj->shape;
+		c->next = NULL;
+		c->holder = holder == obj ? NULL : holder;
+		c->holdershape = holder->shape;
+		c->slot = ((js_Shape*)ref)->count - 1;
+	}
+	jsR_pushproperty(J, obj, holder, ref);
+}
+
+/*
+ * Property reads on a primitive string. The length and the characters come
+ * from the string itself and the methods from String.prototype, so no wrapper
+ * object is made. An accessor needs the wrapper as 'this', so return 0 then.
+ */
+static int jsR_getstringproperty(js_State *J, js_Value *v, const char *name)
+{
+	js_Property *ref;
+	js_Object *holder;
+	unsigned int k;
+
+	if (name == JS_ATOM(J, length)) {
+		js_pushnumber(J, jsV_strinfo(J, v)->runes);
+		return 1;
+	}
+	if (js_isarrayindex(J, name, &k)) {
+		js_pushrune(J, jsV_runeat(J, jsV_strinfo(J, v), k));
+		return 1;
+	}
+	ref = jsV_getpropertyx(J, J->String_prototype, name, &holder);
+	if (!ref) {
+		js_pushundefined(J);
+		return 1;
+	}
+	if (ref->getter)
+		return 0;
+	js_pushvalue(J, *jsV_propvalue(J, holder, ref));
+	return 1;
+}
+
+static void jsR_setpropertycached(js_State *J, js_Object *obj, const char *name, js_Value *value, js_PropCache *c)
+{
+	js_Shape *shape = obj->shape;
+	js_Property *ref;
+
+	if (c->shape && shape == c->shape) {
+		if (!c->next) {
+			++J->ichits;
+			obj->slots[c->slot] = *value;
+			return;
+		}
+		if (obj->extensible && jsR_shapedchain(obj->prototype)) {
+			++J->ichits;
+			jsV_extendshape(J, obj, c->next);
+			obj->slots[c->slot] = *value;
+			return;
+		}
+	}
+
+	++J->icmisses;
+	jsR_setproperty(J, obj, name, value);
+	if (!shape)
+		return;
+
+	if (obj->shape == shape) {
+		ref = jsV_getownproperty(J, obj, name);
+		if (ref && !(ref->atts & JS_READONLY)) {
+			c->shape = shape;
+			c->next = NULL;
+			c->slot = ((js_Shape*)ref)->count - 1;
+		}
+	} else if (obj->shape && obj->shape->parent == shape && obj->shape->prop.name == name) {
+		if (jsR_shapedchain(obj->prototype)) {
+			c->shape = shape;
+			c->next = obj->shape;
+			c->slot = shape->count;
+		}
+	}
+}
+
 static void jsR_defproperty(js_State *J, js_Object *obj, const char *name,
 	int atts, js_Value *value, js_Object *getter, js_Object *setter)
 {
 	js_Property *ref;
 	unsigned int k;
 
-	if (obj->type == JS_CARRAY)
-		if (!strcmp(name, "length"))
+	if (obj->type == JS_CARRAY) {
+		if (name == JS_ATOM(J, length))
 			goto readonly;
+		if (obj->u.a.simple && js_isarrayindex(J, name, &k)) {
+			if (k < obj->u.a.filled && value && !getter && !setter && !atts) {
+				obj->u.a.array[k] = *value;
+				return;
+			}
+			jsV_todictionary(J, obj);
+		}
+	}
 
 	if (obj->type == JS_CSTRING) {
-		if (!strcmp(name, "length"))
+		if (name == JS_ATOM(J, length))
 			goto readonly;
 		if (js_isarrayindex(J, name, &k))
-			if (js_runeat(J, obj->u.s.string, k))
+			if (k < obj->u.s.length)
 				goto readonly;
 	}
 
 	if (obj->type == JS_CREGEXP) {
-		if (!strcmp(name, "source")) goto readonly;
-		if (!strcmp(name, "global")) goto readonly;
-		if (!strcmp(name, "ignoreCase")) goto readonly;
-		if (!strcmp(name, "multiline")) goto readonly;
-		if (!strcmp(name, "lastIndex")) goto readonly;
+		if (name == JS_ATOM(J, source)) goto readonly;
+		if (name == JS_ATOM(J, global)) goto readonly;
+		if (name == JS_ATOM(J, ignoreCase)) goto readonly;
+		if (name == JS_ATOM(J, multiline)) goto readonly;
+		if (name == JS_ATOM(J, lastIndex)) goto readonly;
 	}
 
-	ref = jsV_setproperty(J, obj, name);
-	if (ref) {
-		if (value) {
-			if (!(ref->atts & JS_READONLY))
-				ref->value = *value;
-			else if (J->strict)
-				js_typeerror(J, "'%s' is read-only", name);
-		}
-		if (getter) {
-			if (!(ref->atts & JS_DONTCONF))
+	ref = jsV_getownproperty(J, obj, name);
+	if (!ref) {
+		/* accessors are only kept in dictionary mode */
+		if (getter || setter)
+			jsV_todictionary(J, obj);
+		ref = jsV_setproperty(J, obj, name, atts);
+		if (ref) {
+			if (value)
+				*jsV_propvalue(J, obj, ref) = *value;
+			if (getter)
 				ref->getter = getter;
-			else if (J->strict)
-				js_typeerror(J, "'%s' is non-configurable", name);
-		}
-		if (setter) {
-			if (!(ref->atts & JS_DONTCONF))
+			if (setter)
 				ref->setter = setter;
-			else if (J->strict)
-				js_typeerror(J, "'%s' is non-configurable", name);
 		}
-		ref->atts |= atts;
+		return;
+	}
+
+	/* shapes are shared, so changing a descriptor needs a dictionary */
+	if (obj->shape && (getter || setter || (ref->atts | atts) != ref->atts)) {
+		jsV_todictionary(J, obj);
+		ref = jsV_getownproperty(J, obj, name);
+	}
+
+	if (value) {
+		if (!(ref->atts & JS_READONLY))
+			*jsV_propvalue(J, obj, ref) = *value;
+		else if (J->strict)
+			js_typeerror(J, "'%s' is read-only", name);
 	}
+	if (getter) {
+		if (!(ref->atts & JS_DONTCONF))
+			ref->getter = getter;
+		else if (J->strict)
+			js_typeerror(J, "'%s' is non-configurable", name);
+	}
+	if (setter) {
+		if (!(ref->atts & JS_DONTCONF))
+			ref->setter = setter;
+		else if (J->strict)
+			js_typeerror(J, "'%s' is non-configurable", name);
+	}
+	if (atts)
+		ref->atts |= atts;
 
 	return;
 
@@ -636,24 +981,27 @@ static int jsR_delproperty(js_State *J, js_Object *obj, const char *name)
 	js_Property *ref;
 	unsigned int k;
 
-	if (obj->type == JS_CARRAY)
-		if (!strcmp(name, "length"))
+	if (obj->type == JS_CARRAY) {
+		if (name == JS_ATOM(J, length))
 			goto dontconf;
+		if (jsV_getdenseindex(J, obj, name))
+			jsV_todictionary(J, obj);
+	}
 
 	if (obj->type == JS_CSTRING) {
-		if (!strcmp(name, "length"))
+		if (name == JS_ATOM(J, length))
 			goto dontconf;
 		if (js_isarrayindex(J, name, &k))
-			if (js_runeat(J, obj->u.s.string, k))
+			if (k < obj->u.s.length)
 				goto dontconf;
 	}
 
 	if (obj->type == JS_CREGEXP) {
-		if (!strcmp(name, "source")) goto dontconf;
-		if (!strcmp(name, "global")) goto dontconf;
-		if (!strcmp(name, "ignoreCase")) goto dontconf;
-		if (!strcmp(name, "multiline")) goto dontconf;
-		if (!strcmp(name, "lastIndex")) goto dontconf;
+		if (name == JS_ATOM(J, source)) goto dontconf;
+		if (name == JS_ATOM(J, global)) goto dontconf;
+		if (name == JS_ATOM(J, ignoreCase)) goto dontconf;
+		if (name == JS_ATOM(J, multiline)) goto dontconf;
+		if (name == JS_ATOM(J, lastIndex)) goto dontconf;
 	}
 
 	ref = jsV_getownproperty(J, obj, name);
@@ -703,68 +1051,90 @@ void js_unref(js_State *J, const char *ref)
 
 void js_getregistry(js_State *J, const char *name)
 {
-	jsR_getproperty(J, J->R, name);
+	jsR_getproperty(J, J->R, js_intern(J, name));
 }
 
 void js_setregistry(js_State *J, const char *name)
 {
-	jsR_setproperty(J, J->R, name, stackidx(J, -1));
+	jsR_setproperty(J, J->R, js_intern(J, name), stackidx(J, -1));
 	js_pop(J, 1);
 }
 
 void js_delregistry(js_State *J, const char *name)
 {
-	jsR_delproperty(J, J->R, name);
+	jsR_delproperty(J, J->R, js_intern(J, name));
 }
 
 void js_getglobal(js_State *J, const char *name)
 {
-	jsR_getproperty(J, J->G, name);
+	jsR_getproperty(J, J->G, js_intern(J, name));
 }
 
 void js_setglobal(js_State *J, const char *name)
 {
-	jsR_setproperty(J, J->G, name, stackidx(J, -1));
+	jsR_setproperty(J, J->G, js_intern(J, name), stackidx(J, -1));
 	js_pop(J, 1);
 }
 
 void js_defglobal(js_State *J, const char *name, int atts)
 {
-	jsR_defproperty(J, J->G, name, atts, stackidx(J, -1), NULL, NULL);
+	jsR_defproperty(J, J->G, js_intern(J, name), atts, stackidx(J, -1), NULL, NULL);
 	js_pop(J, 1);
 }
 
 void js_getproperty(js_State *J, int idx, const char *name)
 {
-	jsR_getproperty(J, js_toobject(J, idx), name);
+	jsR_getproperty(J, js_toobject(J, idx), js_intern(J, name));
 }
 
 void js_setproperty(js_State *J, int idx, const char *name)
 {
-	jsR_setproperty(J, js_toobject(J, idx), name, stackidx(J, -1));
+	jsR_setproperty(J, js_toobject(J, idx), js_intern(J, name), stackidx(J, -1));
 	js_pop(J, 1);
 }
 
 void js_defproperty(js_State *J, int idx, const char *name, int atts)
 {
-	jsR_defproperty(J, js_toobject(J, idx), name, atts, stackidx(J, -1), NULL, NULL);
+	jsR_defproperty(J, js_toobject(J, idx), js_intern(J, name), atts, stackidx(J, -1), NULL, NULL);
 	js_pop(J, 1);
 }
 
 void js_delproperty(js_State *J, int idx, const char *name)
 {
-	jsR_delproperty(J, js_toobject(J, idx), name);
+	jsR_delproperty(J, js_toobject(J, idx), js_intern(J, name));
 }
 
 void js_defaccessor(js_State *J, int idx, const char *name, int atts)
 {
-	jsR_defproperty(J, js_toobject(J, idx), name, atts, NULL, jsR_tofunction(J, -2), jsR_tofunction(J, -1));
+	jsR_defproperty(J, js_toobject(J, idx), js_intern(J, name), atts, NULL, jsR_tofunction(J, -2), jsR_tofunction(J, -1));
 	js_pop(J, 2);
 }
 
 int js_hasproperty(js_State *J, int idx, const char *name)
 {
-	return jsR_hasproperty(J, js_toobject(J, idx), name);
+	return jsR_hasproperty(J, js_toobject(J, idx), js_intern(J, name));
+}
+
+int js_haspropertyatom(js_State *J, int idx, const char *atom)
+{
+	return jsR_hasproperty(J, js_toobject(J, idx), atom);
+}
+
+void js_getpropertyatom(js_State *J, int idx, const char *atom)
+{
+	jsR_getproperty(J, js_toobject(J, idx), atom);
+}
+
+void js_setpropertyatom(js_State *J, int idx, const char *atom)
+{
+	jsR_setproperty(J, js_toobject(J, idx), atom, stackidx(J, -1));
+	js_pop(J, 1);
+}
+
+void js_defpropertyatom(js_State *J, int idx, const char *atom, int atts)
+{
+	jsR_defproperty(J, js_toobject(J, idx), atom, atts, stackidx(J, -1), NULL, NULL);
+	js_pop(J, 1);
 }
 
 /* Iterator */
@@ -783,7 +1153,7 @@ const char *js_nextiterator(js_State *J, int idx)
 
 js_Environment *jsR_newenvironment(js_State *J, js_Object *vars, js_Environment *outer)
 {
-	js_Environment *E = js_malloc(J, sizeof *E);
+	js_Environment *E = js_malloc(J, offsetof(js_Environment, slots));
 	E->gcmark = 0;
 	E->gcnext = J->gcenv;
 	J->gcenv = E;
@@ -791,33 +1161,93 @@ js_Environment *jsR_newenvironment(js_State *J, js_Object *vars, js_Environment
 
 	E->outer = outer;
 	E->variables = vars;
+	E->function = NULL;
+	return E;
+}
+
+static js_Environment *jsR_newrecord(js_State *J, js_Function *F, js_Environment *outer)
+{
+	js_Environment *E = js_malloc(J, offsetof(js_Environment, slots) + F->envlen * sizeof(js_Value));
+	unsigned int i;
+	E->gcmark = 0;
+	E->gcnext = J->gcenv;
+	J->gcenv = E;
+	++J->gccounter;
+
+	E->outer = outer;
+	E->variables = NULL;
+	E->function = F;
+	for (i = 0; i < F->envlen; ++i)
+		E->slots[i].type = JS_TUNDEFINED;
+	return E;
+}
+
+/* Find the record 'depth' records up the scope chain, skipping catch scopes */
+static js_Environment *jsR_record(js_Environment *E, int depth)
+{
+	while (E->variables)
+		E = E->outer;
+	while (depth-- > 0) {
+		E = E->outer;
+		while (E->variables)
+			E = E->outer;
+	}
 	return E;
 }
 
+static js_Value *jsR_recordslot(js_Environment *E, const char *name)
+{
+	js_Function *F = E->function;
+	unsigned int i;
+	for (i = 0; i < F->envlen; ++i)
+		if (F->envtab[i] == name)
+			return &E->slots[i];
+	return NULL;
+}
+
+/* Declarations go to the nearest scope with a variable object */
+static js_Object *jsR_varobject(js_State *J)
+{
+	js_Environment *E = J->E;
+	while (!E->variables)
+		E = E->outer;
+	return E->variables;
+}
+
 static void js_initvar(js_State *J, const char *name, int idx)
 {
-	jsR_defproperty(J, J->E->variables, name, JS_DONTENUM | JS_DONTCONF, stackidx(J, idx), NULL, NULL);
+	jsR_defproperty(J, jsR_varobject(J), name, JS_DONTENUM | JS_DONTCONF, stackidx(J, idx), NULL, NULL);
 }
 
 static void js_defvar(js_State *J, const char *name)
 {
-	jsR_defproperty(J, J->E->variables, name, JS_DONTENUM | JS_DONTCONF, NULL, NULL, NULL);
+	jsR_defproperty(J, jsR_varobject(J), name, JS_DONTENUM | JS_DONTCONF, NULL, NULL, NULL);
 }
 
 static int js_hasvar(js_State *J, const char *name)
 {
 	js_Environment *E = J->E;
+	js_Object *holder;
+	js_Value *slot;
 	do {
-		js_Property *ref = jsV_getproperty(J, E->variables, name);
-		if (ref) {
-			if (ref->getter) {
-				js_pushobject(J, ref->getter);
-				js_pushobject(J, E->variables);
-				js_call(J, 0);
-			} else {
-				js_pushvalue(J, ref->value);
+		if (!E->variables) {
+			slot = jsR_recordslot(E, name);
+			if (slot) {
+				js_pushvalue(J, *slot);
+				return 1;
+			}
+		} else {
+			js_Property *ref = jsV_getpropertyx(J, E->variables, name, &holder);
+			if (ref) {
+				if (ref->getter) {
+					js_pushobject(J, ref->getter);
+					js_pushobject(J, E->variables);
+					js_call(J, 0);
+				} else {
+					js_pushvalue(J, *jsV_propvalue(J, holder, ref));
+				}
+				return 1;
 			}
-			return 1;
 		}
 		E = E->outer;
 	} while (E);
@@ -827,22 +1257,32 @@ static int js_hasvar(js_State *J, const char *name)
 static void js_setvar(js_State *J, const char *name)
 {
 	js_Environment *E = J->E;
+	js_Object *holder;
+	js_Value *slot;
 	do {
-		js_Property *ref = jsV_getproperty(J, E->variables, name);
-		if (ref) {
-			if (ref->setter) {
-				js_pushobject(J, ref->setter);
-				js_pushobject(J, E->variables);
-				js_copy(J, -3);
-				js_call(J, 1);
-				js_pop(J, 1);
+		if (!E->variables) {
+			slot = jsR_recordslot(E, name);
+			if (slot) {
+				*slot = *stackidx(J, -1);
+				return;
+			}
+		} else {
+			js_Property *ref = jsV_getpropertyx(J, E->variables, name, &holder);
+			if (ref) {
+				if (ref->setter) {
+					js_pushobject(J, ref->setter);
+					js_pushobject(J, E->variables);
+					js_copy(J, -3);
+					js_call(J, 1);
+					js_pop(J, 1);
+					return;
+				}
+				if (!(ref->atts & JS_READONLY))
+					*jsV_propvalue(J, holder, ref) = *stackidx(J, -1);
+				else if (J->strict)
+					js_typeerror(J, "'%s' is read-only", name);
 				return;
 			}
-			if (!(ref->atts & JS_READONLY))
-				ref->value = *stackidx(J, -1);
-			else if (J->strict)
-				js_typeerror(J, "'%s' is read-only", name);
-			return;
 		}
 		E = E->outer;
 	} while (E);
@@ -855,15 +1295,23 @@ static int js_delvar(js_State *J, const char *name)
 {
 	js_Environment *E = J->E;
 	do {
-		js_Property *ref = jsV_getownproperty(J, E->variables, name);
-		if (ref) {
-			if (ref->atts & JS_DONTCONF) {
+		if (!E->variables) {
+			if (jsR_recordslot(E, name)) {
 				if (J->strict)
 					js_typeerror(J, "'%s' is non-configurable", name);
 				return 0;
 			}
-			jsV_delproperty(J, E->variables, name);
-			return 1;
+		} else {
+			js_Property *ref = jsV_getownproperty(J, E->variables, name);
+			if (ref) {
+				if (ref->atts & JS_DONTCONF) {
+					if (J->strict)
+						js_typeerror(J, "'%s' is non-configurable", name);
+					return 0;
+				}
+				jsV_delproperty(J, E->variables, name);
+				return 1;
+			}
 		}
 		E = E->outer;
 	} while (E);
@@ -872,44 +1320,128 @@ static int js_delvar(js_State *J, const char *name)
 
 /* Function calls */
 
+static void jsR_growframes(js_State *J)
+{
+	int cap = J->framecap * 2;
+	if (J->framecap >= J->framelimit)
+		js_error(J, "call stack overflow");
+	if (cap > J->framelimit)
+		cap = J->framelimit;
+	J->frames = js_realloc(J, J->frames, cap * sizeof *J->frames);
+	J->framecap = cap;
+}
+
+static inline js_Frame *jsR_pushframe(js_State *J, const char *name, const char *file, int line)
+{
+	js_Frame *frame;
+	if (J->frametop + 1 >= J->framecap)
+		jsR_growframes(J);
+	frame = &J->frames[++J->frametop];
+	frame->name = name;
+	frame->file = file;
+	frame->line = line;
+	frame->E = NULL;
+	frame->F = NULL;
+	frame->pc = NULL;
+	frame->construct = 0;
+	return frame;
+}
+
 static void jsR_savescope(js_State *J, js_Environment *newE)
 {
-	if (J->envtop + 1 >= JS_ENVLIMIT)
-		js_stackoverflow(J);
-	J->envstack[J->envtop++] = J->E;
+	J->frames[J->frametop].E = J->E;
 	J->E = newE;
 }
 
 static void jsR_restorescope(js_State *J)
 {
-	J->E = J->envstack[--J->envtop];
+	J->E = J->frames[J->frametop].E;
+	J->frames[J->frametop].E = NULL;
+}
+
+/* Create an arguments object from the n values starting at stack index first */
+static void jsR_newarguments(js_State *J, int first, unsigned int n)
+{
+	unsigned int i;
+	js_newobject(J);
+	if (!J->strict) {
+		js_currentfunction(J);
+		js_defpropertyatom(J, -2, JS_ATOM(J, callee), JS_DONTENUM);
+	}
+	js_pushnumber(J, n);
+	js_defpropertyatom(J, -2, JS_ATOM(J, length), JS_DONTENUM);
+	for (i = 0; i < n; ++i) {
+		js_copy(J, first + i);
+		js_setindex(J, -2, i);
+	}
+}
+
+/*
+ * Move the arguments above the locals, where OP_GETARG reads them, and
+ * copy the parameters back into their slots.
+ */
+static void jsR_inplacearguments(js_State *J, unsigned int n, js_Function *F)
+{
+	js_Value *args;
+	unsigned int i;
+
+	CHECKSTACK(F->varlen);
+	args = STACK + BOT + F->varlen + 1;
+	memmove(args, STACK + BOT + 1, n * sizeof *STACK);
+	for (i = 0; i < F->varlen; ++i) {
+		if (i < n && i < F->numparams)
+			STACK[BOT + 1 + i] = args[i];
+		else
+			STACK[BOT + 1 + i].type = JS_TUNDEFINED;
+	}
+	STACK[BOT + F->numparams + 1].type = JS_TINT32;
+	STACK[BOT + F->numparams + 1].u.integer = n;
+	TOP = BOT + F->varlen + 1 + n;
 }
 
-static void jsR_calllwfunction(js_State *J, unsigned int n, js_Function *F, js_Environment *scope)
+static void jsR_enterlwfunction(js_State *J, unsigned int n, js_Function *F, js_Environment *scope)
 {
 	js_Value v;
 	unsigned int i;
 
+	if (F->envlen)
+		scope = jsR_newrecord(J, F, scope);
+
 	jsR_savescope(J, scope);
 
-	if (n > F->numparams) {
-		js_pop(J, F->numparams - n);
-		n = F->numparams;
+	if (F->arguments == JS_ARGUMENTS_INPLACE) {
+		jsR_inplacearguments(J, n, F);
+	} else {
+		if (F->arguments) {
+			jsR_newarguments(J, 1, n);
+			v = STACK[--TOP];
+		}
+		if (n > F->numparams) {
+			js_pop(J, n - F->numparams);
+			n = F->numparams;
+		}
+		for (i = n; i < F->numparams; ++i)
+			js_pushundefined(J);
+		if (F->arguments) {
+			js_pushvalue(J, v);
+			++i;
+		}
+		for (; i < F->varlen; ++i)
+			js_pushundefined(J);
 	}
-	for (i = n; i < F->varlen; ++i)
-		js_pushundefined(J);
-
-	jsR_run(J, F);
-	v = *stackidx(J, -1);
-	TOP = --BOT; /* clear stack */
-	js_pushvalue(J, v);
+}
 
-	jsR_restorescope(J);
+/* Look up an argument that is not in range on a temporary arguments object */
+static void jsR_getarg(js_State *J, js_Function *F)
+{
+	const char *name = js_intern(J, js_tostring(J, -1));
+	jsR_newarguments(J, F->varlen + 1, STACK[BOT + F->numparams + 1].u.integer);
+	jsR_getproperty(J, js_toobject(J, -1), name);
+	js_rot3pop2(J);
 }
 
-static void jsR_callfunction(js_State *J, unsigned int n, js_Function *F, js_Environment *scope)
+static void jsR_enterfullfunction(js_State *J, unsigned int n, js_Function *F, js_Environment *scope)
 {
-	js_Value v;
 	unsigned int i;
 
 	scope = jsR_newenvironment(J, jsV_newobject(J, JS_COBJECT, NULL), scope);
@@ -917,18 +1449,8 @@ static void jsR_callfunction(js_State *J, unsigned int n, js_Function *F, js_Env
 	jsR_savescope(J, scope);
 
 	if (F->arguments) {
-		js_newobject(J);
-		if (!J->strict) {
-			js_currentfunction(J);
-			js_defproperty(J, -2, "callee", JS_DONTENUM);
-		}
-		js_pushnumber(J, n);
-		js_defproperty(J, -2, "length", JS_DONTENUM);
-		for (i = 0; i < n; ++i) {
-			js_copy(J, i + 1);
-			js_setindex(J, -2, i);
-		}
-		js_initvar(J, "arguments", -1);
+		jsR_newarguments(J, 1, n);
+		js_initvar(J, JS_ATOM(J, arguments), -1);
 		js_pop(J, 1);
 	}
 
@@ -942,12 +1464,22 @@ static void jsR_callfunction(js_State *J, unsigned int n, js_Function *F, js_Env
 		}
 	}
 	js_pop(J, n);
+}
 
-	jsR_run(J, F);
-	v = *stackidx(J, -1);
-	TOP = --BOT; /* clear stack */
-	js_pushvalue(J, v);
+/* Set up the locals and scope of a function whose arguments are at BOT+1 */
+static void jsR_enterfunction(js_State *J, unsigned int n, js_Function *F, js_Environment *scope)
+{
+	if (F->lightweight)
+		jsR_enterlwfunction(J, n, F, scope);
+	else
+		jsR_enterfullfunction(J, n, F, scope);
+}
 
+/* Replace the frame on the stack with its return value and restore the caller's scope */
+static inline void jsR_leavefunction(js_State *J)
+{
+	STACK[BOT-1] = STACK[TOP-1];
+	TOP = BOT--; /* clear stack */
 	jsR_restorescope(J);
 }
 
@@ -982,15 +1514,6 @@ static void jsR_callcfunction(js_State *J, unsigned int n, unsigned int min, js_
 	js_pushvalue(J, v);
 }
 
-static void jsR_pushtrace(js_State *J, const char *name, const char *file, int line)
-{
-	if (++J->tracetop == JS_ENVLIMIT)
-		js_error(J, "call stack overflow");
-	J->trace[J->tracetop].name = name;
-	J->trace[J->tracetop].file = file;
-	J->trace[J->tracetop].line = line;
-}
-
 void js_call(js_State *J, int n)
 {
 	js_Object *obj;
@@ -1005,29 +1528,87 @@ void js_call(js_State *J, int n)
 	BOT = TOP - n - 1;
 
 	if (obj->type == JS_CFUNCTION) {
-		jsR_pushtrace(J, obj->u.f.function->name, obj->u.f.function->filename, obj->u.f.function->line);
-		if (obj->u.f.function->lightweight)
-			jsR_calllwfunction(J, n, obj->u.f.function, obj->u.f.scope);
-		else
-			jsR_callfunction(J, n, obj->u.f.function, obj->u.f.scope);
-		--J->tracetop;
+		jsR_pushframe(J, obj->u.f.function->name, obj->u.f.function->filename, obj->u.f.function->line);
+		jsR_enterfunction(J, n, obj->u.f.function, obj->u.f.scope);
+		jsR_run(J, obj->u.f.function);
+		jsR_leavefunction(J);
+		--J->frametop;
 	} else if (obj->type == JS_CSCRIPT) {
-		jsR_pushtrace(J, obj->u.f.function->name, obj->u.f.function->filename, obj->u.f.function->line);
+		jsR_pushframe(J, obj->u.f.function->name, obj->u.f.function->filename, obj->u.f.function->line);
 		jsR_callscript(J, n, obj->u.f.function, obj->u.f.scope);
-		--J->tracetop;
+		--J->frametop;
 	} else if (obj->type == JS_CCFUNCTION) {
-		jsR_pushtrace(J, obj->u.c.name, "[C]", 0);
+		jsR_pushframe(J, obj->u.c.name, "[C]", 0);
 		jsR_callcfunction(J, n, obj->u.c.length, obj->u.c.function);
-		--J->tracetop;
+		--J->frametop;
 	}
 
 	BOT = savebot;
 }
 
+/* Create the 'this' object for a constructor call, and shift it into the 'this' slot */
+static js_Object *jsR_newthis(js_State *J, int n)
+{
+	js_Object *prototype;
+	js_Object *newobj;
+
+	/* extract the function object's prototype property */
+	js_getpropertyatom(J, -n - 1, JS_ATOM(J, prototype));
+	if (js_isobject(J, -1))
+		prototype = js_toobject(J, -1);
+	else
+		prototype = J->Object_prototype;
+	js_pop(J, 1);
+
+	newobj = jsV_newobject(J, JS_COBJECT, prototype);
+	js_pushobject(J, newobj);
+	if (n > 0)
+		js_rot(J, n + 1);
+	return newobj;
+}
+
+/*
+ * Enter a script function called from the interpreter loop without
+ * recursing; OP_RETURN resumes the caller F at pc.
+ */
+static inline void jsR_callinline(js_State *J, int n, js_Function *F, js_Instruction *pc, int construct)
+{
+	js_Object *obj = STACK[TOP - n - 2].u.object;
+	js_Frame *frame;
+	int savebot = BOT;
+
+	BOT = TOP - n - 1;
+	frame = jsR_pushframe(J, obj->u.f.function->name, obj->u.f.function->filename, obj->u.f.function->line);
+	frame->F = F;
+	frame->pc = pc;
+	frame->bot = savebot;
+	frame->construct = construct;
+	jsR_enterfunction(J, n, obj->u.f.function, obj->u.f.scope);
+}
+
+/*
+ * Replace the current frame with a call to the script function below the
+ * n arguments on top of the stack. The callee, 'this' and the arguments
+ * move down over the caller's stack window, and the callee's scope takes
+ * the place of the caller's.
+ */
+static void jsR_tailcall(js_State *J, int n)
+{
+	js_Object *obj = STACK[TOP - n - 2].u.object;
+	js_Frame *frame = &J->frames[J->frametop];
+
+	jsR_restorescope(J);
+	memmove(STACK + BOT - 1, STACK + TOP - n - 2, (n + 2) * sizeof *STACK);
+	TOP = BOT + n + 1;
+	frame->name = obj->u.f.function->name;
+	frame->file = obj->u.f.function->filename;
+	frame->line = obj->u.f.function->line;
+	jsR_enterfunction(J, n, obj->u.f.function, obj->u.f.scope);
+}
+
 void js_construct(js_State *J, int n)
 {
 	js_Object *obj;
-	js_Object *prototype;
 	js_Object *newobj;
 
 	if (!js_iscallable(J, -n-1))
@@ -1043,27 +1624,15 @@ void js_construct(js_State *J, int n)
 			js_rot(J, n + 1);
 		BOT = TOP - n - 1;
 
-		jsR_pushtrace(J, obj->u.c.name, "[C]", 0);
+		jsR_pushframe(J, obj->u.c.name, "[C]", 0);
 		jsR_callcfunction(J, n, obj->u.c.length, obj->u.c.constructor);
-		--J->tracetop;
+		--J->frametop;
 
 		BOT = savebot;
 		return;
 	}
 
-	/* extract the function object's prototype property */
-	js_getproperty(J, -n - 1, "prototype");
-	if (js_isobject(J, -1))
-		prototype = js_toobject(J, -1);
-	else
-		prototype = J->Object_prototype;
-	js_pop(J, 1);
-
-	/* create a new object with above prototype, and shift it into the 'this' slot */
-	newobj = jsV_newobject(J, JS_COBJECT, prototype);
-	js_pushobject(J, newobj);
-	if (n > 0)
-		js_rot(J, n + 1);
+	newobj = jsR_newthis(J, n);
 
 	/* call the function */
 	js_call(J, n);
@@ -1107,28 +1676,33 @@ int js_pcall(js_State *J, int n)
 
 void js_savetry(js_State *J, js_Instruction *pc)
 {
-	if (J->trytop == JS_TRYLIMIT)
-		js_error(J, "try: exception stack overflow");
-	J->trybuf[J->trytop].E = J->E;
-	J->trybuf[J->trytop].envtop = J->envtop;
-	J->trybuf[J->trytop].tracetop = J->tracetop;
-	J->trybuf[J->trytop].top = J->top;
-	J->trybuf[J->trytop].bot = J->bot;
-	J->trybuf[J->trytop].pc = pc;
+	js_Jumpbuf *buf;
+	if (J->trytop == J->trycap) {
+		if (J->trycap == J->trylimit)
+			js_tryoverflow(J); /* js_error would need a try to build the stack trace */
+		J->trybuf = js_realloc(J, J->trybuf, (J->trycap + 1) * sizeof *J->trybuf);
+		J->trybuf[J->trycap] = js_malloc(J, sizeof **J->trybuf);
+		++J->trycap;
+	}
+	buf = J->trybuf[J->trytop];
+	buf->E = J->E;
+	buf->frametop = J->frametop;
+	buf->top = J->top;
+	buf->bot = J->bot;
+	buf->pc = pc;
 }
 
-void js_throw(js_State *J)
+JS_NOINLINE void js_throw(js_State *J)
 {
 	if (J->trytop > 0) {
 		js_Value v = *stackidx(J, -1);
-		--J->trytop;
-		J->E = J->trybuf[J->trytop].E;
-		J->envtop = J->trybuf[J->trytop].envtop;
-		J->tracetop = J->trybuf[J->trytop].tracetop;
-		J->top = J->trybuf[J->trytop].top;
-		J->bot = J->trybuf[J->trytop].bot;
+		js_Jumpbuf *buf = J->trybuf[--J->trytop];
+		J->E = buf->E;
+		J->frametop = buf->frametop;
+		J->top = buf->top;
+		J->bot = buf->bot;
 		js_pushvalue(J, v);
-		longjmp(J->trybuf[J->trytop].buf, 1);
+		js_longjmp(buf->buf);
 	}
 	if (J->panic)
 		J->panic(J);
@@ -1137,6 +1711,21 @@ void js_throw(js_State *J)
 
 /* Main interpreter loop */
 
+/*
+ * With GCC-compatible compilers each opcode handler jumps straight to the
+ * next one through a table of label addresses (optable.h, generated from
+ * jscompile.h), saving the range check of the switch and giving every
+ * handler its own indirect branch to predict. The switch is still used to
+ * enter the loop, and is all that remains when JS_THREADED is 0.
+ */
+#ifndef JS_THREADED
+#ifdef __GNUC__
+#define JS_THREADED 1
+#else
+#define JS_THREADED 0
+#endif
+#endif
+
 static void jsR_dumpstack(js_State *J)
 {
 	int i;
@@ -1152,8 +1741,19 @@ static void jsR_dumpstack(js_State *J)
 
 static void jsR_dumpenvironment(js_State *J, js_Environment *E, int d)
 {
+	unsigned int i;
 	printf("scope %d ", d);
-	js_dumpobject(J, E->variables);
+	if (E->variables) {
+		js_dumpobject(J, E->variables);
+	} else {
+		printf("record {\n");
+		for (i = 0; i < E->function->envlen; ++i) {
+			printf("\t%s: ", E->function->envtab[i]);
+			js_dumpvalue(J, E->slots[i]);
+			printf(",\n");
+		}
+		printf("}\n");
+	}
 	if (E->outer)
 		jsR_dumpenvironment(J, E->outer, d+1);
 }
@@ -1162,10 +1762,10 @@ void js_stacktrace(js_State *J)
 {
 	int n;
 	printf("stack trace:\n");
-	for (n = J->tracetop; n >= 0; --n) {
-		const char *name = J->trace[n].name;
-		const char *file = J->trace[n].file;
-		int line = J->trace[n].line;
+	for (n = J->frametop; n >= 0; --n) {
+		const char *name = J->frames[n].name;
+		const char *file = J->frames[n].file;
+		int line = J->frames[n].line;
 		if (line > 0)
 			printf("\t%s:%d: in function '%s'\n", file, line, name);
 		else
@@ -1185,189 +1785,487 @@ void js_trap(js_State *J, int pc)
 	js_stacktrace(J);
 }
 
+/*
+ * Overflow checked arithmetic for the JS_TINT32 fast paths. These return 0
+ * if the exact result is not an int or is negative zero, in which case the
+ * caller falls back to double arithmetic.
+ */
+
+static int jsR_addint(int x, int y, int *z)
+{
+	int r = (int)((unsigned int)x + (unsigned int)y);
+	if (((x ^ r) & (y ^ r)) < 0)
+		return 0;
+	*z = r;
+	return 1;
+}
+
+static int jsR_subint(int x, int y, int *z)
+{
+	int r = (int)((unsigned int)x - (unsigned int)y);
+	if (((x ^ y) & (x ^ r)) < 0)
+		return 0;
+	*z = r;
+	return 1;
+}
+
+static int jsR_mulint(int x, int y, int *z)
+{
+	long long r = (long long)x * y;
+	if (r < INT_MIN || r > INT_MAX)
+		return 0;
+	if (r == 0 && (x | y) < 0)
+		return 0;
+	*z = r;
+	return 1;
+}
+
+static int jsR_divint(int x, int y, int *z)
+{
+	if (y == 0 || y == -1 || (x == 0 && y < 0) || x % y != 0)
+		return 0;
+	*z = x / y;
+	return 1;
+}
+
+static int jsR_modint(int x, int y, int *z)
+{
+	if (y == 0 || y == -1 || (x < 0 && x % y == 0))
+		return 0;
+	*z = x % y;
+	return 1;
+}
+
+/*
+ * Arithmetic operators read their operands and write their result in place
+ * at the top of the stack. Only operands that are not already numbers go
+ * through the generic conversions, which may call valueOf.
+ */
+
+static double jsR_tonumber(js_State *J, int idx)
+{
+	js_Value *v = STACK + idx;
+	if (v->type == JS_TINT32)
+		return v->u.integer;
+	if (v->type == JS_TNUMBER)
+		return v->u.number;
+	return jsV_tonumber(J, v);
+}
+
+static void jsR_unarynumber(js_State *J, double x)
+{
+	STACK[TOP-1].type = JS_TNUMBER;
+	STACK[TOP-1].u.number = x;
+}
+
+static void jsR_unaryint(js_State *J, int x)
+{
+	STACK[TOP-1].type = JS_TINT32;
+	STACK[TOP-1].u.integer = x;
+}
+
+static void jsR_binarynumber(js_State *J, double x)
+{
+	--TOP;
+	STACK[TOP-1].type = JS_TNUMBER;
+	STACK[TOP-1].u.number = x;
+}
+
+static void jsR_binaryint(js_State *J, int x)
+{
+	--TOP;
+	STACK[TOP-1].type = JS_TINT32;
+	STACK[TOP-1].u.integer = x;
+}
+
+static void jsR_binaryboolean(js_State *J, int x)
+{
+	--TOP;
+	STACK[TOP-1].type = JS_TBOOLEAN;
+	STACK[TOP-1].u.boolean = x;
+}
+
+#ifdef JS_OPSTATS
+/*
+ * Count each pair of opcodes run, to find sequences worth fusing into a
+ * superinstruction. Build with -DJS_OPSTATS; js_freestate prints the
+ * most common pairs to stderr.
+ */
+static const char *opstatname[] = {
+#include "opnames.h"
+};
+static unsigned long opstats[nelem(opstatname)][nelem(opstatname)];
+static unsigned int opstatlast;
+#define OPSTAT(op) (++opstats[opstatlast][op], opstatlast = (op))
+
+void jsR_dumpopstats(void)
+{
+	unsigned long total = 0, best;
+	unsigned int a, b, i, besta = 0, bestb = 0;
+
+	for (a = 0; a < nelem(opstatname); ++a)
+		for (b = 0; b < nelem(opstatname); ++b)
+			total += opstats[a][b];
+	if (total == 0)
+		return;
+
+	fprintf(stderr, "opcode pairs: %lu\n", total);
+	for (i = 0; i < 40; ++i) {
+		best = 0;
+		for (a = 0; a < nelem(opstatname); ++a)
+			for (b = 0; b < nelem(opstatname); ++b)
+				if (opstats[a][b] > best)
+					best = opstats[a][b], besta = a, bestb = b;
+		if (best == 0)
+			break;
+		fprintf(stderr, "\t%-16s %-16s %5.1f%%\n", opstatname[besta], opstatname[bestb], best * 100.0 / total);
+		opstats[besta][bestb] = 0;
+	}
+	memset(opstats, 0, sizeof opstats);
+}
+#else
+#define OPSTAT(op) ((void)0)
+#endif
+
+/* labels as values are an extension; keep -Wpedantic quiet about them only here */
+#if JS_THREADED
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+/* OP_TRY reloads the function registers after catching a longjmp */
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wclobbered"
+#endif
+
 static void jsR_run(js_State *J, js_Function *F)
 {
 	js_Function **FT = F->funtab;
 	double *NT = F->numtab;
 	const char **ST = F->strtab;
+	js_PropCache *CT = F->cachetab;
 	js_Instruction *pcstart = F->code;
 	js_Instruction *pc = F->code;
 	enum js_OpCode opcode;
 	int offset;
+	int base = J->frametop;
+	js_Frame *frame;
 
 	const char *str;
 	js_Object *obj;
+	js_Environment *E;
 	double x, y;
 	unsigned int ux, uy;
-	int ix, iy, okay;
+	int ix, okay;
 	int b;
 
-	while (1) {
-		if (J->gccounter > JS_GCLIMIT) {
-			J->gccounter = 0;
-			js_gc(J, 0);
-		}
+#if JS_THREADED
+	static const void *optable[] = {
+#include "optable.h"
+	};
+#define CASE(op) case op: L_##op
+#ifdef JS_OPSTATS
+#define NEXT do { opcode = *pc++; OPSTAT(opcode); goto *optable[opcode]; } while (0)
+#else
+#define NEXT goto *optable[*pc++]
+#endif
+#else
+#define CASE(op) case op
+#define NEXT break
+#endif
+
+	/*
+	 * Garbage is only collected at safepoints: before calls and on
+	 * backward jumps, where every live value is on the stack or in the
+	 * environment chain. Straight-line code always reaches one of them
+	 * after a bounded number of allocations.
+	 */
+#define SAFEPOINT \
+	do { \
+		if (J->gccounter > JS_GCLIMIT) { \
+			J->gccounter = 0; \
+			js_gc(J, 0); \
+		} \
+	} while (0)
+
+	/* switch to another function, for inline calls and returns */
+#define LOADFUNCTION(fun) \
+	do { \
+		F = fun; \
+		FT = F->funtab; \
+		NT = F->numtab; \
+		ST = F->strtab; \
+		CT = F->cachetab; \
+		pcstart = F->code; \
+	} while (0)
+
+#define JUMPIF(cond) \
+	do { \
+		offset = *pc++; \
+		if (cond) { \
+			if (pcstart + offset < pc) \
+				SAFEPOINT; \
+			pc = pcstart + offset; \
+		} \
+	} while (0)
+
+	SAFEPOINT;
+
+	/* Operands of binary operators, for the fast paths */
+#define INT2 (STACK[TOP-2].type == JS_TINT32 && STACK[TOP-1].type == JS_TINT32)
+#define NUM2 (JSV_ISNUMBER(&STACK[TOP-2]) && JSV_ISNUMBER(&STACK[TOP-1]))
+#define NUMBER(v) ((v).type == JS_TINT32 ? (v).u.integer : (v).u.number)
+#define IX (STACK[TOP-2].u.integer)
+#define IY (STACK[TOP-1].u.integer)
+
+/* integer keys of dense arrays skip the conversion to a property name */
+#define DENSEKEY(o, k) (STACK[TOP-k].type == JS_TINT32 && STACK[TOP-k].u.integer >= 0 && \
+	STACK[TOP-o].type == JS_TOBJECT && JSV_ISDENSE(STACK[TOP-o].u.object))
 
+	while (1) {
 		opcode = *pc++;
+		OPSTAT(opcode);
 		switch (opcode) {
-		case OP_POP: js_pop(J, 1); break;
-		case OP_DUP: js_dup(J); break;
-		case OP_DUP2: js_dup2(J); break;
-		case OP_ROT2: js_rot2(J); break;
-		case OP_ROT3: js_rot3(J); break;
-		case OP_ROT4: js_rot4(J); break;
-
-		case OP_NUMBER_0: js_pushnumber(J, 0); break;
-		case OP_NUMBER_1: js_pushnumber(J, 1); break;
-		case OP_NUMBER_POS: js_pushnumber(J, *pc++); break;
-		case OP_NUMBER_NEG: js_pushnumber(J, -(*pc++)); break;
-		case OP_NUMBER: js_pushnumber(J, NT[*pc++]); break;
-		case OP_STRING: js_pushliteral(J, ST[*pc++]); break;
-
-		case OP_CLOSURE: js_newfunction(J, FT[*pc++], J->E); break;
-		case OP_NEWOBJECT: js_newobject(J); break;
-		case OP_NEWARRAY: js_newarray(J); break;
-		case OP_NEWREGEXP: js_newregexp(J, ST[pc[0]], pc[1]); pc += 2; break;
-
-		case OP_UNDEF: js_pushundefined(J); break;
-		case OP_NULL: js_pushnull(J); break;
-		case OP_TRUE: js_pushboolean(J, 1); break;
-		case OP_FALSE: js_pushboolean(J, 0); break;
-
-		case OP_THIS: js_copy(J, 0); break;
-		case OP_GLOBAL: js_pushobject(J, J->G); break;
-		case OP_CURRENT: js_currentfunction(J); break;
-
-		case OP_INITLOCAL:
+		CASE(OP_POP): js_pop(J, 1); NEXT;
+		CASE(OP_DUP): js_dup(J); NEXT;
+		CASE(OP_DUP2): js_dup2(J); NEXT;
+		CASE(OP_ROT2): js_rot2(J); NEXT;
+		CASE(OP_ROT3): js_rot3(J); NEXT;
+		CASE(OP_ROT4): js_rot4(J); NEXT;
+
+		CASE(OP_NUMBER_0): js_pushint32(J, 0); NEXT;
+		CASE(OP_NUMBER_1): js_pushint32(J, 1); NEXT;
+		CASE(OP_NUMBER_POS): js_pushint32(J, *pc++); NEXT;
+		CASE(OP_NUMBER_NEG): js_pushint32(J, -(int)*pc++); NEXT;
+		CASE(OP_INTEGER): js_pushint32(J, (int)(pc[0] | (unsigned int)pc[1] << 16)); pc += 2; NEXT;
+		CASE(OP_NUMBER): js_pushnumber(J, NT[*pc++]); NEXT;
+		CASE(OP_STRING): js_pushliteral(J, ST[*pc++]); NEXT;
+
+		CASE(OP_CLOSURE): js_newfunction(J, FT[*pc++], J->E); NEXT;
+		CASE(OP_NEWOBJECT): js_newobject(J); NEXT;
+		CASE(OP_NEWARRAY): js_newarray(J); NEXT;
+		CASE(OP_NEWREGEXP): js_newregexpliteral(J, F, pc[0], pc[1]); pc += 2; NEXT;
+
+		CASE(OP_UNDEF): js_pushundefined(J); NEXT;
+		CASE(OP_NULL): js_pushnull(J); NEXT;
+		CASE(OP_TRUE): js_pushboolean(J, 1); NEXT;
+		CASE(OP_FALSE): js_pushboolean(J, 0); NEXT;
+
+		CASE(OP_THIS): js_copy(J, 0); NEXT;
+		CASE(OP_GLOBAL): js_pushobject(J, J->G); NEXT;
+		CASE(OP_CURRENT): js_currentfunction(J); NEXT;
+
+		CASE(OP_INITLOCAL):
 			STACK[BOT + *pc++] = STACK[--TOP];
-			break;
+			NEXT;
 
-		case OP_GETLOCAL:
+		CASE(OP_GETLOCAL):
 			CHECKSTACK(1);
 			STACK[TOP++] = STACK[BOT + *pc++];
-			break;
+			NEXT;
 
-		case OP_SETLOCAL:
+		CASE(OP_SETLOCAL):
 			STACK[BOT + *pc++] = STACK[TOP-1];
-			break;
+			NEXT;
+
+		CASE(OP_GETLOCAL2):
+			CHECKSTACK(2);
+			STACK[TOP++] = STACK[BOT + *pc++];
+			STACK[TOP++] = STACK[BOT + *pc++];
+			NEXT;
+
+		CASE(OP_GETLOCALPROP_S):
+			str = ST[pc[1]];
+			if (!JSV_ISSTRING(&STACK[BOT + pc[0]]) || !jsR_getstringproperty(J, &STACK[BOT + pc[0]], str)) {
+				obj = jsV_toobject(J, &STACK[BOT + pc[0]]);
+				jsR_getpropertycached(J, obj, str, &CT[pc[2]]);
+			}
+			pc += 3;
+			NEXT;
 
-		case OP_DELLOCAL:
+		CASE(OP_DELLOCAL):
 			++pc;
 			js_pushboolean(J, 0);
-			break;
+			NEXT;
 
-		case OP_INITVAR:
+		CASE(OP_ARGLENGTH):
+			CHECKSTACK(1);
+			STACK[TOP++] = STACK[BOT + F->numparams + 1];
+			NEXT;
+
+		CASE(OP_GETARG):
+			ux = STACK[BOT + F->numparams + 1].u.integer;
+			if (STACK[TOP-1].type == JS_TINT32 && (unsigned int)STACK[TOP-1].u.integer < ux)
+				STACK[TOP-1] = STACK[BOT + F->varlen + 1 + STACK[TOP-1].u.integer];
+			else
+				jsR_getarg(J, F);
+			NEXT;
+
+		CASE(OP_INITENV):
+			E = jsR_record(J->E, pc[0]);
+			E->slots[pc[1]] = STACK[--TOP];
+			pc += 2;
+			NEXT;
+
+		CASE(OP_GETENV):
+			CHECKSTACK(1);
+			E = jsR_record(J->E, pc[0]);
+			STACK[TOP++] = E->slots[pc[1]];
+			pc += 2;
+			NEXT;
+
+		CASE(OP_SETENV):
+			E = jsR_record(J->E, pc[0]);
+			E->slots[pc[1]] = STACK[TOP-1];
+			pc += 2;
+			NEXT;
+
+		CASE(OP_INITVAR):
 			js_initvar(J, ST[*pc++], -1);
 			js_pop(J, 1);
-			break;
+			NEXT;
 
-		case OP_DEFVAR:
+		CASE(OP_DEFVAR):
 			js_defvar(J, ST[*pc++]);
-			break;
+			NEXT;
 
-		case OP_GETVAR:
+		CASE(OP_GETVAR):
 			str = ST[*pc++];
 			if (!js_hasvar(J, str))
 				js_referenceerror(J, "'%s' is not defined", str);
-			break;
+			NEXT;
 
-		case OP_HASVAR:
+		CASE(OP_HASVAR):
 			if (!js_hasvar(J, ST[*pc++]))
 				js_pushundefined(J);
-			break;
+			NEXT;
 
-		case OP_SETVAR:
+		CASE(OP_SETVAR):
 			js_setvar(J, ST[*pc++]);
-			break;
+			NEXT;
 
-		case OP_DELVAR:
+		CASE(OP_DELVAR):
 			b = js_delvar(J, ST[*pc++]);
 			js_pushboolean(J, b);
-			break;
+			NEXT;
 
-		case OP_IN:
+		CASE(OP_IN):
 			str = js_tostring(J, -2);
 			if (!js_isobject(J, -1))
 				js_typeerror(J, "operand to 'in' is not an object");
 			b = js_hasproperty(J, -1, str);
 			js_pop(J, 2 + b);
 			js_pushboolean(J, b);
-			break;
+			NEXT;
 
-		case OP_INITPROP:
+		CASE(OP_INITPROP):
+			if (DENSEKEY(3, 2) && jsV_setdenseindex(J, STACK[TOP-3].u.object, IX, &STACK[TOP-1])) {
+				TOP -= 2;
+				NEXT;
+			}
 			obj = js_toobject(J, -3);
-			str = js_tostring(J, -2);
+			str = js_intern(J, js_tostring(J, -2));
 			jsR_setproperty(J, obj, str, stackidx(J, -1));
 			js_pop(J, 2);
-			break;
+			NEXT;
 
-		case OP_INITGETTER:
+		CASE(OP_INITGETTER):
 			obj = js_toobject(J, -3);
-			str = js_tostring(J, -2);
+			str = js_intern(J, js_tostring(J, -2));
 			jsR_defproperty(J, obj, str, 0, NULL, jsR_tofunction(J, -1), NULL);
 			js_pop(J, 2);
-			break;
+			NEXT;
 
-		case OP_INITSETTER:
+		CASE(OP_INITSETTER):
 			obj = js_toobject(J, -3);
-			str = js_tostring(J, -2);
+			str = js_intern(J, js_tostring(J, -2));
 			jsR_defproperty(J, obj, str, 0, NULL, NULL, jsR_tofunction(J, -1));
 			js_pop(J, 2);
-			break;
+			NEXT;
 
-		case OP_GETPROP:
-			str = js_tostring(J, -1);
+		CASE(OP_GETPROP):
+			if (DENSEKEY(2, 1) && (unsigned int)IY < STACK[TOP-2].u.object->u.a.filled) {
+				STACK[TOP-2] = STACK[TOP-2].u.object->u.a.array[IY];
+				--TOP;
+				NEXT;
+			}
+			if (STACK[TOP-1].type == JS_TINT32 && IY >= 0 && JSV_ISSTRING(&STACK[TOP-2])) {
+				b = jsV_runeat(J, jsV_strinfo(J, &STACK[TOP-2]), IY);
+				js_pop(J, 2);
+				js_pushrune(J, b);
+				NEXT;
+			}
+			str = js_intern(J, js_tostring(J, -1));
 			obj = js_toobject(J, -2);
 			jsR_getproperty(J, obj, str);
 			js_rot3pop2(J);
-			break;
+			NEXT;
 
-		case OP_GETPROP_S:
+		CASE(OP_GETPROP_S):
 			str = ST[*pc++];
-			obj = js_toobject(J, -1);
-			jsR_getproperty(J, obj, str);
+			if (!JSV_ISSTRING(&STACK[TOP-1]) || !jsR_getstringproperty(J, &STACK[TOP-1], str)) {
+				obj = js_toobject(J, -1);
+				jsR_getpropertycached(J, obj, str, &CT[*pc]);
+			}
+			++pc;
 			js_rot2pop1(J);
-			break;
+			NEXT;
 
-		case OP_SETPROP:
-			str = js_tostring(J, -2);
+		CASE(OP_GETMETHOD_S):
+			str = ST[*pc++];
+			if (!JSV_ISSTRING(&STACK[TOP-1]) || !jsR_getstringproperty(J, &STACK[TOP-1], str)) {
+				obj = js_toobject(J, -1);
+				jsR_getpropertycached(J, obj, str, &CT[*pc]);
+			}
+			++pc;
+			js_rot2(J);
+			NEXT;
+
+		CASE(OP_SETPROP):
+			if (DENSEKEY(3, 2) && jsV_setdenseindex(J, STACK[TOP-3].u.object, IX, &STACK[TOP-1])) {
+				STACK[TOP-3] = STACK[TOP-1];
+				TOP -= 2;
+				NEXT;
+			}
+			str = js_intern(J, js_tostring(J, -2));
 			obj = js_toobject(J, -3);
 			jsR_setproperty(J, obj, str, stackidx(J, -1));
 			js_rot3pop2(J);
-			break;
+			NEXT;
 
-		case OP_SETPROP_S:
+		CASE(OP_SETPROP_S):
 			str = ST[*pc++];
 			obj = js_toobject(J, -2);
-			jsR_setproperty(J, obj, str, stackidx(J, -1));
+			jsR_setpropertycached(J, obj, str, stackidx(J, -1), &CT[*pc++]);
 			js_rot2pop1(J);
-			break;
+			NEXT;
 
-		case OP_DELPROP:
-			str = js_tostring(J, -1);
+		CASE(OP_DELPROP):
+			str = js_intern(J, js_tostring(J, -1));
 			obj = js_toobject(J, -2);
 			b = jsR_delproperty(J, obj, str);
 			js_pop(J, 2);
 			js_pushboolean(J, b);
-			break;
+			NEXT;
 
-		case OP_DELPROP_S:
+		CASE(OP_DELPROP_S):
 			str = ST[*pc++];
 			obj = js_toobject(J, -1);
 			b = jsR_delproperty(J, obj, str);
 			js_pop(J, 1);
 			js_pushboolean(J, b);
-			break;
+			NEXT;
 
-		case OP_ITERATOR:
+		CASE(OP_ITERATOR):
 			if (!js_isundefined(J, -1) && !js_isnull(J, -1)) {
 				obj = jsV_newiterator(J, js_toobject(J, -1), 0);
 				js_pop(J, 1);
 				js_pushobject(J, obj);
 			}
-			break;
+			NEXT;
 
-		case OP_NEXTITER:
+		CASE(OP_NEXTITER):
 			obj = js_toobject(J, -1);
 			str = jsV_nextiterator(J, obj);
 			if (str) {
@@ -1377,160 +2275,270 @@ static void jsR_run(js_State *J, js_Function *F)
 				js_pop(J, 1);
 				js_pushboolean(J, 0);
 			}
-			break;
+			NEXT;
 
 		/* Function calls */
 
-		case OP_EVAL:
+		CASE(OP_EVAL):
 			js_eval(J);
-			break;
-
-		case OP_CALL:
-			js_call(J, *pc++);
-			break;
-
-		case OP_NEW:
-			js_construct(J, *pc++);
-			break;
+			NEXT;
+
+		CASE(OP_CALL):
+			SAFEPOINT;
+			ix = *pc++;
+			if (STACK[TOP-ix-2].type == JS_TOBJECT && STACK[TOP-ix-2].u.object->type == JS_CFUNCTION) {
+				jsR_callinline(J, ix, F, pc, 0);
+				LOADFUNCTION(STACK[BOT-1].u.object->u.f.function);
+				pc = pcstart;
+			} else {
+				js_call(J, ix);
+			}
+			NEXT;
+
+		CASE(OP_TAILCALL):
+			SAFEPOINT;
+			ix = *pc++;
+			/* constructors check the return value, so 'new' frames are kept */
+			if (STACK[TOP-ix-2].type == JS_TOBJECT && STACK[TOP-ix-2].u.object->type == JS_CFUNCTION &&
+					!J->frames[J->frametop].construct) {
+				jsR_tailcall(J, ix);
+				LOADFUNCTION(STACK[BOT-1].u.object->u.f.function);
+				pc = pcstart;
+			} else {
+				js_call(J, ix);
+			}
+			NEXT;
+
+		CASE(OP_NEW):
+			SAFEPOINT;
+			ix = *pc++;
+			if (STACK[TOP-ix-1].type == JS_TOBJECT && STACK[TOP-ix-1].u.object->type == JS_CFUNCTION) {
+				jsR_newthis(J, ix);
+				jsR_callinline(J, ix, F, pc, 1);
+				LOADFUNCTION(STACK[BOT-1].u.object->u.f.function);
+				pc = pcstart;
+			} else {
+				js_construct(J, ix);
+			}
+			NEXT;
 
 		/* Unary operators */
 
-		case OP_TYPEOF:
+		CASE(OP_TYPEOF):
 			str = js_typeof(J, -1);
 			js_pop(J, 1);
 			js_pushliteral(J, str);
-			break;
-
-		case OP_POS:
-			x = js_tonumber(J, -1);
-			js_pop(J, 1);
-			js_pushnumber(J, x);
-			break;
-
-		case OP_NEG:
-			x = js_tonumber(J, -1);
-			js_pop(J, 1);
-			js_pushnumber(J, -x);
-			break;
-
-		case OP_BITNOT:
-			ix = js_toint32(J, -1);
-			js_pop(J, 1);
-			js_pushnumber(J, ~ix);
-			break;
-
-		case OP_LOGNOT:
+			NEXT;
+
+		CASE(OP_POS):
+			if (!JSV_ISNUMBER(&STACK[TOP-1]))
+				jsR_unarynumber(J, jsR_tonumber(J, TOP-1));
+			NEXT;
+
+		CASE(OP_NEG):
+			if (STACK[TOP-1].type == JS_TINT32 && STACK[TOP-1].u.integer != 0 && STACK[TOP-1].u.integer != INT_MIN)
+				STACK[TOP-1].u.integer = -STACK[TOP-1].u.integer;
+			else
+				jsR_unarynumber(J, -jsR_tonumber(J, TOP-1));
+			NEXT;
+
+		CASE(OP_BITNOT):
+			if (STACK[TOP-1].type == JS_TINT32)
+				STACK[TOP-1].u.integer = ~STACK[TOP-1].u.integer;
+			else
+				jsR_unaryint(J, ~js_toint32(J, -1));
+			NEXT;
+
+		CASE(OP_LOGNOT):
 			b = js_toboolean(J, -1);
 			js_pop(J, 1);
 			js_pushboolean(J, !b);
-			break;
-
-		case OP_INC:
-			x = js_tonumber(J, -1);
-			js_pop(J, 1);
-			js_pushnumber(J, x + 1);
-			break;
-
-		case OP_DEC:
-			x = js_tonumber(J, -1);
-			js_pop(J, 1);
-			js_pushnumber(J, x - 1);
-			break;
-
-		case OP_POSTINC:
-			x = js_tonumber(J, -1);
-			js_pop(J, 1);
-			js_pushnumber(J, x + 1);
-			js_pushnumber(J, x);
-			break;
+			NEXT;
+
+		CASE(OP_INC):
+			if (STACK[TOP-1].type == JS_TINT32 && STACK[TOP-1].u.integer != INT_MAX)
+				++STACK[TOP-1].u.integer;
+			else
+				jsR_unarynumber(J, jsR_tonumber(J, TOP-1) + 1);
+			NEXT;
+
+		CASE(OP_DEC):
+			if (STACK[TOP-1].type == JS_TINT32 && STACK[TOP-1].u.integer != INT_MIN)
+				--STACK[TOP-1].u.integer;
+			else
+				jsR_unarynumber(J, jsR_tonumber(J, TOP-1) - 1);
+			NEXT;
+
+		CASE(OP_POSTINC):
+			CHECKSTACK(1);
+			if (STACK[TOP-1].type == JS_TINT32 && STACK[TOP-1].u.integer != INT_MAX) {
+				STACK[TOP] = STACK[TOP-1];
+				++STACK[TOP-1].u.integer;
+				++TOP;
+			} else {
+				x = jsR_tonumber(J, TOP-1);
+				jsR_unarynumber(J, x + 1);
+				js_pushnumber(J, x);
+			}
+			NEXT;
 
-		case OP_POSTDEC:
-			x = js_tonumber(J, -1);
-			js_pop(J, 1);
-			js_pushnumber(J, x - 1);
-			js_pushnumber(J, x);
-			break;
+		CASE(OP_POSTDEC):
+			CHECKSTACK(1);
+			if (STACK[TOP-1].type == JS_TINT32 && STACK[TOP-1].u.integer != INT_MIN) {
+				STACK[TOP] = STACK[TOP-1];
+				--STACK[TOP-1].u.integer;
+				++TOP;
+			} else {
+				x = jsR_tonumber(J, TOP-1);
+				jsR_unarynumber(J, x - 1);
+				js_pushnumber(J, x);
+			}
+			NEXT;
 
 		/* Multiplicative operators */
 
-		case OP_MUL:
-			x = js_tonumber(J, -2);
-			y = js_tonumber(J, -1);
-			js_pop(J, 2);
-			js_pushnumber(J, x * y);
-			break;
-
-		case OP_DIV:
-			x = js_tonumber(J, -2);
-			y = js_tonumber(J, -1);
-			js_pop(J, 2);
-			js_pushnumber(J, x / y);
-			break;
-
-		case OP_MOD:
-			x = js_tonumber(J, -2);
-			y = js_tonumber(J, -1);
-			js_pop(J, 2);
-			js_pushnumber(J, fmod(x, y));
-			break;
+		CASE(OP_MUL):
+			if (INT2 && jsR_mulint(IX, IY, &IX))
+				--TOP;
+			else {
+				x = jsR_tonumber(J, TOP-2);
+				y = jsR_tonumber(J, TOP-1);
+				jsR_binarynumber(J, x * y);
+			}
+			NEXT;
+
+		CASE(OP_DIV):
+			if (INT2 && jsR_divint(IX, IY, &IX))
+				--TOP;
+			else {
+				x = jsR_tonumber(J, TOP-2);
+				y = jsR_tonumber(J, TOP-1);
+				jsR_binarynumber(J, x / y);
+			}
+			NEXT;
+
+		CASE(OP_MOD):
+			if (INT2 && jsR_modint(IX, IY, &IX))
+				--TOP;
+			else {
+				x = jsR_tonumber(J, TOP-2);
+				y = jsR_tonumber(J, TOP-1);
+				jsR_binarynumber(J, fmod(x, y));
+			}
+			NEXT;
 
 		/* Additive operators */
 
-		case OP_ADD:
-			js_concat(J);
-			break;
-
-		case OP_SUB:
-			x = js_tonumber(J, -2);
-			y = js_tonumber(J, -1);
-			js_pop(J, 2);
-			js_pushnumber(J, x - y);
-			break;
+		CASE(OP_ADD):
+			if (INT2 && jsR_addint(IX, IY, &IX))
+				--TOP;
+			else if (NUM2)
+				jsR_binarynumber(J, NUMBER(STACK[TOP-2]) + NUMBER(STACK[TOP-1]));
+			else
+				js_concat(J);
+			NEXT;
+
+		CASE(OP_SUB):
+			if (INT2 && jsR_subint(IX, IY, &IX))
+				--TOP;
+			else {
+				x = jsR_tonumber(J, TOP-2);
+				y = jsR_tonumber(J, TOP-1);
+				jsR_binarynumber(J, x - y);
+			}
+			NEXT;
 
 		/* Shift operators */
 
-		case OP_SHL:
+		CASE(OP_SHL):
 			ix = js_toint32(J, -2);
 			uy = js_touint32(J, -1);
-			js_pop(J, 2);
-			js_pushnumber(J, ix << (uy & 0x1F));
-			break;
+			jsR_binaryint(J, (unsigned int)ix << (uy & 0x1F));
+			NEXT;
 
-		case OP_SHR:
+		CASE(OP_SHR):
 			ix = js_toint32(J, -2);
 			uy = js_touint32(J, -1);
-			js_pop(J, 2);
-			js_pushnumber(J, ix >> (uy & 0x1F));
-			break;
+			jsR_binaryint(J, ix >> (uy & 0x1F));
+			NEXT;
 
-		case OP_USHR:
+		CASE(OP_USHR):
 			ux = js_touint32(J, -2);
 			uy = js_touint32(J, -1);
-			js_pop(J, 2);
-			js_pushnumber(J, ux >> (uy & 0x1F));
-			break;
+			ux >>= uy & 0x1F;
+			if (ux <= INT_MAX)
+				jsR_binaryint(J, ux);
+			else
+				jsR_binarynumber(J, ux);
+			NEXT;
 
 		/* Relational operators */
 
-		case OP_LT: b = js_compare(J, &okay); js_pop(J, 2); js_pushboolean(J, okay && b < 0); break;
-		case OP_GT: b = js_compare(J, &okay); js_pop(J, 2); js_pushboolean(J, okay && b > 0); break;
-		case OP_LE: b = js_compare(J, &okay); js_pop(J, 2); js_pushboolean(J, okay && b <= 0); break;
-		case OP_GE: b = js_compare(J, &okay); js_pop(J, 2); js_pushboolean(J, okay && b >= 0); break;
-
-		case OP_INSTANCEOF:
+		CASE(OP_LT):
+			if (INT2) b = IX < IY;
+			else if (NUM2) b = NUMBER(STACK[TOP-2]) < NUMBER(STACK[TOP-1]);
+			else { b = js_compare(J, &okay); b = okay && b < 0; }
+			jsR_binaryboolean(J, b);
+			NEXT;
+
+		CASE(OP_GT):
+			if (INT2) b = IX > IY;
+			else if (NUM2) b = NUMBER(STACK[TOP-2]) > NUMBER(STACK[TOP-1]);
+			else { b = js_compare(J, &okay); b = okay && b > 0; }
+			jsR_binaryboolean(J, b);
+			NEXT;
+
+		CASE(OP_LE):
+			if (INT2) b = IX <= IY;
+			else if (NUM2) b = NUMBER(STACK[TOP-2]) <= NUMBER(STACK[TOP-1]);
+			else { b = js_compare(J, &okay); b = okay && b <= 0; }
+			jsR_binaryboolean(J, b);
+			NEXT;
+
+		CASE(OP_GE):
+			if (INT2) b = IX >= IY;
+			else if (NUM2) b = NUMBER(STACK[TOP-2]) >= NUMBER(STACK[TOP-1]);
+			else { b = js_compare(J, &okay); b = okay && b >= 0; }
+			jsR_binaryboolean(J, b);
+			NEXT;
+
+		CASE(OP_INSTANCEOF):
 			b = js_instanceof(J);
 			js_pop(J, 2);
 			js_pushboolean(J, b);
-			break;
+			NEXT;
 
 		/* Equality */
 
-		case OP_EQ: b = js_equal(J); js_pop(J, 2); js_pushboolean(J, b); break;
-		case OP_NE: b = js_equal(J); js_pop(J, 2); js_pushboolean(J, !b); break;
-		case OP_STRICTEQ: b = js_strictequal(J); js_pop(J, 2); js_pushboolean(J, b); break;
-		case OP_STRICTNE: b = js_strictequal(J); js_pop(J, 2); js_pushboolean(J, !b); break;
-
-		case OP_JCASE:
+		CASE(OP_EQ):
+			if (INT2) b = IX == IY;
+			else if (NUM2) b = NUMBER(STACK[TOP-2]) == NUMBER(STACK[TOP-1]);
+			else b = js_equal(J);
+			jsR_binaryboolean(J, b);
+			NEXT;
+
+		CASE(OP_NE):
+			if (INT2) b = IX != IY;
+			else if (NUM2) b = NUMBER(STACK[TOP-2]) != NUMBER(STACK[TOP-1]);
+			else b = !js_equal(J);
+			jsR_binaryboolean(J, b);
+			NEXT;
+
+		CASE(OP_STRICTEQ):
+			if (INT2) b = IX == IY;
+			else if (NUM2) b = NUMBER(STACK[TOP-2]) == NUMBER(STACK[TOP-1]);
+			else b = js_strictequal(J);
+			jsR_binaryboolean(J, b);
+			NEXT;
+
+		CASE(OP_STRICTNE):
+			if (INT2) b = IX != IY;
+			else if (NUM2) b = NUMBER(STACK[TOP-2]) != NUMBER(STACK[TOP-1]);
+			else b = !js_strictequal(J);
+			jsR_binaryboolean(J, b);
+			NEXT;
+
+		CASE(OP_JCASE):
 			offset = *pc++;
 			b = js_strictequal(J);
 			if (b) {
@@ -1539,50 +2547,49 @@ static void jsR_run(js_State *J, js_Function *F)
 			} else {
 				js_pop(J, 1);
 			}
-			break;
+			NEXT;
 
 		/* Binary bitwise operators */
 
-		case OP_BITAND:
-			ix = js_toint32(J, -2);
-			iy = js_toint32(J, -1);
-			js_pop(J, 2);
-			js_pushnumber(J, ix & iy);
-			break;
+		CASE(OP_BITAND):
+			if (INT2) ix = IX & IY;
+			else ix = js_toint32(J, -2) & js_toint32(J, -1);
+			jsR_binaryint(J, ix);
+			NEXT;
 
-		case OP_BITXOR:
-			ix = js_toint32(J, -2);
-			iy = js_toint32(J, -1);
-			js_pop(J, 2);
-			js_pushnumber(J, ix ^ iy);
-			break;
+		CASE(OP_BITXOR):
+			if (INT2) ix = IX ^ IY;
+			else ix = js_toint32(J, -2) ^ js_toint32(J, -1);
+			jsR_binaryint(J, ix);
+			NEXT;
 
-		case OP_BITOR:
-			ix = js_toint32(J, -2);
-			iy = js_toint32(J, -1);
-			js_pop(J, 2);
-			js_pushnumber(J, ix | iy);
-			break;
+		CASE(OP_BITOR):
+			if (INT2) ix = IX | IY;
+			else ix = js_toint32(J, -2) | js_toint32(J, -1);
+			jsR_binaryint(J, ix);
+			NEXT;
 
 		/* Try and Catch */
 
-		case OP_THROW:
+		CASE(OP_THROW):
 			js_throw(J);
 
-		case OP_TRY:
+		CASE(OP_TRY):
 			offset = *pc++;
 			if (js_trypc(J, pc)) {
-				pc = J->trybuf[J->trytop].pc;
+				/* the throw may have come from an inline call */
+				LOADFUNCTION(STACK[BOT-1].u.object->u.f.function);
+				pc = J->trybuf[J->trytop]->pc;
 			} else {
 				pc = pcstart + offset;
 			}
-			break;
+			NEXT;
 
-		case OP_ENDTRY:
+		CASE(OP_ENDTRY):
 			js_endtry(J);
-			break;
+			NEXT;
 
-		case OP_CATCH:
+		CASE(OP_CATCH):
 			str = ST[*pc++];
 			obj = jsV_newobject(J, JS_COBJECT, NULL);
 			js_pushobject(J, obj);
@@ -1590,56 +2597,117 @@ static void jsR_run(js_State *J, js_Function *F)
 			js_setproperty(J, -2, str);
 			J->E = jsR_newenvironment(J, obj, J->E);
 			js_pop(J, 1);
-			break;
+			NEXT;
 
-		case OP_ENDCATCH:
+		CASE(OP_ENDCATCH):
 			J->E = J->E->outer;
-			break;
+			NEXT;
 
 		/* With */
 
-		case OP_WITH:
+		CASE(OP_WITH):
 			obj = js_toobject(J, -1);
 			J->E = jsR_newenvironment(J, obj, J->E);
 			js_pop(J, 1);
-			break;
+			NEXT;
 
-		case OP_ENDWITH:
+		CASE(OP_ENDWITH):
 			J->E = J->E->outer;
-			break;
+			NEXT;
 
 		/* Branching */
 
-		case OP_DEBUGGER:
+		CASE(OP_DEBUGGER):
 			js_trap(J, (int)(pc - pcstart) - 1);
-			break;
+			NEXT;
 
-		case OP_JUMP:
-			pc = pcstart + *pc;
-			break;
+		CASE(OP_JUMP):
+			offset = *pc;
+			if (pcstart + offset < pc)
+				SAFEPOINT;
+			pc = pcstart + offset;
+			NEXT;
 
-		case OP_JTRUE:
-			offset = *pc++;
+		CASE(OP_JTRUE):
 			b = js_toboolean(J, -1);
 			js_pop(J, 1);
-			if (b)
-				pc = pcstart + offset;
-			break;
+			JUMPIF(b);
+			NEXT;
 
-		case OP_JFALSE:
-			offset = *pc++;
+		CASE(OP_JFALSE):
 			b = js_toboolean(J, -1);
 			js_pop(J, 1);
-			if (!b)
-				pc = pcstart + offset;
-			break;
+			JUMPIF(!b);
+			NEXT;
 
-		case OP_RETURN:
-			return;
+		CASE(OP_JNLT):
+			if (INT2) b = IX < IY;
+			else if (NUM2) b = NUMBER(STACK[TOP-2]) < NUMBER(STACK[TOP-1]);
+			else { b = js_compare(J, &okay); b = okay && b < 0; }
+			js_pop(J, 2);
+			JUMPIF(!b);
+			NEXT;
 
-		case OP_LINE:
-			J->trace[J->tracetop].line = *pc++;
-			break;
+		CASE(OP_JNGT):
+			if (INT2) b = IX > IY;
+			else if (NUM2) b = NUMBER(STACK[TOP-2]) > NUMBER(STACK[TOP-1]);
+			else { b = js_compare(J, &okay); b = okay && b > 0; }
+			js_pop(J, 2);
+			JUMPIF(!b);
+			NEXT;
+
+		CASE(OP_JNLE):
+			if (INT2) b = IX <= IY;
+			else if (NUM2) b = NUMBER(STACK[TOP-2]) <= NUMBER(STACK[TOP-1]);
+			else { b = js_compare(J, &okay); b = okay && b <= 0; }
+			js_pop(J, 2);
+			JUMPIF(!b);
+			NEXT;
+
+		CASE(OP_JNGE):
+			if (INT2) b = IX >= IY;
+			else if (NUM2) b = NUMBER(STACK[TOP-2]) >= NUMBER(STACK[TOP-1]);
+			else { b = js_compare(J, &okay); b = okay && b >= 0; }
+			js_pop(J, 2);
+			JUMPIF(!b);
+			NEXT;
+
+		CASE(OP_RETURN):
+			if (J->frametop == base)
+				return;
+			frame = &J->frames[J->frametop];
+			/* 'new' returns the object it created unless the constructor returns another */
+			if (frame->construct && !js_isobject(J, -1))
+				STACK[TOP-1] = STACK[BOT];
+			jsR_leavefunction(J);
+			BOT = frame->bot;
+			pc = frame->pc;
+			LOADFUNCTION(frame->F);
+			--J->frametop;
+			NEXT;
+
+		CASE(OP_LINE):
+			J->frames[J->frametop].line = *pc++;
+			NEXT;
 		}
 	}
-}
+
+#undef CASE
+#undef NEXT
+#undef SAFEPOINT
+#undef LOADFUNCTION
+#undef JUMPIF
+#undef INT2
+#undef NUM2
+#undef NUMBER
+#undef IX
+#undef IY
+#undef DENSEKEY
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#if JS_THREADED
+#pragma GCC diagnostic pop
+#endif
@@ -2,14 +2,26 @@
 #define js_run_h
 
 js_Environment *jsR_newenvironment(js_State *J, js_Object *variables, js_Environment *outer);
+void jsR_freeoldstacks(js_State *J);
+#ifdef JS_OPSTATS
+void jsR_dumpopstats(void);
+#endif
 
+/*
+ * An environment is either an object holding the variables by name, or
+ * the record of a lightweight function holding its captured variables in
+ * the slots named by function->envtab.
+ */
 struct js_Environment
 {
 	js_Environment *outer;
-	js_Object *variables;
+	js_Object *variables; /* NULL for a record */
+	js_Function *function;
 
 	js_Environment *gcnext;
 	int gcmark;
+
+	js_Value slots[1];
 };
 
 #endif
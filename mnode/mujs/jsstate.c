@@ -72,8 +72,9 @@ void js_loadstring(js_State *J, const char *filename, const char *source)
 
 void js_loadfile(js_State *J, const char *filename)
 {
+	js_String *s = jsV_newscratch(J, 0); /* the collector frees it, even if loading fails */
 	FILE *f;
-	char *s;
+	char *p;
 	int n, t;
 
 	f = fopen(filename, "rb");
@@ -97,32 +98,26 @@ void js_loadfile(js_State *J, const char *filename)
 		js_error(J, "cannot seek in file: '%s'", filename);
 	}
 
-	s = js_malloc(J, n + 1); /* add space for string terminator */
-	if (!s) {
+	p = J->alloc(J->actx, s->p, n + 1); /* add space for string terminator */
+	if (!p) {
 		fclose(f);
 		js_error(J, "cannot allocate storage for file contents: '%s'", filename);
 	}
+	s->p = p;
 
-	t = fread(s, 1, n, f);
+	t = fread(s->p, 1, n, f);
+	fclose(f);
 	if (t != n) {
-		js_free(J, s);
-		fclose(f);
 		js_error(J, "cannot read data from file: '%s'", filename);
 	}
 
-	s[n] = 0; /* zero-terminate string containing file data */
+	s->p[n] = 0; /* zero-terminate string containing file data */
 
-	if (js_try(J)) {
-		js_free(J, s);
-		fclose(f);
-		js_throw(J);
-	}
-
-	js_loadstring(J, filename, s);
+	js_loadstring(J, filename, s->p);
 
-	js_free(J, s);
-	fclose(f);
-	js_endtry(J);
+	/* the compiled function does not need the text; free it now, not at the next collection */
+	J->alloc(J->actx, s->p, 0);
+	s->p = s->u.text;
 }
 
 int js_dostring(js_State *J, const char *source, int report)
@@ -175,7 +170,7 @@ void *js_getcontext(js_State *J)
 	return J->uctx;
 }
 
-js_State *js_newstate(js_Alloc alloc, void *actx, int flags)
+js_State *js_newstate(js_Alloc alloc, void *actx, int flags, const js_Options *options)
 {
 	js_State *J;
 
@@ -195,21 +190,46 @@ js_State *js_newstate(js_Alloc alloc, void *actx, int flags)
 	if (flags & JS_STRICT)
 		J->strict = 1;
 
-	J->trace[0].name = "?";
-	J->trace[0].file = "[C]";
-	J->trace[0].line = 0;
-
 	J->panic = js_defaultpanic;
 
-	J->stack = alloc(actx, NULL, JS_STACKSIZE * sizeof *J->stack);
+	J->stacksize = JS_STACKSIZE;
+	J->stacklimit = JS_STACKLIMIT;
+	J->framelimit = JS_FRAMELIMIT;
+	J->trylimit = JS_TRYLIMIT;
+	if (options) {
+		if (options->stacksize > 0) J->stacksize = options->stacksize;
+		if (options->stacklimit > 0) J->stacklimit = options->stacklimit;
+		if (options->framelimit > 0) J->framelimit = options->framelimit;
+		if (options->trylimit > 0) J->trylimit = options->trylimit;
+	}
+	if (J->stacksize > J->stacklimit)
+		J->stacksize = J->stacklimit;
+
+	J->stack = alloc(actx, NULL, J->stacksize * sizeof *J->stack);
 	if (!J->stack) {
 		alloc(actx, NULL, 0);
 		return NULL;
 	}
 
+	J->framecap = J->framelimit < JS_FRAMES ? J->framelimit : JS_FRAMES;
+	J->frames = alloc(actx, NULL, J->framecap * sizeof *J->frames);
+	if (!J->frames) {
+		alloc(actx, J->stack, 0);
+		alloc(actx, J, 0);
+		return NULL;
+	}
+	memset(J->frames, 0, sizeof *J->frames);
+	J->frames[0].name = "?";
+	J->frames[0].file = "[C]";
+
 	J->gcmark = 1;
 	J->nextref = 0;
 
+	jsS_initatoms(J);
+
+	J->emptyshape = jsV_newshape(J, NULL, "", 0);
+	J->strcache = js_malloc(J, sizeof *J->strcache);
+
 	J->R = jsV_newobject(J, JS_COBJECT, NULL);
 	J->G = jsV_newobject(J, JS_COBJECT, NULL);
 	J->E = jsR_newenvironment(J, J->G, NULL);
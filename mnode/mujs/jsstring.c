@@ -36,16 +36,16 @@ const char *js_utfidxtoptr(const char *s, int i)
 
 int js_utfptrtoidx(const char *s, const char *p)
 {
-	Rune rune;
-	int i = 0;
-	while (s < p) {
-		if (*(unsigned char *)s < Runeself)
-			++s;
-		else
-			s += chartorune(&rune, s);
-		++i;
+	return jsV_countrunes(s, p);
+}
+
+/* Convert a value to a string in place, so its lengths can be looked up later. */
+static void checkstring(js_State *J, int idx)
+{
+	if (!js_isstring(J, idx)) {
+		js_pushstring(J, js_tostring(J, idx));
+		js_replace(J, idx);
 	}
-	return i;
 }
 
 static void jsB_new_String(js_State *J)
@@ -75,9 +75,11 @@ static void Sp_valueOf(js_State *J)
 static void Sp_charAt(js_State *J)
 {
 	char buf[UTFmax + 1];
-	const char *s = js_tostring(J, 0);
-	int pos = js_tointeger(J, 1);
-	Rune rune = js_runeat(J, s, pos);
+	int pos;
+	Rune rune;
+	checkstring(J, 0);
+	pos = js_tointeger(J, 1);
+	rune = pos < 0 ? 0 : jsV_runeat(J, jsV_strinfo(J, js_tovalue(J, 0)), pos);
 	if (rune > 0) {
 		buf[runetochar(buf, &rune)] = 0;
 		js_pushstring(J, buf);
@@ -88,9 +90,11 @@ static void Sp_charAt(js_State *J)
 
 static void Sp_charCodeAt(js_State *J)
 {
-	const char *s = js_tostring(J, 0);
-	int pos = js_tointeger(J, 1);
-	Rune rune = js_runeat(J, s, pos);
+	int pos;
+	Rune rune;
+	checkstring(J, 0);
+	pos = js_tointeger(J, 1);
+	rune = pos < 0 ? 0 : jsV_runeat(J, jsV_strinfo(J, js_tovalue(J, 0)), pos);
 	if (rune > 0)
 		js_pushnumber(J, rune);
 	else
@@ -100,69 +104,59 @@ static void Sp_charCodeAt(js_State *J)
 static void Sp_concat(js_State *J)
 {
 	unsigned int i, top = js_gettop(J);
-	unsigned int n;
-	char * volatile out;
-	const char *s;
+	unsigned int n, m;
+	js_Builder sb;
 
 	if (top == 1)
 		return;
 
-	s = js_tostring(J, 0);
-	n = strlen(s);
-	out = js_malloc(J, n + 1);
-	strcpy(out, s);
-
-	if (js_try(J)) {
-		js_free(J, out);
-		js_throw(J);
-	}
-
-	for (i = 1; i < top; ++i) {
-		s = js_tostring(J, i);
-		n += strlen(s);
-		out = realloc(out, n + 1);
-		strcat(out, s);
+	/* convert everything first, so the result is allocated once */
+	n = 0;
+	for (i = 0; i < top; ++i) {
+		m = strlen(js_tostring(J, i));
+		if (n + m < n)
+			js_rangeerror(J, "invalid string length");
+		n += m;
 	}
 
-	js_pushstring(J, out);
-	js_endtry(J);
-	js_free(J, out);
+	jsV_newbuilder(J, &sb, n);
+	for (i = 0; i < top; ++i)
+		jsV_puts(J, &sb, js_tostring(J, i));
+	jsV_endbuilder(J, &sb);
 }
 
 static void Sp_indexOf(js_State *J)
 {
-	const char *haystack = js_tostring(J, 0);
-	const char *needle = js_tostring(J, 1);
-	int pos = js_tointeger(J, 2);
-	int len = strlen(needle);
-	int k = 0;
-	Rune rune;
-	while (*haystack) {
-		if (k >= pos && !strncmp(haystack, needle, len)) {
-			js_pushnumber(J, k);
-			return;
-		}
-		haystack += chartorune(&rune, haystack);
-		++k;
-	}
-	js_pushnumber(J, -1);
+	js_String *str;
+	const char *needle, *p;
+	int pos;
+
+	checkstring(J, 0);
+	needle = js_tostring(J, 1);
+	pos = js_tointeger(J, 2);
+	str = jsV_strinfo(J, js_tovalue(J, 0));
+
+	pos = pos < 0 ? 0 : (unsigned int)pos > str->runes ? (int)str->runes : pos;
+	p = jsV_runeptr(J, str, pos);
+	p = jsV_search(p, str->length - (p - str->p), needle, strlen(needle));
+	js_pushnumber(J, p ? (int)jsV_runeidx(J, str, p) : -1);
 }
 
 static void Sp_lastIndexOf(js_State *J)
 {
-	const char *haystack = js_tostring(J, 0);
-	const char *needle = js_tostring(J, 1);
-	int pos = js_isdefined(J, 2) ? js_tointeger(J, 2) : strlen(haystack);
-	int len = strlen(needle);
-	int k = 0, last = -1;
-	Rune rune;
-	while (*haystack && k <= pos) {
-		if (!strncmp(haystack, needle, len))
-			last = k;
-		haystack += chartorune(&rune, haystack);
-		++k;
-	}
-	js_pushnumber(J, last);
+	js_String *str;
+	const char *needle, *p;
+	int pos;
+
+	checkstring(J, 0);
+	needle = js_tostring(J, 1);
+	pos = js_isdefined(J, 2) ? js_tointeger(J, 2) : INT_MAX;
+	str = jsV_strinfo(J, js_tovalue(J, 0));
+
+	pos = pos < 0 ? 0 : (unsigned int)pos > str->runes ? (int)str->runes : pos;
+	p = jsV_runeptr(J, str, pos);
+	p = jsV_rsearch(str->p, str->length, p - str->p, needle, strlen(needle));
+	js_pushnumber(J, p ? (int)jsV_runeidx(J, str, p) : -1);
 }
 
 static void Sp_localeCompare(js_State *J)
@@ -174,11 +168,15 @@ static void Sp_localeCompare(js_State *J)
 
 static void Sp_slice(js_State *J)
 {
-	const char *str = js_tostring(J, 0);
+	js_String *str;
 	const char *ss, *ee;
-	int len = utflen(str);
-	int s = js_tointeger(J, 1);
-	int e = js_isdefined(J, 2) ? js_tointeger(J, 2) : len;
+	int len, s, e;
+
+	checkstring(J, 0);
+	s = js_tointeger(J, 1);
+	e = js_isdefined(J, 2) ? js_tointeger(J, 2) : INT_MAX;
+	str = jsV_strinfo(J, js_tovalue(J, 0));
+	len = str->runes;
 
 	s = s < 0 ? s + len : s;
 	e = e < 0 ? e + len : e;
@@ -187,11 +185,11 @@ static void Sp_slice(js_State *J)
 	e = e < 0 ? 0 : e > len ? len : e;
 
 	if (s < e) {
-		ss = js_utfidxtoptr(str, s);
-		ee = js_utfidxtoptr(ss, e - s);
+		ss = jsV_runeptr(J, str, s);
+		ee = jsV_runeptr(J, str, e);
 	} else {
-		ss = js_utfidxtoptr(str, e);
-		ee = js_utfidxtoptr(ss, s - e);
+		ss = jsV_runeptr(J, str, e);
+		ee = jsV_runeptr(J, str, s);
 	}
 
 	js_pushlstring(J, ss, ee - ss);
@@ -199,68 +197,64 @@ static void Sp_slice(js_State *J)
 
 static void Sp_substring(js_State *J)
 {
-	const char *str = js_tostring(J, 0);
+	js_String *str;
 	const char *ss, *ee;
-	int len = utflen(str);
-	int s = js_tointeger(J, 1);
-	int e = js_isdefined(J, 2) ? js_tointeger(J, 2) : len;
+	int len, s, e;
+
+	checkstring(J, 0);
+	s = js_tointeger(J, 1);
+	e = js_isdefined(J, 2) ? js_tointeger(J, 2) : INT_MAX;
+	str = jsV_strinfo(J, js_tovalue(J, 0));
+	len = str->runes;
 
 	s = s < 0 ? 0 : s > len ? len : s;
 	e = e < 0 ? 0 : e > len ? len : e;
 
 	if (s < e) {
-		ss = js_utfidxtoptr(str, s);
-		ee = js_utfidxtoptr(ss, e - s);
+		ss = jsV_runeptr(J, str, s);
+		ee = jsV_runeptr(J, str, e);
 	} else {
-		ss = js_utfidxtoptr(str, e);
-		ee = js_utfidxtoptr(ss, s - e);
+		ss = jsV_runeptr(J, str, e);
+		ee = jsV_runeptr(J, str, s);
 	}
 
 	js_pushlstring(J, ss, ee - ss);
 }
 
-static void Sp_toLowerCase(js_State *J)
+/* ASCII text maps byte for byte; other text may change length per character */
+static void convertcase(js_State *J, Rune (*convert)(Rune))
 {
-	const char *src = js_tostring(J, 0);
-	char *dst = js_malloc(J, UTFmax * strlen(src) + 1);
-	const char *s = src;
-	char *d = dst;
+	js_String *info;
+	js_Builder sb;
+	const char *s;
+	char buf[UTFmax];
 	Rune rune;
-	while (*s) {
-		s += chartorune(&rune, s);
-		rune = tolowerrune(rune);
-		d += runetochar(d, &rune);
-	}
-	*d = 0;
-	if (js_try(J)) {
-		js_free(J, dst);
-		js_throw(J);
+
+	checkstring(J, 0);
+	info = jsV_strinfo(J, js_tovalue(J, 0));
+	jsV_newbuilder(J, &sb, info->length);
+	s = js_tostring(J, 0);
+	if (info->ascii) {
+		while (*s)
+			jsV_putc(J, &sb, convert(*s++));
+	} else {
+		while (*s) {
+			s += chartorune(&rune, s);
+			rune = convert(rune);
+			jsV_putm(J, &sb, buf, buf + runetochar(buf, &rune));
+		}
 	}
-	js_pushstring(J, dst);
-	js_endtry(J);
-	js_free(J, dst);
+	jsV_endbuilder(J, &sb);
+}
+
+static void Sp_toLowerCase(js_State *J)
+{
+	convertcase(J, tolowerrune);
 }
 
 static void Sp_toUpperCase(js_State *J)
 {
-	const char *src = js_tostring(J, 0);
-	char *dst = js_malloc(J, UTFmax * strlen(src) + 1);
-	const char *s = src;
-	char *d = dst;
-	Rune rune;
-	while (*s) {
-		s += chartorune(&rune, s);
-		rune = toupperrune(rune);
-		d += runetochar(d, &rune);
-	}
-	*d = 0;
-	if (js_try(J)) {
-		js_free(J, dst);
-		js_throw(J);
-	}
-	js_pushstring(J, dst);
-	js_endtry(J);
-	js_free(J, dst);
+	convertcase(J, toupperrune);
 }
 
 static int istrim(int c)
@@ -284,25 +278,16 @@ static void Sp_trim(js_State *J)
 static void S_fromCharCode(js_State *J)
 {
 	unsigned int i, top = js_gettop(J);
+	js_Builder sb;
+	char buf[UTFmax];
 	Rune c;
-	char *s, *p;
-
-	s = p = js_malloc(J, (top-1) * UTFmax + 1);
-
-	if (js_try(J)) {
-		js_free(J, s);
-		js_throw(J);
-	}
 
+	jsV_newbuilder(J, &sb, (top - 1) * UTFmax); /* before a valueOf runs script code */
 	for (i = 1; i < top; ++i) {
 		c = js_touint16(J, i);
-		p += runetochar(p, &c);
+		jsV_putm(J, &sb, buf, buf + runetochar(buf, &c));
 	}
-	*p = 0;
-	js_pushstring(J, s);
-
-	js_endtry(J);
-	js_free(J, s);
+	jsV_endbuilder(J, &sb);
 }
 
 static void Sp_match(js_State *J)
@@ -378,7 +363,7 @@ static void Sp_replace_regexp(js_State *J)
 {
 	js_Regexp *re;
 	const char *source, *s, *r;
-	js_Buffer *sb = NULL;
+	js_Builder sb;
 	unsigned int n, x;
 	Resub m;
 
@@ -392,6 +377,8 @@ static void Sp_replace_regexp(js_State *J)
 
 	re->last = 0;
 
+	jsV_newbuilder(J, &sb, strlen(source));
+
 loop:
 	s = m.sub[0].sp;
 	n = m.sub[0].ep - m.sub[0].sp;
@@ -405,20 +392,20 @@ loop:
 		js_copy(J, 0); /* arg x+3: search string */
 		js_call(J, 2 + x);
 		r = js_tostring(J, -1);
-		js_putm(J, &sb, source, s);
-		js_puts(J, &sb, r);
+		jsV_putm(J, &sb, source, s);
+		jsV_puts(J, &sb, r);
 		js_pop(J, 1);
 	} else {
 		r = js_tostring(J, 2);
-		js_putm(J, &sb, source, s);
+		jsV_putm(J, &sb, source, s);
 		while (*r) {
 			if (*r == '$') {
 				switch (*(++r)) {
-				case '$': js_putc(J, &sb, '$'); break;
-				case '`': js_putm(J, &sb, source, s); break;
-				case '\'': js_puts(J, &sb, s + n); break;
+				case '$': jsV_putc(J, &sb, '$'); break;
+				case '`': jsV_putm(J, &sb, source, s); break;
+				case '\'': jsV_puts(J, &sb, s + n); break;
 				case '&':
-					js_putm(J, &sb, s, s + n);
+					jsV_putm(J, &sb, s, s + n);
 					break;
 				case '0': case '1': case '2': case '3': case '4':
 				case '5': case '6': case '7': case '8': case '9':
@@ -426,25 +413,25 @@ loop:
 					if (r[1] >= '0' && r[1] <= '9')
 						x = x * 10 + *(++r) - '0';
 					if (x > 0 && x < m.nsub) {
-						js_putm(J, &sb, m.sub[x].sp, m.sub[x].ep);
+						jsV_putm(J, &sb, m.sub[x].sp, m.sub[x].ep);
 					} else {
-						js_putc(J, &sb, '$');
+						jsV_putc(J, &sb, '$');
 						if (x > 10) {
-							js_putc(J, &sb, '0' + x / 10);
-							js_putc(J, &sb, '0' + x % 10);
+							jsV_putc(J, &sb, '0' + x / 10);
+							jsV_putc(J, &sb, '0' + x % 10);
 						} else {
-							js_putc(J, &sb, '0' + x);
+							jsV_putc(J, &sb, '0' + x);
 						}
 					}
 					break;
 				default:
-					js_putc(J, &sb, '$');
-					js_putc(J, &sb, *r);
+					jsV_putc(J, &sb, '$');
+					jsV_putc(J, &sb, *r);
 					break;
 				}
 				++r;
 			} else {
-				js_putc(J, &sb, *r++);
+				jsV_putc(J, &sb, *r++);
 			}
 		}
 	}
@@ -453,7 +440,7 @@ loop:
 		source = m.sub[0].ep;
 		if (n == 0) {
 			if (*source)
-				js_putc(J, &sb, *source++);
+				jsV_putc(J, &sb, *source++);
 			else
 				goto end;
 		}
@@ -462,33 +449,27 @@ loop:
 	}
 
 end:
-	js_puts(J, &sb, s + n);
-	js_putc(J, &sb, 0);
-
-	if (js_try(J)) {
-		js_free(J, sb);
-		js_throw(J);
-	}
-	js_pushstring(J, sb ? sb->s : "");
-	js_endtry(J);
-	js_free(J, sb);
+	jsV_puts(J, &sb, s + n);
+	jsV_endbuilder(J, &sb);
 }
 
 static void Sp_replace_string(js_State *J)
 {
 	const char *source, *needle, *s, *r;
-	js_Buffer *sb = NULL;
+	js_Builder sb;
 	int n;
 
 	source = js_tostring(J, 0);
 	needle = js_tostring(J, 1);
+	n = strlen(needle);
 
-	s = strstr(source, needle);
+	s = jsV_search(source, strlen(source), needle, n);
 	if (!s) {
 		js_copy(J, 0);
 		return;
 	}
-	n = strlen(needle);
+
+	jsV_newbuilder(J, &sb, strlen(source));
 
 	if (js_iscallable(J, 2)) {
 		js_copy(J, 2);
@@ -498,39 +479,31 @@ static void Sp_replace_string(js_State *J)
 		js_copy(J, 0); /* arg 3: search string */
 		js_call(J, 3);
 		r = js_tostring(J, -1);
-		js_putm(J, &sb, source, s);
-		js_puts(J, &sb, r);
-		js_puts(J, &sb, s + n);
-		js_putc(J, &sb, 0);
+		jsV_putm(J, &sb, source, s);
+		jsV_puts(J, &sb, r);
+		jsV_puts(J, &sb, s + n);
 		js_pop(J, 1);
 	} else {
 		r = js_tostring(J, 2);
-		js_putm(J, &sb, source, s);
+		jsV_putm(J, &sb, source, s);
 		while (*r) {
 			if (*r == '$') {
 				switch (*(++r)) {
-				case '$': js_putc(J, &sb, '$'); break;
-				case '&': js_putm(J, &sb, s, s + n); break;
-				case '`': js_putm(J, &sb, source, s); break;
-				case '\'': js_puts(J, &sb, s + n); break;
-				default: js_putc(J, &sb, '$'); js_putc(J, &sb, *r); break;
+				case '$': jsV_putc(J, &sb, '$'); break;
+				case '&': jsV_putm(J, &sb, s, s + n); break;
+				case '`': jsV_putm(J, &sb, source, s); break;
+				case '\'': jsV_puts(J, &sb, s + n); break;
+				default: jsV_putc(J, &sb, '$'); jsV_putc(J, &sb, *r); break;
 				}
 				++r;
 			} else {
-				js_putc(J, &sb, *r++);
+				jsV_putc(J, &sb, *r++);
 			}
 		}
-		js_puts(J, &sb, s + n);
-		js_putc(J, &sb, 0);
+		jsV_puts(J, &sb, s + n);
 	}
 
-	if (js_try(J)) {
-		js_free(J, sb);
-		js_throw(J);
-	}
-	js_pushstring(J, sb ? sb->s : "");
-	js_endtry(J);
-	js_free(J, sb);
+	jsV_endbuilder(J, &sb);
 }
 
 static void Sp_replace(js_State *J)
@@ -606,10 +579,12 @@ static void Sp_split_string(js_State *J)
 	const char *sep = js_tostring(J, 1);
 	unsigned int limit = js_isdefined(J, 2) ? js_touint32(J, 2) : 1 << 30;
 	unsigned int i, n;
+	const char *e;
 
 	js_newarray(J);
 
 	n = strlen(sep);
+	e = str + strlen(str);
 
 	/* empty string */
 	if (n == 0) {
@@ -624,7 +599,7 @@ static void Sp_split_string(js_State *J)
 	}
 
 	for (i = 0; str && i < limit; ++i) {
-		const char *s = strstr(str, sep);
+		const char *s = jsV_search(str, e - str, sep, n);
 		if (s) {
 			js_pushlstring(J, str, s-str);
 			js_setindex(J, -2, i);
@@ -652,7 +627,7 @@ static void Sp_split(js_State *J)
 
 void jsB_initstring(js_State *J)
 {
-	J->String_prototype->u.s.string = "";
+	J->String_prototype->u.s.string = js_intern(J, "");
 	J->String_prototype->u.s.length = 0;
 
 	js_pushobject(J, J->String_prototype);
@@ -4,8 +4,9 @@
 #include "jsvalue.h"
 #include "utf.h"
 
-#define JSV_ISSTRING(v) (v->type==JS_TSHRSTR || v->type==JS_TMEMSTR || v->type==JS_TLITSTR)
-#define JSV_TOSTRING(v) (v->type==JS_TSHRSTR ? v->u.shrstr : v->type==JS_TLITSTR ? v->u.litstr : v->type==JS_TMEMSTR ? v->u.memstr->p : "")
+#define JSV_TOSTRING(v) (v->type==JS_TSHRSTR ? v->u.shrstr : v->type==JS_TLITSTR ? v->u.litstr : v->type==JS_TMEMSTR ? JSV_MEMSTR(J, v->u.memstr) : "")
+
+#define JS_ROPEMIN 64 /* concatenations shorter than this are copied flat */
 
 double jsV_numbertointeger(double n)
 {
@@ -20,6 +21,8 @@ int jsV_numbertoint32(double n)
 	double two32 = 4294967296.0;
 	double two31 = 2147483648.0;
 
+	if (n >= INT_MIN && n <= INT_MAX)
+		return n;
 	if (!isfinite(n) || n == 0)
 		return 0;
 
@@ -50,7 +53,7 @@ unsigned short jsV_numbertouint16(double n)
 static int jsV_toString(js_State *J, js_Object *obj)
 {
 	js_pushobject(J, obj);
-	js_getproperty(J, -1, "toString");
+	js_getpropertyatom(J, -1, JS_ATOM(J, toString));
 	if (js_iscallable(J, -1)) {
 		js_rot2(J);
 		js_call(J, 0);
@@ -67,7 +70,7 @@ static int jsV_toString(js_State *J, js_Object *obj)
 static int jsV_valueOf(js_State *J, js_Object *obj)
 {
 	js_pushobject(J, obj);
-	js_getproperty(J, -1, "valueOf");
+	js_getpropertyatom(J, -1, JS_ATOM(J, valueOf));
 	if (js_iscallable(J, -1)) {
 		js_rot2(J);
 		js_call(J, 0);
@@ -80,36 +83,41 @@ static int jsV_valueOf(js_State *J, js_Object *obj)
 	return 0;
 }
 
-/* ToPrimitive() on a value */
-void jsV_toprimitive(js_State *J, js_Value *v, int preferred)
+/*
+ * ToPrimitive() on a value, in place. The stack may move while valueOf
+ * or toString run, so if v is a stack slot the pointer to where it is
+ * now is returned.
+ */
+js_Value *jsV_toprimitive(js_State *J, js_Value *v, int preferred)
 {
 	js_Object *obj;
+	int idx, okay;
 
 	if (v->type != JS_TOBJECT)
-		return;
+		return v;
 
 	obj = v->u.object;
+	idx = v >= J->stack && v < J->stack + J->top ? v - J->stack : -1;
 
 	if (preferred == JS_HNONE)
 		preferred = obj->type == JS_CDATE ? JS_HSTRING : JS_HNUMBER;
 
-	if (preferred == JS_HSTRING) {
-		if (jsV_toString(J, obj) || jsV_valueOf(J, obj)) {
-			*v = *js_tovalue(J, -1);
-			js_pop(J, 1);
-			return;
-		}
+	if (preferred == JS_HSTRING)
+		okay = jsV_toString(J, obj) || jsV_valueOf(J, obj);
+	else
+		okay = jsV_valueOf(J, obj) || jsV_toString(J, obj);
+
+	if (idx >= 0)
+		v = J->stack + idx;
+
+	if (okay) {
+		*v = *js_tovalue(J, -1);
+		js_pop(J, 1);
 	} else {
-		if (jsV_valueOf(J, obj) || jsV_toString(J, obj)) {
-			*v = *js_tovalue(J, -1);
-			js_pop(J, 1);
-			return;
-		}
+		v->type = JS_TLITSTR;
+		v->u.litstr = "[object]";
 	}
-
-	v->type = JS_TLITSTR;
-	v->u.litstr = "[object]";
-	return;
+	return v;
 }
 
 /* ToBoolean() on a value */
@@ -122,8 +130,9 @@ int jsV_toboolean(js_State *J, js_Value *v)
 	case JS_TNULL: return 0;
 	case JS_TBOOLEAN: return v->u.boolean;
 	case JS_TNUMBER: return v->u.number != 0 && !isnan(v->u.number);
+	case JS_TINT32: return v->u.integer != 0;
 	case JS_TLITSTR: return v->u.litstr[0] != 0;
-	case JS_TMEMSTR: return v->u.memstr->p[0] != 0;
+	case JS_TMEMSTR: return v->u.memstr->length != 0;
 	case JS_TOBJECT: return 1;
 	}
 }
@@ -203,11 +212,11 @@ double jsV_tonumber(js_State *J, js_Value *v)
 	case JS_TNULL: return 0;
 	case JS_TBOOLEAN: return v->u.boolean;
 	case JS_TNUMBER: return v->u.number;
+	case JS_TINT32: return v->u.integer;
 	case JS_TLITSTR: return jsV_stringtonumber(J, v->u.litstr);
-	case JS_TMEMSTR: return jsV_stringtonumber(J, v->u.memstr->p);
+	case JS_TMEMSTR: return jsV_stringtonumber(J, JSV_MEMSTR(J, v->u.memstr));
 	case JS_TOBJECT:
-		jsV_toprimitive(J, v, JS_HNUMBER);
-		return jsV_tonumber(J, v);
+		return jsV_tonumber(J, jsV_toprimitive(J, v, JS_HNUMBER));
 	}
 }
 
@@ -267,11 +276,370 @@ const char *jsV_numbertostring(js_State *J, char buf[32], double f)
 	return buf;
 }
 
+/* Copy the text of a rope to p. Recurse into the shorter half and loop on the
+ * longer one, so the C stack stays logarithmic in the length. */
+static void jsV_copyrope(char *p, js_String *s)
+{
+	while (!s->p) {
+		js_String *left = s->u.rope.left;
+		js_String *right = s->u.rope.right;
+		if (left->length < right->length) {
+			jsV_copyrope(p, left);
+			p += left->length;
+			s = right;
+		} else {
+			jsV_copyrope(p + left->length, right);
+			s = left;
+		}
+	}
+	memcpy(p, s->p, s->length);
+}
+
+/* Flatten a rope in place and drop the references to its halves. */
+const char *jsV_flatten(js_State *J, js_String *s)
+{
+	char *p = js_malloc(J, s->length + 1);
+	jsV_copyrope(p, s);
+	p[s->length] = 0;
+	s->p = p;
+	s->u.rope.left = s->u.rope.right = NULL;
+	return p;
+}
+
+/* Text is scanned a word at a time where it is plain ASCII. */
+
+#define ONES ((size_t)-1 / 0xFF)
+#define HIGHBITS (ONES * 0x80)
+
+/* Skip the ASCII bytes from s, up to e. */
+const char *jsV_skipascii(const char *s, const char *e)
+{
+	size_t w;
+	while (e - s >= (ptrdiff_t)sizeof w) {
+		memcpy(&w, s, sizeof w);
+		if (w & HIGHBITS)
+			break;
+		s += sizeof w;
+	}
+	while (s < e && *(const unsigned char *)s < Runeself)
+		++s;
+	return s;
+}
+
+/* Count the characters of the text from s to e. */
+unsigned int jsV_countrunes(const char *s, const char *e)
+{
+	unsigned int n = 0;
+	const char *q;
+	Rune rune;
+	while (s < e) {
+		q = jsV_skipascii(s, e);
+		n += q - s;
+		s = q;
+		if (s < e) {
+			s += chartorune(&rune, s);
+			++n;
+		}
+	}
+	return n;
+}
+
+/* Step back over the character that ends at p, as decoding forward from s
+ * would have read it: bytes that do not decode together count one by one. */
+static const char *prevrune(const char *s, const char *p)
+{
+	const char *q = p - 1;
+	Rune rune;
+	if (*(const unsigned char *)q < Runeself)
+		return q;
+	while (q > s && p - q < UTFmax && (*(const unsigned char *)q & 0xC0) == 0x80)
+		--q;
+	if (q + chartorune(&rune, q) == p)
+		return q;
+	return p - 1;
+}
+
+/* Count the characters of flat text and note whether it is plain ASCII. */
+void jsV_measurestring(js_String *s)
+{
+	const char *e = s->p + s->length;
+	const char *p = jsV_skipascii(s->p, e);
+	s->ascii = p == e;
+	s->runes = (p - s->p) + jsV_countrunes(p, e);
+}
+
+static js_Cursor *jsV_findcursor(js_State *J, js_String *s)
+{
+	int i;
+	for (i = 0; i < JS_CURSORS; ++i)
+		if (J->cursors[i].str == s)
+			return &J->cursors[i];
+	return NULL;
+}
+
+/* Move the cursor of s to the front, replacing the least recently used. */
+static js_Cursor *jsV_usecursor(js_State *J, js_String *s)
+{
+	js_Cursor *c = J->cursors;
+	js_Cursor use;
+	int i;
+	for (i = 0; i < JS_CURSORS - 1; ++i)
+		if (c[i].str == s)
+			break;
+	use = c[i];
+	if (use.str != s) {
+		use.str = s;
+		use.index = use.offset = 0;
+	}
+	memmove(c + 1, c, i * sizeof *c);
+	c[0] = use;
+	return c;
+}
+
+/* Forget the last lookup in s, before its text changes. */
+static void jsV_dropcursor(js_State *J, js_String *s)
+{
+	js_Cursor *c = jsV_findcursor(J, s);
+	if (c)
+		c->str = NULL;
+}
+
+/* Measure a literal string; the last one is cached until the next collection. */
+js_String *jsV_literalinfo(js_State *J, const char *s)
+{
+	js_String *info = J->strcache;
+	if (J->strkey != s) {
+		jsV_dropcursor(J, info);
+		info->p = (char *)s;
+		info->length = strlen(s);
+		jsV_measurestring(info);
+		J->strkey = s;
+	}
+	return info;
+}
+
+/* Lengths of a string value. Heap strings carry their own; short strings live
+ * in the value and are measured on every call. */
+js_String *jsV_strinfo(js_State *J, js_Value *v)
+{
+	js_String *info;
+	if (v->type == JS_TMEMSTR)
+		return v->u.memstr;
+	if (v->type == JS_TLITSTR)
+		return jsV_literalinfo(J, v->u.litstr);
+	info = J->strcache;
+	jsV_dropcursor(J, info);
+	info->p = v->u.shrstr;
+	info->length = strlen(v->u.shrstr);
+	jsV_measurestring(info);
+	J->strkey = NULL;
+	return info;
+}
+
+/* Pointer to character i (0 <= i <= runes). ASCII text is indexed directly;
+ * otherwise walk from the start or from the last lookup, whichever is nearer. */
+const char *jsV_runeptr(js_State *J, js_String *s, unsigned int i)
+{
+	const char *p = s->p ? s->p : jsV_flatten(J, s);
+	const char *e = p + s->length;
+	unsigned int k = 0;
+	const char *q;
+	js_Cursor *c;
+	Rune rune;
+
+	if (s->ascii)
+		return p + i;
+
+	c = jsV_usecursor(J, s);
+	if (i >= c->index) {
+		k = c->index;
+		p += c->offset;
+	} else if (c->index - i < i) {
+		k = c->index;
+		p += c->offset;
+		while (k > i) {
+			p = prevrune(s->p, p);
+			--k;
+		}
+	}
+	while (k < i) {
+		q = jsV_skipascii(p, (unsigned int)(e - p) > i - k ? p + (i - k) : e);
+		k += q - p;
+		p = q;
+		if (k < i) {
+			p += chartorune(&rune, p);
+			++k;
+		}
+	}
+	c->index = i;
+	c->offset = p - s->p;
+	return p;
+}
+
+/* Character i, or 0 if it is out of range. */
+int jsV_runeat(js_State *J, js_String *s, unsigned int i)
+{
+	Rune rune;
+	if (i >= s->runes)
+		return 0;
+	chartorune(&rune, jsV_runeptr(J, s, i));
+	return rune;
+}
+
+/* Character index of a pointer into the flat text of s. The count is taken
+ * from the last lookup when that is nearer, which a character start allows. */
+unsigned int jsV_runeidx(js_State *J, js_String *s, const char *p)
+{
+	js_Cursor *c;
+	const char *q;
+	if (s->ascii)
+		return p - s->p;
+	c = jsV_findcursor(J, s);
+	if (!c)
+		return jsV_countrunes(s->p, p);
+	q = s->p + c->offset;
+	if (p >= q)
+		return c->index + jsV_countrunes(q, p);
+	if (q - p < p - s->p && (*(const unsigned char *)p & 0xC0) != 0x80)
+		return c->index - jsV_countrunes(p, q);
+	return jsV_countrunes(s->p, p);
+}
+
+/* Substring search */
+
+/*
+ * Text that runs on to the end of a string is searched with strstr, which
+ * the C library vectorises. A bounded stretch of text is scanned with memchr
+ * for the byte of the needle that is least common in ordinary text, and the
+ * needle is checked around each hit. When the false hits cost more than the
+ * scanning, it goes on with a Horspool skip table instead.
+ */
+
+#define SEARCH_TABLE 256 /* cost of setting up the skip table, in bytes scanned */
+
+/* A rough rank of how common a byte is in text */
+static const unsigned char bytefreq[256] = {
+	[' '] = 3,
+	['0'] = 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	['A'] = 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	['a'] = 3, 2, 2, 2, 3, 2, 2, 2, 3, 2, 2, 2, 2, 3, 3, 2, 2, 3, 3, 3, 2, 2, 2, 2, 2, 2,
+};
+
+/* The position of the rarest byte of the needle */
+static unsigned int rarebyte(const char *needle, unsigned int n)
+{
+	unsigned int i, k = 0;
+	int f, best = bytefreq[(unsigned char)needle[0]];
+	for (i = 1; i < n && best > 0; ++i) {
+		f = bytefreq[(unsigned char)needle[i]];
+		if (f < best)
+			k = i, best = f;
+	}
+	return k;
+}
+
+/* Horspool search over the starts s..last */
+static const char *horspool(const char *s, const char *last, const char *needle, unsigned int n)
+{
+	unsigned int shift[256], i, k, end;
+	unsigned char c;
+
+	if (s > last)
+		return NULL;
+	end = last - s;
+	for (i = 0; i < 256; ++i)
+		shift[i] = n;
+	for (i = 0; i < n - 1; ++i)
+		shift[(unsigned char)needle[i]] = n - 1 - i;
+
+	for (k = 0; k <= end; k += shift[c]) {
+		c = s[k + n - 1];
+		if (c == (unsigned char)needle[n - 1] && !memcmp(s + k, needle, n - 1))
+			return s + k;
+	}
+	return NULL;
+}
+
+/* First occurrence of needle (n bytes) in the len bytes at s, or NULL */
+static const char *memsearch(const char *s, unsigned int len, const char *needle, unsigned int n)
+{
+	unsigned int j, misses = 0;
+	const char *p, *e;
+
+	if (n > len)
+		return NULL;
+	if (n == 0)
+		return s;
+	if (n == 1)
+		return memchr(s, needle[0], len);
+	j = rarebyte(needle, n);
+	p = s + j;
+	e = s + (len - n) + j + 1; /* where needle[j] can be */
+	while ((p = memchr(p, needle[j], e - p))) {
+		if (*(p - j) == needle[0] && !memcmp(p - j, needle, n))
+			return p - j;
+		/* a false hit costs about a needle's length of checking */
+		if (++misses * n > (unsigned int)(p - s) + SEARCH_TABLE)
+			return horspool(p - j + 1, s + (len - n), needle, n);
+		++p;
+	}
+	return NULL;
+}
+
+/* First occurrence of needle (a string of n bytes) in the len bytes at s,
+ * which end the string, or NULL. */
+const char *jsV_search(const char *s, unsigned int len, const char *needle, unsigned int n)
+{
+	if (n > len)
+		return NULL;
+	if (n == 1)
+		return memchr(s, needle[0], len);
+	return strstr(s, needle);
+}
+
+/* Last occurrence of needle (a string of n bytes) in the len bytes at s,
+ * which end the string, starting at or before s + pos, or NULL. The text is
+ * searched forward in windows that grow as they go back from pos. */
+const char *jsV_rsearch(const char *s, unsigned int len, unsigned int pos, const char *needle, unsigned int n)
+{
+	unsigned int a, b, k, next, w = 64;
+	const char *p, *last;
+
+	if (n > len)
+		return NULL;
+	if (pos > len - n)
+		pos = len - n;
+	if (n == 0)
+		return s + pos;
+
+	/* look for the starts in a..b-1; the first one after is at next */
+	for (b = next = pos + 1; ; b = a) {
+		/* strstr overruns each window, so take the rest once it is not much more */
+		a = b > w && b / 16 > pos + 1 - b ? b - w : 0;
+		last = NULL;
+		if (next - b > w) {
+			/* strstr would run far past the window */
+			for (k = a; k < b && (p = memsearch(s + k, b - k - 1 + n, needle, n)); k = p - s + 1)
+				last = p;
+		} else {
+			for (k = a; (p = strstr(s + k, needle)) && (unsigned int)(p - s) < b; k = p - s + 1)
+				last = p;
+			if (!last)
+				next = p ? p - s : len;
+		}
+		if (last || a == 0)
+			return last;
+		if (w < len)
+			w *= 2;
+	}
+}
+
 /* ToString() on a value */
 const char *jsV_tostring(js_State *J, js_Value *v)
 {
 	char buf[32];
 	const char *p;
+	int n;
 	switch (v->type) {
 	default:
 	case JS_TSHRSTR: return v->u.shrstr;
@@ -279,7 +647,14 @@ const char *jsV_tostring(js_State *J, js_Value *v)
 	case JS_TNULL: return "null";
 	case JS_TBOOLEAN: return v->u.boolean ? "true" : "false";
 	case JS_TLITSTR: return v->u.litstr;
-	case JS_TMEMSTR: return v->u.memstr->p;
+	case JS_TMEMSTR: return JSV_MEMSTR(J, v->u.memstr);
+	case JS_TINT32:
+		n = v->u.integer;
+		js_itoa(buf, n < 0 ? 0 - (unsigned int)n : (unsigned int)n);
+		v->u.shrstr[0] = '-';
+		strcpy(v->u.shrstr + (n < 0), buf);
+		v->type = JS_TSHRSTR;
+		return v->u.shrstr;
 	case JS_TNUMBER:
 		p = jsV_numbertostring(J, buf, v->u.number);
 		if (p == buf) {
@@ -298,8 +673,7 @@ const char *jsV_tostring(js_State *J, js_Value *v)
 		}
 		return p;
 	case JS_TOBJECT:
-		jsV_toprimitive(J, v, JS_HSTRING);
-		return jsV_tostring(J, v);
+		return jsV_tostring(J, jsV_toprimitive(J, v, JS_HSTRING));
 	}
 }
 
@@ -323,7 +697,7 @@ static js_Object *jsV_newstring(js_State *J, const char *v)
 {
 	js_Object *obj = jsV_newobject(J, JS_CSTRING, J->String_prototype);
 	obj->u.s.string = js_intern(J, v); /* TODO: js_String */
-	obj->u.s.length = utflen(v);
+	obj->u.s.length = jsV_literalinfo(J, obj->u.s.string)->runes;
 	return obj;
 }
 
@@ -337,8 +711,9 @@ js_Object *jsV_toobject(js_State *J, js_Value *v)
 	case JS_TNULL: js_typeerror(J, "cannot convert null to object");
 	case JS_TBOOLEAN: return jsV_newboolean(J, v->u.boolean);
 	case JS_TNUMBER: return jsV_newnumber(J, v->u.number);
+	case JS_TINT32: return jsV_newnumber(J, v->u.integer);
 	case JS_TLITSTR: return jsV_newstring(J, v->u.litstr);
-	case JS_TMEMSTR: return jsV_newstring(J, v->u.memstr->p);
+	case JS_TMEMSTR: return jsV_newstring(J, JSV_MEMSTR(J, v->u.memstr));
 	case JS_TOBJECT: return v->u.object;
 	}
 }
@@ -376,13 +751,13 @@ void js_newfunction(js_State *J, js_Function *fun, js_Environment *scope)
 	js_pushobject(J, obj);
 	{
 		js_pushnumber(J, fun->numparams);
-		js_defproperty(J, -2, "length", JS_READONLY | JS_DONTENUM | JS_DONTCONF);
+		js_defpropertyatom(J, -2, JS_ATOM(J, length), JS_READONLY | JS_DONTENUM | JS_DONTCONF);
 		js_newobject(J);
 		{
 			js_copy(J, -2);
-			js_defproperty(J, -2, "constructor", JS_DONTENUM);
+			js_defpropertyatom(J, -2, JS_ATOM(J, constructor), JS_DONTENUM);
 		}
-		js_defproperty(J, -2, "prototype", JS_DONTCONF);
+		js_defpropertyatom(J, -2, JS_ATOM(J, prototype), JS_DONTCONF);
 	}
 }
 
@@ -404,13 +779,13 @@ void js_newcfunction(js_State *J, js_CFunction cfun, const char *name, unsigned
 	js_pushobject(J, obj);
 	{
 		js_pushnumber(J, length);
-		js_defproperty(J, -2, "length", JS_READONLY | JS_DONTENUM | JS_DONTCONF);
+		js_defpropertyatom(J, -2, JS_ATOM(J, length), JS_READONLY | JS_DONTENUM | JS_DONTCONF);
 		js_newobject(J);
 		{
 			js_copy(J, -2);
-			js_defproperty(J, -2, "constructor", JS_DONTENUM);
+			js_defpropertyatom(J, -2, JS_ATOM(J, constructor), JS_DONTENUM);
 		}
-		js_defproperty(J, -2, "prototype", JS_DONTCONF);
+		js_defpropertyatom(J, -2, JS_ATOM(J, prototype), JS_DONTCONF);
 	}
 }
 
@@ -424,11 +799,11 @@ void js_newcconstructor(js_State *J, js_CFunction cfun, js_CFunction ccon, const
 	js_pushobject(J, obj); /* proto obj */
 	{
 		js_pushnumber(J, length);
-		js_defproperty(J, -2, "length", JS_READONLY | JS_DONTENUM | JS_DONTCONF);
+		js_defpropertyatom(J, -2, JS_ATOM(J, length), JS_READONLY | JS_DONTENUM | JS_DONTCONF);
 		js_rot2(J); /* obj proto */
 		js_copy(J, -2); /* obj proto obj */
-		js_defproperty(J, -2, "constructor", JS_DONTENUM);
-		js_defproperty(J, -2, "prototype", JS_READONLY | JS_DONTENUM | JS_DONTCONF);
+		js_defpropertyatom(J, -2, JS_ATOM(J, constructor), JS_DONTENUM);
+		js_defpropertyatom(J, -2, JS_ATOM(J, prototype), JS_READONLY | JS_DONTENUM | JS_DONTCONF);
 	}
 }
 
@@ -460,7 +835,7 @@ int js_instanceof(js_State *J)
 	if (!js_isobject(J, -2))
 		return 0;
 
-	js_getproperty(J, -1, "prototype");
+	js_getpropertyatom(J, -1, JS_ATOM(J, prototype));
 	if (!js_isobject(J, -1))
 		js_typeerror(J, "instanceof: 'prototype' property is not an object");
 	O = js_toobject(J, -1);
@@ -482,20 +857,59 @@ void js_concat(js_State *J)
 	js_toprimitive(J, -1, JS_HNONE);
 
 	if (js_isstring(J, -2) || js_isstring(J, -1)) {
-		const char *sa = js_tostring(J, -2);
-		const char *sb = js_tostring(J, -1);
-		/* TODO: create js_String directly */
-		char *sab = js_malloc(J, strlen(sa) + strlen(sb) + 1);
-		strcpy(sab, sa);
-		strcat(sab, sb);
-		if (js_try(J)) {
-			js_free(J, sab);
-			js_throw(J);
+		js_String *a = NULL, *b = NULL;
+		const char *sa = NULL, *sb = NULL;
+		unsigned int na, nb;
+		js_Value v;
+
+		/* take heap strings as they are; anything else is converted to flat text */
+		v = *js_tovalue(J, -2);
+		if (v.type == JS_TMEMSTR)
+			a = v.u.memstr, na = a->length;
+		else
+			sa = js_tostring(J, -2), na = strlen(sa);
+		v = *js_tovalue(J, -1);
+		if (v.type == JS_TMEMSTR)
+			b = v.u.memstr, nb = b->length;
+		else
+			sb = js_tostring(J, -1), nb = strlen(sb);
+		if (na + nb < na)
+			js_rangeerror(J, "invalid string length");
+
+		if (na + nb < JS_ROPEMIN) {
+			/* short result: copy both halves into one flat string */
+			char buf[JS_ROPEMIN];
+			memcpy(buf, a ? JSV_MEMSTR(J, a) : sa, na);
+			memcpy(buf + na, b ? JSV_MEMSTR(J, b) : sb, nb);
+			js_pop(J, 2);
+			js_pushlstring(J, buf, na + nb);
+			return;
 		}
+
+		if (nb == 0)
+			b = a ? a : jsV_newmemstring(J, sa, na);
+		else if (na == 0) {
+			if (!b)
+				b = jsV_newmemstring(J, sb, nb);
+		} else {
+			if (!a)
+				a = jsV_newmemstring(J, sa, na);
+			if (!b && !a->p && a->u.rope.right->p && a->u.rope.right->length + nb < JS_ROPEMIN) {
+				/* merge a short tail into the last piece of the rope */
+				js_String *tail = a->u.rope.right;
+				char buf[JS_ROPEMIN];
+				memcpy(buf, tail->p, tail->length);
+				memcpy(buf + tail->length, sb, nb);
+				b = jsV_newrope(J, a->u.rope.left, jsV_newmemstring(J, buf, tail->length + nb));
+			} else {
+				if (!b)
+					b = jsV_newmemstring(J, sb, nb);
+				b = jsV_newrope(J, a, b);
+			}
+		}
+
 		js_pop(J, 2);
-		js_pushstring(J, sab);
-		js_endtry(J);
-		js_free(J, sab);
+		js_pushmemstring(J, b);
 	} else {
 		double x = js_tonumber(J, -2);
 		double y = js_tonumber(J, -1);
@@ -523,16 +937,18 @@ int js_compare(js_State *J, int *okay)
 
 int js_equal(js_State *J)
 {
-	js_Value *x = js_tovalue(J, -2);
-	js_Value *y = js_tovalue(J, -1);
+	js_Value *x, *y;
 
 retry:
+	x = js_tovalue(J, -2); /* toprimitive may move the stack */
+	y = js_tovalue(J, -1);
 	if (JSV_ISSTRING(x) && JSV_ISSTRING(y))
 		return !strcmp(JSV_TOSTRING(x), JSV_TOSTRING(y));
+	if (JSV_ISNUMBER(x) && JSV_ISNUMBER(y))
+		return jsV_tonumber(J, x) == jsV_tonumber(J, y);
 	if (x->type == y->type) {
 		if (x->type == JS_TUNDEFINED) return 1;
 		if (x->type == JS_TNULL) return 1;
-		if (x->type == JS_TNUMBER) return x->u.number == y->u.number;
 		if (x->type == JS_TBOOLEAN) return x->u.boolean == y->u.boolean;
 		if (x->type == JS_TOBJECT) return x->u.object == y->u.object;
 		return 0;
@@ -541,10 +957,10 @@ retry:
 	if (x->type == JS_TNULL && y->type == JS_TUNDEFINED) return 1;
 	if (x->type == JS_TUNDEFINED && y->type == JS_TNULL) return 1;
 
-	if (x->type == JS_TNUMBER && JSV_ISSTRING(y))
-		return x->u.number == jsV_tonumber(J, y);
-	if (JSV_ISSTRING(x) && y->type == JS_TNUMBER)
-		return jsV_tonumber(J, x) == y->u.number;
+	if (JSV_ISNUMBER(x) && JSV_ISSTRING(y))
+		return jsV_tonumber(J, x) == jsV_tonumber(J, y);
+	if (JSV_ISSTRING(x) && JSV_ISNUMBER(y))
+		return jsV_tonumber(J, x) == jsV_tonumber(J, y);
 
 	if (x->type == JS_TBOOLEAN) {
 		x->type = JS_TNUMBER;
@@ -556,11 +972,11 @@ retry:
 		y->u.number = y->u.boolean;
 		goto retry;
 	}
-	if ((JSV_ISSTRING(x) || x->type == JS_TNUMBER) && y->type == JS_TOBJECT) {
+	if ((JSV_ISSTRING(x) || JSV_ISNUMBER(x)) && y->type == JS_TOBJECT) {
 		jsV_toprimitive(J, y, JS_HNONE);
 		goto retry;
 	}
-	if (x->type == JS_TOBJECT && (JSV_ISSTRING(y) || y->type == JS_TNUMBER)) {
+	if (x->type == JS_TOBJECT && (JSV_ISSTRING(y) || JSV_ISNUMBER(y))) {
 		jsV_toprimitive(J, x, JS_HNONE);
 		goto retry;
 	}
@@ -575,11 +991,12 @@ int js_strictequal(js_State *J)
 
 	if (JSV_ISSTRING(x) && JSV_ISSTRING(y))
 		return !strcmp(JSV_TOSTRING(x), JSV_TOSTRING(y));
+	if (JSV_ISNUMBER(x) && JSV_ISNUMBER(y))
+		return jsV_tonumber(J, x) == jsV_tonumber(J, y);
 
 	if (x->type != y->type) return 0;
 	if (x->type == JS_TUNDEFINED) return 1;
 	if (x->type == JS_TNULL) return 1;
-	if (x->type == JS_TNUMBER) return x->u.number == y->u.number;
 	if (x->type == JS_TBOOLEAN) return x->u.boolean == y->u.boolean;
 	if (x->type == JS_TOBJECT) return x->u.object == y->u.object;
 	return 0;
@@ -3,6 +3,7 @@
 
 typedef struct js_Property js_Property;
 typedef struct js_Iterator js_Iterator;
+typedef struct js_Builder js_Builder;
 
 /* Hint to ToPrimitive() */
 enum {
@@ -17,6 +18,7 @@ enum js_Type {
 	JS_TNULL,
 	JS_TBOOLEAN,
 	JS_TNUMBER,
+	JS_TINT32, /* number that fits in an int, never negative zero */
 	JS_TLITSTR,
 	JS_TMEMSTR,
 	JS_TOBJECT,
@@ -52,6 +54,7 @@ struct js_Value
 	union {
 		int boolean;
 		double number;
+		int integer;
 		char shrstr[8];
 		const char *litstr;
 		js_String *memstr;
@@ -61,17 +64,36 @@ struct js_Value
 	char type; /* type tag and zero terminator for shrstr */
 };
 
+#define JSV_ISNUMBER(v) ((v)->type == JS_TNUMBER || (v)->type == JS_TINT32)
+#define JSV_ISSTRING(v) ((v)->type == JS_TSHRSTR || (v)->type == JS_TMEMSTR || (v)->type == JS_TLITSTR)
+#define JSV_ISDENSE(obj) ((obj)->type == JS_CARRAY && (obj)->u.a.simple)
+
+/*
+ * A heap string is either flat text or a rope: a concatenation node that
+ * refers to its two halves. A rope is flattened into a separate buffer the
+ * first time its text is read; p is NULL until then.
+ */
 struct js_String
 {
 	js_String *gcnext;
 	char gcmark;
-	char p[1];
+	char ascii; /* every character is a single byte */
+	unsigned int length; /* in bytes */
+	unsigned int runes; /* in characters */
+	char *p;
+	union {
+		struct { js_String *left, *right; } rope;
+		char text[1];
+	} u;
 };
 
+#define JSV_MEMSTR(J, s) ((s)->p ? (s)->p : jsV_flatten(J, s))
+
 struct js_Regexp
 {
 	void *prog;
 	const char *source;
+	js_Function *owner; /* the function holding a literal's shared prog, or NULL */
 	unsigned short flags;
 	unsigned short last;
 };
@@ -80,7 +102,9 @@ struct js_Object
 {
 	enum js_Class type;
 	int extensible;
-	js_Property *properties;
+	js_Shape *shape; /* NULL in dictionary mode */
+	js_Value *slots; /* property values in shape mode */
+	js_Property *properties; /* in dictionary mode */
 	js_Property *head, **tailp; /* for enumeration */
 	unsigned int count; /* number of properties, for array sparseness check */
 	js_Object *prototype;
@@ -93,6 +117,10 @@ struct js_Object
 		} s;
 		struct {
 			unsigned int length;
+			int simple; /* dense: elements are in array, holes only after them */
+			unsigned int filled; /* elements in array, the rest up to length are holes */
+			unsigned int capacity;
+			js_Value *array;
 		} a;
 		struct {
 			js_Function *function;
@@ -131,27 +159,94 @@ struct js_Property
 	js_Object *setter;
 };
 
+struct js_Shape
+{
+	js_Property prop; /* descriptor of the property added by this shape */
+	js_Shape *parent;
+	js_Shape *kids, *sibling; /* transitions to shapes with one more property */
+	unsigned int count; /* number of properties, and slot index of prop + 1 */
+	js_Shape *gcnext;
+	int gcmark;
+};
+
+/* where the value of a property found on obj lives */
+static inline js_Value *jsV_propvalue(js_State *J, js_Object *obj, js_Property *ref)
+{
+	if (obj->shape)
+		return &obj->slots[((js_Shape*)ref)->count - 1];
+	return &ref->value;
+}
+
 struct js_Iterator
 {
 	const char *name;
 	js_Iterator *next;
 };
 
+/* Text produced by a builtin, growing in a scratch string on the stack */
+struct js_Builder
+{
+	js_String *str;
+	unsigned int n, cap;
+};
+
 /* jsrun.c */
 js_String *jsV_newmemstring(js_State *J, const char *s, int n);
+js_String *jsV_newrope(js_State *J, js_String *left, js_String *right);
+js_String *jsV_newscratch(js_State *J, unsigned int size);
+void jsV_resizescratch(js_State *J, js_String *v, unsigned int size);
+void jsV_endscratch(js_String *v, unsigned int n);
+void jsV_newbuilder(js_State *J, js_Builder *sb, unsigned int size);
+void jsV_growbuilder(js_State *J, js_Builder *sb, unsigned int more);
+void jsV_endbuilder(js_State *J, js_Builder *sb);
+void js_pushmemstring(js_State *J, js_String *v);
 js_Value *js_tovalue(js_State *J, int idx);
 void js_toprimitive(js_State *J, int idx, int hint);
 js_Object *js_toobject(js_State *J, int idx);
 void js_pushvalue(js_State *J, js_Value v);
 void js_pushobject(js_State *J, js_Object *v);
 
+static inline void jsV_putm(js_State *J, js_Builder *sb, const char *s, const char *e)
+{
+	unsigned int n = e - s;
+	if (n == 0)
+		return; /* s may be NULL for a capture that did not match */
+	if (n > sb->cap - sb->n)
+		jsV_growbuilder(J, sb, n);
+	memcpy(sb->str->p + sb->n, s, n);
+	sb->n += n;
+}
+
+static inline void jsV_puts(js_State *J, js_Builder *sb, const char *s)
+{
+	jsV_putm(J, sb, s, s + strlen(s));
+}
+
+static inline void jsV_putc(js_State *J, js_Builder *sb, int c)
+{
+	if (sb->n == sb->cap)
+		jsV_growbuilder(J, sb, 1);
+	sb->str->p[sb->n++] = c;
+}
+
 /* jsvalue.c */
 int jsV_toboolean(js_State *J, js_Value *v);
 double jsV_tonumber(js_State *J, js_Value *v);
 double jsV_tointeger(js_State *J, js_Value *v);
 const char *jsV_tostring(js_State *J, js_Value *v);
 js_Object *jsV_toobject(js_State *J, js_Value *v);
-void jsV_toprimitive(js_State *J, js_Value *v, int preferred);
+js_Value *jsV_toprimitive(js_State *J, js_Value *v, int preferred);
+const char *jsV_flatten(js_State *J, js_String *s);
+void jsV_measurestring(js_String *s);
+js_String *jsV_strinfo(js_State *J, js_Value *v);
+js_String *jsV_literalinfo(js_State *J, const char *s);
+const char *jsV_runeptr(js_State *J, js_String *s, unsigned int i);
+unsigned int jsV_runeidx(js_State *J, js_String *s, const char *p);
+const char *jsV_skipascii(const char *s, const char *e);
+unsigned int jsV_countrunes(const char *s, const char *e);
+const char *jsV_search(const char *s, unsigned int len, const char *needle, unsigned int n);
+const char *jsV_rsearch(const char *s, unsigned int len, unsigned int pos, const char *needle, unsigned int n);
+int jsV_runeat(js_State *J, js_String *s, unsigned int i);
 
 const char *js_itoa(char buf[32], unsigned int a);
 double js_stringtofloat(const char *s, char **ep);
@@ -165,16 +260,23 @@ double jsV_stringtonumber(js_State *J, const char *string);
 
 /* jsproperty.c */
 js_Object *jsV_newobject(js_State *J, enum js_Class type, js_Object *prototype);
+js_Shape *jsV_newshape(js_State *J, js_Shape *parent, const char *name, int atts);
+void jsV_todictionary(js_State *J, js_Object *obj);
+void jsV_extendshape(js_State *J, js_Object *obj, js_Shape *shape);
+js_Property *jsV_firstproperty(js_State *J, js_Object *obj);
+js_Property *jsV_nextproperty(js_State *J, js_Object *obj, js_Property *ref);
+/* property names passed to these must come from js_intern */
 js_Property *jsV_getownproperty(js_State *J, js_Object *obj, const char *name);
-js_Property *jsV_getpropertyx(js_State *J, js_Object *obj, const char *name, int *own);
+js_Property *jsV_getpropertyx(js_State *J, js_Object *obj, const char *name, js_Object **holder);
 js_Property *jsV_getproperty(js_State *J, js_Object *obj, const char *name);
-js_Property *jsV_setproperty(js_State *J, js_Object *obj, const char *name);
-js_Property *jsV_nextproperty(js_State *J, js_Object *obj, const char *name);
+js_Property *jsV_setproperty(js_State *J, js_Object *obj, const char *name, int atts);
 void jsV_delproperty(js_State *J, js_Object *obj, const char *name);
 
 js_Object *jsV_newiterator(js_State *J, js_Object *obj, int own);
 const char *jsV_nextiterator(js_State *J, js_Object *iter);
 
+js_Value *jsV_getdenseindex(js_State *J, js_Object *obj, const char *name);
+int jsV_setdenseindex(js_State *J, js_Object *obj, unsigned int k, const js_Value *value);
 void jsV_resizearray(js_State *J, js_Object *obj, unsigned int newlen);
 
 /* jsdump.c */
@@ -25,14 +25,24 @@
 #endif
 
 typedef struct js_State js_State;
+typedef struct js_Options js_Options;
 
 typedef void *(*js_Alloc)(void *memctx, void *ptr, unsigned int size);
 typedef void (*js_Panic)(js_State *J);
 typedef void (*js_CFunction)(js_State *J);
 typedef void (*js_Finalize)(js_State *J, void *p);
 
+/* Resource limits for a new state; fields left at zero get the defaults */
+struct js_Options
+{
+	int stacksize;	/* initial size of the value stack */
+	int stacklimit;	/* maximum size of the value stack */
+	int framelimit;	/* maximum call depth */
+	int trylimit;	/* maximum nesting of try blocks */
+};
+
 /* Basic functions */
-js_State *js_newstate(js_Alloc alloc, void *actx, int flags);
+js_State *js_newstate(js_Alloc alloc, void *actx, int flags, const js_Options *options);
 void js_setcontext(js_State *J, void *uctx);
 void *js_getcontext(js_State *J);
 js_Panic js_atpanic(js_State *J, js_Panic panic);
@@ -107,6 +117,13 @@ void js_defproperty(js_State *J, int idx, const char *name, int atts);
 void js_delproperty(js_State *J, int idx, const char *name);
 void js_defaccessor(js_State *J, int idx, const char *name, int atts);
 
+/* Atoms are names interned for the lifetime of the state */
+const char *js_atom(js_State *J, const char *name);
+int js_haspropertyatom(js_State *J, int idx, const char *atom);
+void js_getpropertyatom(js_State *J, int idx, const char *atom);
+void js_setpropertyatom(js_State *J, int idx, const char *atom);
+void js_defpropertyatom(js_State *J, int idx, const char *atom, int atts);
+
 unsigned int js_getlength(js_State *J, int idx);
 void js_setlength(js_State *J, int idx, unsigned int len);
 int js_hasindex(js_State *J, int idx, unsigned int i);
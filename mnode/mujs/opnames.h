@@ -8,6 +8,7 @@
 "number_1",
 "number_pos",
 "number_neg",
+"integer",
 "number",
 "string",
 "closure",
@@ -25,6 +26,11 @@
 "getlocal",
 "setlocal",
 "dellocal",
+"initenv",
+"getenv",
+"setenv",
+"arglength",
+"getarg",
 "initvar",
 "defvar",
 "hasvar",
@@ -45,6 +51,7 @@
 "nextiter",
 "eval",
 "call",
+"tailcall",
 "new",
 "typeof",
 "pos",
@@ -89,3 +96,10 @@
 "jfalse",
 "return",
 "line",
+"getlocal2",
+"getlocalprop_s",
+"getmethod_s",
+"jnlt",
+"jngt",
+"jnle",
+"jnge",
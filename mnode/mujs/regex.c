@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <setjmp.h>
@@ -16,11 +17,14 @@
 #define REPINF 255
 #define MAXTHREAD 1000
 #define MAXSUB REG_MAXSUB
+#define MAXPREFIX 15
 
 typedef struct Reclass Reclass;
 typedef struct Renode Renode;
 typedef struct Reinst Reinst;
 typedef struct Rethread Rethread;
+typedef struct Rework Rework;
+typedef struct Redstate Redstate;
 
 struct Reclass {
 	Rune *end;
@@ -31,6 +35,14 @@ struct Reprog {
 	Reinst *start, *end;
 	int flags;
 	unsigned int nsub;
+	int backtrack; /* needs the backtracker: back-references or lookahead */
+	Rework *work; /* Pike VM and DFA state, allocated on first use */
+
+	/* where a match can start: the literal prefix, or else the first bytes */
+	char prefix[MAXPREFIX + 1];
+	unsigned int nprefix;
+	int hasfirst;
+	unsigned char first[256];
 	Reclass cclass[16];
 };
 
@@ -40,7 +52,7 @@ struct cstate {
 
 	const char *source;
 	unsigned int ncclass;
-	unsigned int nsub;
+	unsigned int nsub, nloop;
 	Renode *sub[MAXSUB];
 
 	int lookahead;
@@ -418,6 +430,29 @@ static Renode *newnode(struct cstate *g, int type)
 	return node;
 }
 
+/* back-references and lookahead need the backtracking matcher */
+static int needbacktrack(Renode *node)
+{
+	if (!node) return 0;
+	switch (node->type) {
+	default: return 0;
+	case P_REF: case P_PLA: case P_NLA: return 1;
+	case P_CAT: case P_ALT: return needbacktrack(node->x) || needbacktrack(node->y);
+	case P_REP: case P_PAR: return needbacktrack(node->x);
+	}
+}
+
+static int hasref(Renode *node)
+{
+	if (!node) return 0;
+	switch (node->type) {
+	default: return 0;
+	case P_REF: return 1;
+	case P_CAT: case P_ALT: return hasref(node->x) || hasref(node->y);
+	case P_REP: case P_PAR: case P_PLA: case P_NLA: return hasref(node->x);
+	}
+}
+
 static int empty(Renode *node)
 {
 	if (!node) return 1;
@@ -437,6 +472,13 @@ static Renode *newrep(struct cstate *g, Renode *atom, int ng, int min, int max)
 	Renode *rep = newnode(g, P_REP);
 	if (max == REPINF && empty(atom))
 		die(g, "infinite loop matching the empty string");
+	/* a back-reference to an unset group matches the empty string, so such
+	 * a loop keeps where each iteration started in a spare capture slot */
+	if (max == REPINF && hasref(atom)) {
+		if (g->nsub + g->nloop == MAXSUB)
+			die(g, "too many captures");
+		rep->c = MAXSUB - ++g->nloop;
+	}
 	rep->ng = ng;
 	rep->m = min;
 	rep->n = max;
@@ -494,7 +536,7 @@ static Renode *parseatom(struct cstate *g)
 		return newnode(g, P_ANY);
 	if (accept(g, '(')) {
 		atom = newnode(g, P_PAR);
-		if (g->nsub == MAXSUB)
+		if (g->nsub + g->nloop == MAXSUB)
 			die(g, "too many captures");
 		atom->n = g->nsub++;
 		atom->x = parsealt(g);
@@ -585,7 +627,7 @@ enum {
 	I_END, I_JUMP, I_SPLIT, I_PLA, I_NLA,
 	I_ANYNL, I_ANY, I_CHAR, I_CCLASS, I_NCCLASS, I_REF,
 	I_BOL, I_EOL, I_WORD, I_NWORD,
-	I_LPAR, I_RPAR
+	I_LPAR, I_RPAR, I_PROGRESS
 };
 
 struct Reinst {
@@ -610,6 +652,7 @@ static unsigned int count(Renode *node)
 		max = node->n;
 		if (min == max) return count(node->x) * min;
 		if (max < REPINF) return count(node->x) * max + (max - min);
+		if (node->c) return count(node->x) * (min + 1) + 4;
 		return count(node->x) * (min + 1) + 2;
 	case P_PAR: return count(node->x) + 2;
 	case P_PLA: return count(node->x) + 2;
@@ -671,9 +714,17 @@ static void compile(Reprog *prog, Renode *node)
 					split->y = prog->end;
 				}
 			}
-		} else if (node->m == 0) {
+		} else if (node->m == 0 || node->c) {
 			split = emit(prog, I_SPLIT);
+			if (node->c) {
+				inst = emit(prog, I_LPAR);
+				inst->n = node->c;
+			}
 			compile(prog, node->x);
+			if (node->c) {
+				inst = emit(prog, I_PROGRESS);
+				inst->n = node->c;
+			}
 			jump = emit(prog, I_JUMP);
 			if (node->ng) {
 				split->y = split + 1;
@@ -804,11 +855,143 @@ static void dumpprog(Reprog *prog)
 		case I_NWORD: puts("nword"); break;
 		case I_LPAR: printf("lpar %d\n", inst->n); break;
 		case I_RPAR: printf("rpar %d\n", inst->n); break;
+		case I_PROGRESS: printf("progress %d\n", inst->n); break;
 		}
 	}
 }
 #endif
 
+/* Prefilter */
+
+/*
+ * Every match starts with the literal prefix, when the program has one, or
+ * else with a byte in the first set. Matching skips ahead to the next such
+ * position instead of trying each one in turn.
+ */
+
+/* Add the bytes that can start a rune in lo..hi. Returns 0 if the range
+ * takes in Runeerror, which an invalid byte anywhere can decode to. */
+static int addfirst(Reprog *prog, Rune lo, Rune hi, int icase)
+{
+	char buf[UTFmax];
+	int a, b;
+
+	if (lo <= Runeerror && Runeerror <= hi)
+		return 0;
+	for (; lo <= hi && lo < Runeself; ++lo) {
+		prog->first[lo] = 1;
+		if (icase && lo >= 'A' && lo <= 'Z')
+			prog->first[lo - 'A' + 'a'] = 1;
+		if (icase && lo >= 'a' && lo <= 'z')
+			prog->first[lo - 'a' + 'A'] = 1;
+	}
+	if (lo <= hi) {
+		/* any other case of a non-ASCII rune is non-ASCII too */
+		if (icase)
+			lo = Runeself, hi = Runeerror - 1;
+		runetochar(buf, &lo);
+		a = (unsigned char)buf[0];
+		runetochar(buf, &hi);
+		b = (unsigned char)buf[0];
+		while (a <= b)
+			prog->first[a++] = 1;
+	}
+	return 1;
+}
+
+/* Add the first bytes of what can be matched from pc. Returns 0 if that
+ * can be empty or start with almost anything. */
+static int firstset(Reprog *prog, Reinst *pc, unsigned char *seen)
+{
+	int icase = prog->flags & REG_ICASE;
+	Rune *p;
+
+	for (;;) {
+		if (seen[pc - prog->start])
+			return 1;
+		seen[pc - prog->start] = 1;
+		switch (pc->opcode) {
+		case I_JUMP:
+			pc = pc->x;
+			break;
+		case I_SPLIT:
+			if (!firstset(prog, pc->x, seen))
+				return 0;
+			pc = pc->y;
+			break;
+		case I_LPAR:
+		case I_RPAR:
+		case I_PROGRESS:
+		case I_BOL:
+		case I_EOL:
+		case I_WORD:
+		case I_NWORD:
+			++pc;
+			break;
+		case I_CHAR:
+			return addfirst(prog, pc->c, pc->c, icase);
+		case I_CCLASS:
+			for (p = pc->cc->spans; p < pc->cc->end; p += 2)
+				if (!addfirst(prog, p[0], p[1], icase))
+					return 0;
+			return 1;
+		default:
+			return 0;
+		}
+	}
+}
+
+static void prefilter(Reprog *prog)
+{
+	Reinst *pc = prog->start + 3; /* past the .*? loop */
+	unsigned char *seen;
+	int i, n;
+
+	prog->nprefix = 0;
+	memset(prog->first, 0, sizeof prog->first);
+
+	seen = calloc(prog->end - prog->start, 1);
+	prog->hasfirst = seen && firstset(prog, pc, seen);
+	free(seen);
+	if (!prog->hasfirst)
+		return;
+
+	if (!(prog->flags & REG_ICASE)) {
+		for (;; ++pc) {
+			if (pc->opcode == I_CHAR && pc->c != 0) {
+				if (prog->nprefix + runelen(pc->c) > MAXPREFIX)
+					break;
+				prog->nprefix += runetochar(prog->prefix + prog->nprefix, &pc->c);
+			} else if (pc->opcode != I_LPAR && pc->opcode != I_RPAR &&
+					pc->opcode != I_BOL && pc->opcode != I_EOL &&
+					pc->opcode != I_WORD && pc->opcode != I_NWORD) {
+				break;
+			}
+		}
+	}
+
+	/* a single first byte is a one byte prefix */
+	if (prog->nprefix == 0) {
+		for (i = n = 0; i < 256; ++i)
+			if (prog->first[i])
+				prog->prefix[0] = i, ++n;
+		if (n == 1)
+			prog->nprefix = 1;
+	}
+	prog->prefix[prog->nprefix] = 0;
+}
+
+/* the first position from sp where a match can start, or NULL if there is none */
+static const char *skipahead(Reprog *prog, const char *sp)
+{
+	const unsigned char *s = (const unsigned char *)sp;
+	if (prog->nprefix > 0)
+		return strstr(sp, prog->prefix);
+	while (*s && !prog->first[*s])
+		++s;
+	return *s ? (const char *)s : NULL;
+}
+
 Reprog *regcomp(const char *pattern, int cflags, const char **errorp)
 {
 	struct cstate g;
@@ -829,6 +1012,7 @@ Reprog *regcomp(const char *pattern, int cflags, const char **errorp)
 	g.source = pattern;
 	g.ncclass = 0;
 	g.nsub = 1;
+	g.nloop = 0;
 	for (i = 0; i < MAXSUB; ++i)
 		g.sub[i] = 0;
 
@@ -842,6 +1026,8 @@ Reprog *regcomp(const char *pattern, int cflags, const char **errorp)
 		die(&g, "syntax error");
 
 	g.prog->nsub = g.nsub;
+	g.prog->backtrack = needbacktrack(node);
+	g.prog->work = NULL;
 	g.prog->start = g.prog->end = malloc((count(node) + 6) * sizeof (Reinst));
 
 	split = emit(g.prog, I_SPLIT);
@@ -854,6 +1040,7 @@ Reprog *regcomp(const char *pattern, int cflags, const char **errorp)
 	compile(g.prog, node);
 	emit(g.prog, I_RPAR);
 	emit(g.prog, I_END);
+	prefilter(g.prog);
 
 #ifdef TEST
 	dumpnode(node);
@@ -867,9 +1054,12 @@ Reprog *regcomp(const char *pattern, int cflags, const char **errorp)
 	return g.prog;
 }
 
+static void freework(Rework *w);
+
 void regfree(Reprog *prog)
 {
 	if (prog) {
+		freework(prog->work);
 		free(prog->start);
 		free(prog);
 	}
@@ -1036,6 +1226,8 @@ static int match(Reinst *pc, const char *sp, const char *bol, int flags, Resub *
 				break;
 			case I_REF:
 				i = sub.sub[pc->n].ep - sub.sub[pc->n].sp;
+				if (i == 0)
+					break; /* unset groups match the empty string */
 				if (flags & REG_ICASE) {
 					if (strncmpcanon(sp, sub.sub[pc->n].sp, i))
 						goto dead;
@@ -1043,8 +1235,7 @@ static int match(Reinst *pc, const char *sp, const char *bol, int flags, Resub *
 					if (strncmp(sp, sub.sub[pc->n].sp, i))
 						goto dead;
 				}
-				if (i > 0)
-					sp += i;
+				sp += i;
 				break;
 
 			case I_BOL:
@@ -1080,6 +1271,11 @@ static int match(Reinst *pc, const char *sp, const char *bol, int flags, Resub *
 			case I_RPAR:
 				sub.sub[pc->n].ep = sp;
 				break;
+			case I_PROGRESS:
+				/* an iteration that matched nothing fails */
+				if (sp == sub.sub[pc->n].sp)
+					goto dead;
+				break;
 			default:
 				goto dead;
 			}
@@ -1090,9 +1286,507 @@ dead: ;
 	return 0;
 }
 
+/*
+ * Programs without back-references or lookahead run on a Pike VM, which
+ * steps all threads over the string in lockstep and so takes time linear in
+ * its length. Threads are kept in priority order and the lower priority
+ * ones are cut off when one matches, which gives the same leftmost-first
+ * matches as the backtracker. A lazy DFA built from the same program
+ * answers whether there is a match at all; regexec runs it first, so
+ * strings that do not match never reach the VM.
+ */
+
+enum {
+	CTX_BOL = 1, /* '^' matches here */
+	CTX_WORD = 2, /* the previous character is a word character */
+};
+
+#define DFA_MAXSTATE 64
+#define DFA_BUCKETS 64
+#define DFA_MAXFLUSH 4
+
+struct Redstate {
+	Redstate *next[128]; /* transitions on ASCII characters, filled in lazily; 0 is the end */
+	Redstate *link; /* hash chain */
+	unsigned int hash;
+	int ctx;
+	unsigned int n;
+	Reinst *pc[1];
+};
+
+struct Rework {
+	unsigned int ninst, ncap;
+
+	/* instruction marks, to visit each once per step */
+	unsigned int *mark, gen;
+
+	/* Pike VM: two thread lists and the captures of the thread being added */
+	struct { Reinst **pc; const char **cap; unsigned int n; } list[2];
+	const char **cap;
+	struct { Reinst *pc; int slot; const char *old; } *stack;
+
+	/* DFA: interned states, and the start states by context */
+	Redstate *table[DFA_BUCKETS];
+	Redstate *start[4];
+	unsigned int nstate, nflush;
+	unsigned int nexec, nfail; /* runs, and runs that found no match */
+	Reinst **set;
+};
+
+static Redstate matchstate, deadstate;
+
+static Rework *getwork(Reprog *prog)
+{
+	Rework *w = prog->work;
+	unsigned int ninst, ncap;
+
+	if (w)
+		return w;
+
+	ninst = prog->end - prog->start;
+	ncap = prog->nsub * 2;
+	w = malloc(sizeof *w);
+	if (!w)
+		return NULL;
+	memset(w, 0, sizeof *w);
+	w->ninst = ninst;
+	w->ncap = ncap;
+	w->mark = calloc(ninst, sizeof *w->mark);
+	w->list[0].pc = malloc(ninst * sizeof *w->list[0].pc);
+	w->list[1].pc = malloc(ninst * sizeof *w->list[1].pc);
+	w->list[0].cap = malloc(ninst * ncap * sizeof *w->list[0].cap);
+	w->list[1].cap = malloc(ninst * ncap * sizeof *w->list[1].cap);
+	w->cap = malloc(ncap * sizeof *w->cap);
+	w->stack = malloc(2 * ninst * sizeof *w->stack);
+	w->set = malloc(2 * ninst * sizeof *w->set); /* a step holds two sets */
+	if (!w->mark || !w->list[0].pc || !w->list[1].pc || !w->list[0].cap || !w->list[1].cap ||
+			!w->cap || !w->stack || !w->set) {
+		freework(w);
+		return NULL;
+	}
+	prog->work = w;
+	return w;
+}
+
+static void flushdfa(Rework *w)
+{
+	Redstate *s, *next;
+	unsigned int i;
+	for (i = 0; i < DFA_BUCKETS; ++i) {
+		for (s = w->table[i]; s; s = next) {
+			next = s->link;
+			free(s);
+		}
+		w->table[i] = NULL;
+	}
+	for (i = 0; i < nelem(w->start); ++i)
+		w->start[i] = NULL;
+	w->nstate = 0;
+}
+
+static void freework(Rework *w)
+{
+	if (w) {
+		flushdfa(w);
+		free(w->mark);
+		free(w->list[0].pc);
+		free(w->list[1].pc);
+		free(w->list[0].cap);
+		free(w->list[1].cap);
+		free(w->cap);
+		free(w->stack);
+		free(w->set);
+		free(w);
+	}
+}
+
+/* the zero-width assertion at pc holds between the characters prev and next */
+static int assertion(Reinst *pc, const char *sp, const char *bol, int flags)
+{
+	int i;
+	switch (pc->opcode) {
+	case I_BOL:
+		if (sp == bol && !(flags & REG_NOTBOL))
+			return 1;
+		return (flags & REG_NEWLINE) && sp > bol && isnewline(sp[-1]);
+	case I_EOL:
+		return *sp == 0 || ((flags & REG_NEWLINE) && isnewline(*sp));
+	case I_WORD:
+		i = sp > bol && iswordchar(sp[-1]);
+		return i ^ iswordchar(sp[0]);
+	case I_NWORD:
+		i = sp > bol && iswordchar(sp[-1]);
+		return !(i ^ iswordchar(sp[0]));
+	}
+	return 0;
+}
+
+/* the instruction at pc accepts the character c */
+static int accepts(Reinst *pc, Rune c, int flags)
+{
+	if (c == 0)
+		return 0;
+	switch (pc->opcode) {
+	case I_ANYNL:
+		return 1;
+	case I_ANY:
+		return !isnewline(c);
+	case I_CHAR:
+		return ((flags & REG_ICASE) ? canon(c) : c) == pc->c;
+	case I_CCLASS:
+		if (flags & REG_ICASE)
+			return incclasscanon(pc->cc, canon(c));
+		return incclass(pc->cc, c);
+	case I_NCCLASS:
+		if (flags & REG_ICASE)
+			return !incclasscanon(pc->cc, canon(c));
+		return !incclass(pc->cc, c);
+	}
+	return 0;
+}
+
+/* Pike VM */
+
+/* Follow the empty transitions from pc at sp, and add the threads that
+ * reach a character test or the end to list l, in priority order. */
+static void addthread(Rework *w, int l, Reinst *start, Reinst *pc, const char *sp, const char *bol, int flags)
+{
+	unsigned int top = 0, slot, n;
+
+	w->stack[top].pc = pc;
+	w->stack[top++].slot = -1;
+	while (top > 0) {
+		--top;
+		if (w->stack[top].slot >= 0) {
+			w->cap[w->stack[top].slot] = w->stack[top].old;
+			continue;
+		}
+		pc = w->stack[top].pc;
+		for (;;) {
+			if (w->mark[pc - start] == w->gen)
+				break;
+			w->mark[pc - start] = w->gen;
+			switch (pc->opcode) {
+			case I_JUMP:
+				pc = pc->x;
+				continue;
+			case I_SPLIT:
+				w->stack[top].pc = pc->y;
+				w->stack[top++].slot = -1;
+				pc = pc->x;
+				continue;
+			case I_LPAR:
+			case I_RPAR:
+				slot = pc->n * 2 + (pc->opcode == I_RPAR);
+				w->stack[top].slot = slot;
+				w->stack[top++].old = w->cap[slot];
+				w->cap[slot] = sp;
+				++pc;
+				continue;
+			case I_BOL:
+			case I_EOL:
+			case I_WORD:
+			case I_NWORD:
+				if (!assertion(pc, sp, bol, flags))
+					break;
+				++pc;
+				continue;
+			default:
+				n = w->list[l].n++;
+				w->list[l].pc[n] = pc;
+				memcpy(w->list[l].cap + n * w->ncap, w->cap, w->ncap * sizeof *w->cap);
+				break;
+			}
+			break;
+		}
+	}
+}
+
+/*
+ * The program starts with a lazy .* loop (see regcomp) for a search that is
+ * not anchored. The VM starts the attempt at each position itself instead,
+ * after the threads already running, until one of them matches. With no
+ * threads running it skips ahead to where a match can start. A pattern
+ * anchored with ^ is only attempted at the start.
+ */
+static int pikevm(Reprog *prog, Rework *w, const char *bol, const char *sp, int flags, Resub *out)
+{
+	Reinst *body = prog->start + 3;
+	int anchored = body[1].opcode == I_BOL && !(flags & REG_NEWLINE);
+	const char **cap;
+	int cl = 0, nl = 1, matched = 0;
+	unsigned int i, k, n;
+	Reinst *pc;
+	Rune c;
+
+	w->list[cl].n = 0;
+	++w->gen;
+
+	for (;;) {
+		if (!matched && (!anchored || sp == bol)) {
+			if (w->list[cl].n == 0 && prog->hasfirst && !anchored) {
+				sp = skipahead(prog, sp);
+				if (!sp)
+					break;
+				++w->gen; /* the marks were for the old position */
+			}
+			memset(w->cap, 0, w->ncap * sizeof *w->cap);
+			addthread(w, cl, prog->start, body, sp, bol, flags);
+		} else if (w->list[cl].n == 0) {
+			break;
+		}
+
+		n = chartorune(&c, sp);
+		w->list[nl].n = 0;
+		++w->gen;
+		for (i = 0; i < w->list[cl].n; ++i) {
+			pc = w->list[cl].pc[i];
+			cap = w->list[cl].cap + i * w->ncap;
+			if (pc->opcode == I_END) {
+				for (k = 0; k < prog->nsub; ++k) {
+					out->sub[k].sp = cap[k * 2];
+					out->sub[k].ep = cap[k * 2 + 1];
+				}
+				matched = 1;
+				break; /* the threads after this one have lower priority */
+			}
+			if (accepts(pc, c, flags)) {
+				memcpy(w->cap, cap, w->ncap * sizeof *w->cap);
+				addthread(w, nl, prog->start, pc + 1, sp + n, bol, flags);
+			}
+		}
+		if (c == 0)
+			break;
+		sp += n;
+		cl = nl;
+		nl = 1 - nl;
+	}
+
+	return matched;
+}
+
+/* Lazy DFA */
+
+/* the assertion at pc holds in context ctx before the character c */
+static int dfaassertion(Reinst *pc, int ctx, Rune c, int flags)
+{
+	int word = c < 128 && iswordchar(c);
+	switch (pc->opcode) {
+	case I_BOL: return ctx & CTX_BOL;
+	case I_EOL: return c == 0 || ((flags & REG_NEWLINE) && (c == '\n' || c == '\r'));
+	case I_WORD: return !!(ctx & CTX_WORD) ^ word;
+	case I_NWORD: return !(!!(ctx & CTX_WORD) ^ word);
+	}
+	return 0;
+}
+
+/* Add what is reachable from pc without consuming input to the set. With
+ * c < 0 the next character is not known yet, and the assertions that look
+ * at it are added to the set to be settled on the next step. Returns 1 if
+ * the end is reached. */
+static int dfaclosure(Rework *w, Reinst *start, Reinst *pc, int ctx, int c, int flags, unsigned int *n)
+{
+	unsigned int top = 0;
+	int end = 0;
+
+	w->stack[top++].pc = pc;
+	while (top > 0) {
+		pc = w->stack[--top].pc;
+		for (;;) {
+			if (w->mark[pc - start] == w->gen)
+				break;
+			w->mark[pc - start] = w->gen;
+			switch (pc->opcode) {
+			case I_JUMP:
+				pc = pc->x;
+				continue;
+			case I_SPLIT:
+				w->stack[top++].pc = pc->y;
+				pc = pc->x;
+				continue;
+			case I_LPAR:
+			case I_RPAR:
+				++pc;
+				continue;
+			case I_EOL:
+			case I_WORD:
+			case I_NWORD:
+				if (c < 0) {
+					w->set[(*n)++] = pc;
+					break;
+				}
+				/* fall through */
+			case I_BOL:
+				if (!dfaassertion(pc, ctx, c, flags))
+					break;
+				++pc;
+				continue;
+			case I_END:
+				end = 1;
+				/* fall through */
+			default:
+				w->set[(*n)++] = pc;
+				break;
+			}
+			break;
+		}
+	}
+	return end;
+}
+
+static int cmpinst(const void *a, const void *b)
+{
+	Reinst *x = *(Reinst**)a, *y = *(Reinst**)b;
+	return x < y ? -1 : x > y;
+}
+
+/* Find or make the state for the first n instructions in the set. Returns
+ * NULL if the cache has been flushed too often to be of use. */
+static Redstate *dfastate(Rework *w, Reinst *start, int ctx, unsigned int n)
+{
+	unsigned int h = ctx, i;
+	Redstate *s;
+
+	qsort(w->set, n, sizeof *w->set, cmpinst);
+	for (i = 0; i < n; ++i)
+		h = h * 31 + (w->set[i] - start);
+
+	for (s = w->table[h % DFA_BUCKETS]; s; s = s->link)
+		if (s->hash == h && s->ctx == ctx && s->n == n && !memcmp(s->pc, w->set, n * sizeof *w->set))
+			return s;
+
+	if (w->nstate == DFA_MAXSTATE) {
+		if (++w->nflush > DFA_MAXFLUSH)
+			return NULL;
+		flushdfa(w);
+	}
+
+	s = malloc(offsetof(Redstate, pc) + (n ? n : 1) * sizeof *s->pc);
+	if (!s)
+		return NULL;
+	memset(s->next, 0, sizeof s->next);
+	s->hash = h;
+	s->ctx = ctx;
+	s->n = n;
+	memcpy(s->pc, w->set, n * sizeof *w->set);
+	s->link = w->table[h % DFA_BUCKETS];
+	w->table[h % DFA_BUCKETS] = s;
+	++w->nstate;
+	return s;
+}
+
+/* The state after the character c, or matchstate or deadstate. */
+static Redstate *dfastep(Rework *w, Reinst *start, Redstate *s, Rune c, int flags)
+{
+	unsigned int i, k, n = 0, m;
+	int ctx;
+
+	/* settle the pending assertions now that c is known */
+	++w->gen;
+	for (i = 0; i < s->n; ++i)
+		if (dfaclosure(w, start, s->pc[i], s->ctx, c, flags, &n))
+			return &matchstate;
+	if (c == 0)
+		return &deadstate;
+
+	ctx = 0;
+	if ((flags & REG_NEWLINE) && (c == '\n' || c == '\r'))
+		ctx |= CTX_BOL;
+	if (c < 128 && iswordchar(c))
+		ctx |= CTX_WORD;
+
+	/* step the character tests over c; the new set goes after the old one */
+	++w->gen;
+	m = n;
+	for (k = 0; k < n; ++k)
+		if (accepts(w->set[k], c, flags))
+			dfaclosure(w, start, w->set[k] + 1, ctx, -1, flags, &m);
+	memmove(w->set, w->set + n, (m - n) * sizeof *w->set);
+	return dfastate(w, start, ctx, m - n);
+}
+
+/* 1 if the string matches, 0 if not, -1 if the DFA gave up */
+static Redstate *dfastart(Reprog *prog, Rework *w, int ctx, int flags)
+{
+	unsigned int n = 0;
+	if (!w->start[ctx]) {
+		++w->gen;
+		dfaclosure(w, prog->start, prog->start, ctx, -1, flags, &n);
+		w->start[ctx] = dfastate(w, prog->start, ctx, n);
+	}
+	return w->start[ctx];
+}
+
+/* the context of the position sp */
+static int dfacontext(const char *bol, const char *sp, int flags)
+{
+	int ctx = 0;
+	if (sp == bol)
+		return (flags & REG_NOTBOL) ? 0 : CTX_BOL;
+	if ((flags & REG_NEWLINE) && (sp[-1] == '\n' || sp[-1] == '\r'))
+		ctx |= CTX_BOL;
+	if (iswordchar(sp[-1]))
+		ctx |= CTX_WORD;
+	return ctx;
+}
+
+static int dfaexec(Reprog *prog, Rework *w, const char *bol, const char *sp, int flags)
+{
+	unsigned int flushes;
+	Redstate *s, *next;
+	const char *p;
+	Rune c;
+
+	w->nflush = 0;
+	s = dfastart(prog, w, dfacontext(bol, sp, flags), flags);
+	if (!s)
+		return -1;
+
+	for (;;) {
+		/* in the start state nothing is under way: skip ahead */
+		if (prog->hasfirst && s == w->start[s->ctx]) {
+			p = skipahead(prog, sp);
+			if (!p)
+				return 0;
+			if (p != sp) {
+				sp = p;
+				s = dfastart(prog, w, dfacontext(bol, sp, flags), flags);
+				if (!s)
+					return -1;
+			}
+		}
+
+		c = *(const unsigned char*)sp;
+		if (c < 128) {
+			next = s->next[c];
+			if (!next) {
+				flushes = w->nflush;
+				next = dfastep(w, prog->start, s, c, flags);
+				if (!next)
+					return -1;
+				if (w->nflush == flushes)
+					s->next[c] = next;
+			}
+			++sp;
+		} else {
+			sp += chartorune(&c, sp);
+			next = dfastep(w, prog->start, s, c, flags);
+			if (!next)
+				return -1;
+		}
+		if (next == &matchstate)
+			return 1;
+		if (next == &deadstate)
+			return 0;
+		s = next;
+	}
+}
+
 int regexec(Reprog *prog, const char *sp, Resub *sub, int eflags)
 {
+	const char *start;
 	Resub scratch;
+	Rework *w;
 	int i;
 
 	if (!sub)
@@ -1102,7 +1796,38 @@ int regexec(Reprog *prog, const char *sp, Resub *sub, int eflags)
 	for (i = 0; i < MAXSUB; ++i)
 		sub->sub[i].sp = sub->sub[i].ep = NULL;
 
-	return !match(prog->start, sp, sp, prog->flags | eflags, sub);
+	/* start where a match can, and turn away a subject with no such place */
+	start = sp;
+	if (prog->hasfirst) {
+		start = skipahead(prog, sp);
+		if (!start)
+			return 1;
+	}
+
+	if (!prog->backtrack && (w = getwork(prog))) {
+		/*
+		 * A program run only once is not worth building a DFA for. When
+		 * the captures are wanted the DFA only saves time if it rejects
+		 * the input, so it is used while the program often fails.
+		 */
+		if (w->nexec++ > 0 && (sub == &scratch || w->nfail * 4 > w->nexec)) {
+			switch (dfaexec(prog, w, sp, start, prog->flags | eflags)) {
+			case 0: ++w->nfail; return 1;
+			case 1: if (sub == &scratch) return 0; break;
+			}
+		}
+		if (!pikevm(prog, w, sp, start, prog->flags | eflags, sub)) {
+			++w->nfail;
+			return 1;
+		}
+		return 0;
+	}
+
+	if (!match(prog->start, start, sp, prog->flags | eflags, sub))
+		return 1;
+	for (i = prog->nsub; i < MAXSUB; ++i)
+		sub->sub[i].sp = sub->sub[i].ep = NULL;
+	return 0;
 }
 
 #ifdef TEST
@@ -1141,3 +1866,116 @@ int main(int argc, char **argv)
 	return 0;
 }
 #endif
+
+#ifdef FUZZ
+/*
+ * Differential fuzzer: run random patterns on random subjects through
+ * regexec (prefilter, DFA and Pike VM) and through the backtracker from the
+ * start of the string, and report where they differ in the match or the
+ * captures. Build with:
+ *	cc -DFUZZ -g -fsanitize=address,undefined -o refuzz regex.c utf.c utftype.c
+ * and run as "refuzz [iterations] [seed]".
+ */
+static unsigned int seed;
+
+static int rnd(int n)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) % n;
+}
+
+static const char *atoms[] = {
+	"a", "b", "c", "x", " ", ".", "[ab]", "[^a]", "[a-c]", "\\d", "\\w", "\\s",
+	"\\b", "\\B", "^", "$", "abc", "bx", "\xc3\xa9", "[\xc3\xa0-\xc3\xbf]",
+	"(?=a)", "(?!b)", "\\1",
+};
+
+static const char *letters[] = {
+	"a", "b", "c", "A", "B", "x", "1", " ", "_", "-", "\n", "\r",
+	"\xc3\xa9", "\xc3\x89", "\xe2\x80\xa8",
+};
+
+static void gen(char *p, int depth)
+{
+	static const char *quant[] = { "*", "+", "?", "*?", "+?", "??", "{1,3}", "{2}", "{0,2}" };
+	switch (rnd(depth > 3 ? 3 : 7)) {
+	case 0: case 1: case 2:
+		strcat(p, atoms[rnd(nelem(atoms))]);
+		break;
+	case 3:
+		strcat(p, "("); gen(p, depth + 1); strcat(p, "|"); gen(p, depth + 1); strcat(p, ")");
+		break;
+	case 4:
+		gen(p, depth + 1); gen(p, depth + 1);
+		break;
+	case 5:
+		strcat(p, "(?:"); gen(p, depth + 1); strcat(p, ")"); strcat(p, quant[rnd(nelem(quant))]);
+		break;
+	case 6:
+		strcat(p, "("); gen(p, depth + 1); strcat(p, ")"); strcat(p, quant[rnd(nelem(quant))]);
+		break;
+	}
+}
+
+static int pos(const char *p, const char *s)
+{
+	return p ? (int)(p - s) : -1;
+}
+
+int main(int argc, char **argv)
+{
+	int iter, niter = argc > 1 ? atoi(argv[1]) : 100000;
+	int ok = 0, bad = 0, matched = 0;
+	char pat[1024], str[128];
+	const char *error;
+	Reprog *p;
+	Resub m1, m2;
+	int i, n, flags, eflags, r1, r2, r3, same;
+
+	seed = argc > 2 ? atoi(argv[2]) : 1;
+	for (iter = 0; iter < niter; ++iter) {
+		pat[0] = 0;
+		gen(pat, 0);
+		flags = rnd(4) & (REG_ICASE | REG_NEWLINE);
+		p = regcomp(pat, flags, &error);
+		if (!p)
+			continue;
+
+		str[0] = 0;
+		n = rnd(20); /* the backtracker is exponential on some of these */
+		for (i = 0; i < n; ++i)
+			strcat(str, letters[rnd(nelem(letters))]);
+
+		/* run twice, so the second regexec goes through the DFA */
+		for (eflags = 0; eflags <= REG_NOTBOL; eflags += REG_NOTBOL) {
+			r1 = regexec(p, str, &m1, eflags);
+			r3 = regexec(p, str, NULL, eflags);
+			for (i = 0; i < MAXSUB; ++i)
+				m2.sub[i].sp = m2.sub[i].ep = NULL;
+			r2 = !match(p->start, str, str, p->flags | eflags, &m2);
+			same = r1 == r2 && r3 == r2;
+			if (same && r1 == 0) {
+				++matched;
+				for (i = 0; i < (int)p->nsub; ++i)
+					if (m1.sub[i].sp != m2.sub[i].sp || m1.sub[i].ep != m2.sub[i].ep)
+						same = 0;
+			}
+			if (same) {
+				++ok;
+				continue;
+			}
+			if (bad++ < 10) {
+				printf("mismatch /%s/ flags=%d eflags=%d '%s': regexec %d, no captures %d, backtracker %d\n",
+					pat, flags, eflags, str, r1, r3, r2);
+				for (i = 0; i < (int)p->nsub; ++i)
+					printf("\t%d: %d-%d, backtracker %d-%d\n", i,
+						pos(m1.sub[i].sp, str), pos(m1.sub[i].ep, str),
+						pos(m2.sub[i].sp, str), pos(m2.sub[i].ep, str));
+			}
+		}
+		regfree(p);
+	}
+	printf("%d agree (%d matches), %d differ\n", ok, matched, bad);
+	return bad > 0;
+}
+#endif